@@ -1,9 +1,279 @@
-#!/usr/bin/python
+#!/usr/bin/python3
 
+import asyncio
+import fcntl
+import os
 import serial
+import signal
+import struct
+import termios
+import time
+
+ACK = "\x06" # Status byte for an accepted line in machine mode.
+NAK = "\x15" # Status byte for a syntax error in machine mode.
+PROMPT = "kurumi> "        # Ends the response to a line in human mode.
+ERROR = "syntax error!"    # Precedes the prompt on errors in human mode.
+RECV_WINDOW = 31 # Bytes the shell can buffer before reading them.
+
+STATS_FRAME = "S" # Starts the reply to "stats binary", then its length.
+STREAM_SYNC = "\xa5"   # Start of a frame in stream mode.
+STREAM_ESCAPE = "\x1b" # Ends stream mode, in place of a frame.
+
+class KurumiError(Exception):
+	pass
+
+SCRIPT_LINES = 1000 # Line numbers 0 to 999 in the shell.
+SCRIPT_SIZE = 1000  # Bytes of instructions in the shell.
+SCRIPT_SLOTS = 4    # Scripts running concurrently in the shell.
+SCRIPT_NESTING = 8  # Repeat and call levels a script can go into.
+
+# Sent before a script, "run" then starts it in slot 0 whichever slot the
+# last script selected. "clear" resets the other slots.
+UPLOAD_PREAMBLE = ["stop", "slot 0", "red off", "green off", "blue off", "clear"]
+
+# "stop" only stops the selected slot, this stops them all and selects slot 0.
+STOP_SLOTS = sum([["slot %d" % (n), "stop"] for n in range(SCRIPT_SLOTS - 1, -1, -1)], [])
+
+# Shell commands usable in scripts and their operands, as in opcode.h: "b" is
+# a byte and "w" a word.
+OPCODES = {
+	"autostart off": "", "autostart on": "",
+	"red": "b", "red off": "", "red on": "", "red toggle": "",
+	"green": "b", "green off": "", "green on": "", "green toggle": "",
+	"blue": "b", "blue off": "", "blue on": "", "blue toggle": "",
+	"fade red": "bw", "fade green": "bw", "fade blue": "bw",
+	"call": "w", "end": "", "goto": "w", "repeat": "w", "return": "",
+	"clear": "", "dump": "", "load": "", "run": "", "save": "",
+	"sleep": "w", "slot": "b", "start": "w", "state": "", "stop": "",
+	"stats": "", "stats binary": "", "stats clear": "", "stream": "w",
+	"timing": "", "mode human": "", "mode machine": "",
+}
+
+COLORS = ["red", "green", "blue"]
+FLOW = ["call", "end", "goto", "repeat", "return"]
+TARGETS = ["call", "goto", "start"] # Commands taking a line number.
+
+class ScriptCompiler(object):
+	"""Parses script lines and removes what makes no visible difference.
+
+	Commands between two sleeps take no time, so for each LED only their
+	combined effect is kept, LED commands that set what is already known to
+	be shown are dropped, and adjacent sleeps are merged. Lines that are
+	jumped to start over with nothing known. Repeated blocks are then
+	folded into repeat loops, if the script does not jump by line number."""
+
+	def __init__(self):
+		self.lines_in = 0
+
+	def parse(self, line, line_no):
+		words = line.split()
+		if len(words) == 0:
+			return None
+		for n in range(len(words), 0, -1):
+			keyword = " ".join(words[:n])
+			if keyword in OPCODES:
+				args = words[n:]
+				break
+		else:
+			raise KurumiError("line %d: unknown command: %s" % (line_no, line))
+		operands = OPCODES[keyword]
+		if len(args) != len(operands):
+			raise KurumiError("line %d: wrong number of operands: %s" % (line_no, line))
+		values = []
+		for arg, kind in zip(args, operands):
+			if not arg.isdigit() or int(arg) > (0xff if kind == "b" else 0xffff):
+				raise KurumiError("line %d: bad operand: %s" % (line_no, line))
+			values.append(int(arg))
+		return (keyword, tuple(values))
+
+	def size(self, insn):
+		size = 1
+		for kind in OPCODES[insn[0]]:
+			size += 1 if kind == "b" else 2
+		return size
+
+	def text(self, insn):
+		return " ".join([insn[0]] + [str(value) for value in insn[1]])
+
+	def _led(self, insn):
+		"""Returns the color and effect of an LED command, if it is one."""
+		words = insn[0].split()
+		if words[0] in COLORS:
+			if len(words) == 1:
+				return words[0], ("set", insn[1][0])
+			return words[0], {"off": ("set", 0), "on": ("set", 255),
+							  "toggle": ("toggle",)}[words[1]]
+		if words[0] == "fade":
+			return words[1], ("fade",) + insn[1]
+		return None, None
+
+	def _led_insn(self, color, effect):
+		if effect[0] == "toggle":
+			return ("%s toggle" % (color), ())
+		if effect[0] == "fade":
+			return ("fade %s" % (color), effect[1:])
+		if effect[1] == 0:
+			return ("%s off" % (color), ())
+		if effect[1] == 255:
+			return ("%s on" % (color), ())
+		return (color, (effect[1],))
+
+	def _optimize(self, insns, targets, concurrent, dimmed):
+		out = []    # (old line, instruction) pairs.
+		pending = {} # Combined effect per color since the last sleep.
+		order = []
+		known = {}  # Levels known to be shown.
+		state = {"sleep": None, "led": 0}
+
+		def flush():
+			line_no = state["led"] # Last line that went into the effects.
+			for color in order:
+				effect = pending[color]
+				if effect is None:
+					continue
+				if effect[0] == "toggle" and color in known:
+					effect = ("set", 0 if known[color] > 0 else 255)
+				if effect[0] == "set" and known.get(color) == effect[1]:
+					continue
+				out.append((line_no, self._led_insn(color, effect)))
+				if effect[0] == "set" and not concurrent:
+					known[color] = effect[1]
+				else:
+					known.pop(color, None)
+				state["sleep"] = None
+			pending.clear()
+			del order[:]
+
+		for line_no, insn in enumerate(insns):
+			if line_no in targets or line_no == 0:
+				flush()
+				known.clear()
+				state["sleep"] = None
+			if insn is None:
+				continue
+
+			color, effect = self._led(insn)
+			if color is not None:
+				previous = pending.get(color)
+				if previous is not None and previous[0] == "fade":
+					flush() # Fades start from the current level.
+					previous = None
+				if effect[0] == "toggle" and previous is not None:
+					if previous[0] == "toggle":
+						# Only fully on or off comes back after two toggles.
+						if color in dimmed:
+							flush()
+						else:
+							effect = None
+					else:
+						effect = ("set", 0 if previous[1] > 0 else 255)
+				elif effect[0] == "fade" and previous is not None:
+					flush()
+				if color not in order:
+					order.append(color)
+				pending[color] = effect
+				state["led"] = line_no
+				continue
+
+			if insn[0] == "sleep":
+				flush()
+				if insn[1][0] == 0:
+					continue
+				if state["sleep"] is not None:
+					merged = out[state["sleep"]][1][1][0] + insn[1][0]
+					if merged <= 0xffff:
+						out[state["sleep"]] = (out[state["sleep"]][0], ("sleep", (merged,)))
+						continue
+				out.append((line_no, insn))
+				state["sleep"] = len(out) - 1
+				continue
+
+			# Anything else keeps its place, and jumps forget what is shown.
+			flush()
+			out.append((line_no, insn))
+			state["sleep"] = None
+			if insn[0] in FLOW:
+				known.clear()
+
+		flush()
+		return out
+
+	def _renumber(self, insns, out):
+		"""Points line numbers at the instruction that now comes first."""
+		new_line = {}
+		index = len(out)
+		for line_no in range(len(insns), -1, -1):
+			while index > 0 and out[index - 1][0] >= line_no:
+				index -= 1
+			new_line[line_no] = index
+		result = []
+		for line_no, insn in out:
+			if insn[0] in TARGETS:
+				insn = (insn[0], (new_line[min(insn[1][0], len(insns))],))
+			result.append(insn)
+		return result
+
+	def _fold(self, insns, levels):
+		"""Folds repeated blocks, and blocks repeated inside them, up to the
+		given number of repeat levels."""
+		if levels == 0:
+			return insns
+		out = []
+		i = 0
+		while i < len(insns):
+			best = None
+			for length in range(1, (len(insns) - i) // 2 + 1):
+				if insns[i + length - 1][0] in FLOW:
+					break
+				if insns[i + length] != insns[i]:
+					continue
+				block = insns[i:i + length]
+				count = 1
+				while count < 0xffff and insns[i + (count * length):i + ((count + 1) * length)] == block:
+					count += 1
+				saving = ((count - 1) * length) - 2
+				if count > 1 and saving > 0 and (best is None or saving > best[0]):
+					best = (saving, length, count)
+			if best is None:
+				out.append(insns[i])
+				i += 1
+				continue
+			saving, length, count = best
+			out.append(("repeat", (count,)))
+			out += self._fold(insns[i:i + length], levels - 1)
+			out.append(("end", ()))
+			i += length * count
+		return out
+
+	def compile(self, lines):
+		insns = [self.parse(line, line_no) for line_no, line in enumerate(lines)]
+		self.lines_in = len([insn for insn in insns if insn is not None])
+		targets = set([insn[1][0] for insn in insns if insn is not None and insn[0] in TARGETS])
+		concurrent = len([insn for insn in insns if insn is not None and insn[0] in ("slot", "start")]) > 0
+
+		dimmed = set()
+		for insn in insns:
+			color, effect = self._led(insn) if insn is not None else (None, None)
+			if color is not None and (effect[0] == "fade" or
+			                          (effect[0] == "set" and effect[1] not in (0, 255))):
+				dimmed.add(color)
+
+		result = self._renumber(insns, self._optimize(insns, targets, concurrent, dimmed))
+		if len(targets) == 0:
+			depth = nesting = 0
+			for insn in result:
+				depth += {"repeat": 1, "end": -1}.get(insn[0], 0)
+				nesting = max(nesting, depth)
+			result = self._fold(result, SCRIPT_NESTING - nesting)
+
+		if len(result) > SCRIPT_LINES or sum([self.size(insn) for insn in result]) > SCRIPT_SIZE:
+			raise KurumiError("script does not fit: %d instructions, %d bytes" %
+				(len(result), sum([self.size(insn) for insn in result])))
+
+		return [self.text(insn) for insn in result]
 
 class Kurumi(object):
-	def __init__(self, port):
+	def __init__(self, port, machine=True):
 		self.s = serial.Serial()
 		self.s.port = port
 		self.s.baudrate = 9600
@@ -18,67 +288,530 @@ class Kurumi(object):
 		self.s.open()
 		self.s.flushInput()
 		self.s.flushOutput()
+
+		self.machine = machine
+		if machine:
+			self._machine_mode()
+		else:
+			self._write("\r")   # Terminate any partially typed line...
+			time.sleep(0.1)
+			self.s.flushInput() # ...and throw away the prompt.
 	
 	def __del__(self):
 		self.s.close()
 
+	def _write(self, text):
+		self.s.write(text.encode("latin-1"))
+
+	def _read(self):
+		return self.s.read(1).decode("latin-1")
+
+	def _machine_mode(self):
+		self._write("\r")   # Terminate any partially typed line...
+		time.sleep(0.1)
+		self.s.flushInput() # ...and throw away the prompt or status.
+		self._write("mode machine\r")
+		while self._read() != ACK: # Skip the echo from human mode.
+			pass
+
+	def _response(self, cmd):
+		reply = ""
+		while True:
+			char = self._read()
+			if self.machine and reply == "" and char == STATS_FRAME:
+				# Binary, so it may hold ACK and NAK bytes itself.
+				length = self._read()
+				reply = char + length
+				while len(reply) < 2 + ord(length):
+					reply += self._read()
+			elif self.machine:
+				if char == ACK:
+					return reply
+				elif char == NAK:
+					raise KurumiError("syntax error: %s" % (cmd))
+				reply += char
+			else:
+				reply += char
+				if reply.endswith(PROMPT):
+					if ERROR in reply:
+						raise KurumiError("syntax error: %s" % (cmd))
+					# Strip the echo and the prompt.
+					return reply[len(cmd):-len(PROMPT)].strip("\r\n")
+
+	def _commands(self, cmds):
+		"""Sends lines back to back and returns their replies.
+
+		The shell reads lines from a small receive buffer, so only as many
+		lines are sent ahead as fit in it. Every response frees the space of
+		its line again."""
+		replies = []
+		pending = []
+		in_flight = 0
+		for cmd in cmds:
+			print(">", cmd)
+			while len(pending) > 0 and in_flight + len(cmd) + 1 > RECV_WINDOW:
+				done = pending.pop(0)
+				replies.append(self._response(done))
+				in_flight -= len(done) + 1
+			self._write(cmd + "\r")
+			pending.append(cmd)
+			in_flight += len(cmd) + 1
+		for cmd in pending:
+			replies.append(self._response(cmd))
+		return replies
+
 	def _command(self, cmd):
-		print ">", cmd
-		for char in cmd:
-			self.s.write(char) # Write one character at a time...
-			self.s.read(1)     # ...and read the echo.
-		self.s.write("\r") # Finish command...
-		self.s.read(10)    # ...and read the prompt.
+		return self._commands([cmd])[0]
+
+	def _upload(self, lines):
+		compiler = ScriptCompiler()
+		lines = compiler.compile(lines)
+		print("compiled %d commands into %d instructions" % (compiler.lines_in, len(lines)))
+		cmds = UPLOAD_PREAMBLE[:]
+		cmds += ["%s %s" % (line_no, line) for line_no, line in enumerate(lines)]
+		start = time.time()
+		self._commands(cmds)
+		elapsed = time.time() - start
+		size = sum([len(cmd) + 1 for cmd in cmds])
+		print("uploaded %d bytes in %.2f s, %d bytes/s" % (size, elapsed, size / max(elapsed, 0.001)))
+		self._command("run")
 
 	def script(self, filename):
-		self._command("stop")
-		self._command("red off")
-		self._command("green off")
-		self._command("blue off")
-		self._command("clear")
 		with open(filename) as fh:
-			for line_no, line in enumerate(fh):
-				self._command("%s %s" % (line_no, line.strip()))
-		self._command("run")
+			self._upload([line.strip() for line in fh])
+
+	def _dump(self):
+		"""Reads back the script as {line number: command}."""
+		lines = {}
+		for text in self._command("dump").split("\r\n"):
+			if text.endswith(" <--"): # Marks the next line to run.
+				text = text[:-4]
+			if text == "":
+				continue
+			line_no, cmd = text.split(": ", 1)
+			lines[int(line_no)] = cmd
+		return lines
+
+	def sync(self, filename):
+		"""Like script(), but only sends the lines that differ."""
+		compiler = ScriptCompiler()
+		with open(filename) as fh:
+			lines = compiler.compile([line.strip() for line in fh])
+		current = self._dump()
+
+		# Shrinking lines first, so the buffer does not fill up in between.
+		changes = []
+		for line_no in range(max([len(lines)] + [n + 1 for n in current.keys()])):
+			new = lines[line_no] if line_no < len(lines) else ""
+			old = current.get(line_no, "")
+			if new == old:
+				continue
+			new_size = compiler.size(compiler.parse(new, line_no)) if new != "" else 1
+			old_size = compiler.size(compiler.parse(old, line_no)) if old != "" else 1
+			changes.append((new_size - old_size, ("%d %s" % (line_no, new)).strip()))
+		changes.sort()
+		print("%d of %d lines changed" % (len(changes), len(lines)))
+
+		self._commands(STOP_SLOTS + ["red off", "green off", "blue off"] +
+		               [cmd for growth, cmd in changes])
+		self._command("start 0")
+
+	def _blink_lines(self, color, times):
+		return ["repeat %d" % (times),
+		        "%s on" % (color),
+		        "sleep 100",
+		        "%s off" % (color),
+		        "sleep 100",
+		        "end"]
 
 	def blink(self, times):
-		self._command("stop")
-		self._command("red off")
-		self._command("green off")
-		self._command("blue off")
-		self._command("clear")
-		line_no = 0
+		lines = []
 
 		if times >= 25:
-			for i in range(0, times / 25):
-				self._command("%s red on"    % (line_no))
-				self._command("%s sleep 100" % (line_no + 1))
-				self._command("%s red off"   % (line_no + 2))
-				self._command("%s sleep 100" % (line_no + 3))
-				line_no += 4
+			lines += self._blink_lines("red", times // 25)
 			times = times % 25
 
 		if times >= 5:
-			for i in range(0, times / 5):
-				self._command("%s green on"  % (line_no))
-				self._command("%s sleep 100" % (line_no + 1))
-				self._command("%s green off" % (line_no + 2))
-				self._command("%s sleep 100" % (line_no + 3))
-				line_no += 4
+			lines += self._blink_lines("green", times // 5)
 			times = times % 5
 
-		for i in range(0, times):
-			self._command("%s blue on"   % (line_no))
-			self._command("%s sleep 100" % (line_no + 1))
-			self._command("%s blue off"  % (line_no + 2))
-			self._command("%s sleep 100" % (line_no + 3))
-			line_no += 4
+		if times > 0:
+			lines += self._blink_lines("blue", times)
 
-		self._command("%s sleep 1000" % (line_no))
-		self._command("run")
+		lines.append("sleep 1000")
+		self._upload(lines)
+
+	def stream(self, frames, period):
+		"""Send (red, green, blue) levels to be shown every period ms."""
+		self._command("stream %d" % (period))
+		start = time.time()
+		for count, (red, green, blue) in enumerate(frames):
+			seq = count % 256
+			self._write(STREAM_SYNC + chr(seq) + chr(red) + chr(green) + chr(blue))
+			# Stay at most one frame ahead of the device.
+			delay = start + ((count + 1) * period / 1000.0) - time.time()
+			if delay > 0:
+				time.sleep(delay)
+		self._write(STREAM_ESCAPE)
+		return self._response("") # Report, then the usual ACK or prompt.
+
+class KurumiBoard(object):
+	"""A board driven from an asyncio event loop, so that many can be
+	driven at once. Only machine mode is used."""
+
+	def __init__(self, port, baud=9600):
+		self.port = port
+		self.baud = baud
+		self.fd = None
+		self.received = ""
+		self.readable = asyncio.Event()
+		self.upload_time = None
+		self.run_sent = None
+		self.run_acked = None
+
+	def open(self):
+		self.fd = os.open(self.port, os.O_RDWR | os.O_NOCTTY | os.O_NONBLOCK)
+		# 9600 baud unless given, 8 data bits, 1 stop bit, no parity, raw.
+		speed = getattr(termios, "B%d" % (self.baud))
+		iflag, oflag, cflag, lflag, ispeed, ospeed, cc = termios.tcgetattr(self.fd)
+		cflag = termios.CS8 | termios.CREAD | termios.CLOCAL
+		cc[termios.VMIN] = 0
+		cc[termios.VTIME] = 0
+		termios.tcsetattr(self.fd, termios.TCSANOW,
+		                  [0, 0, cflag, 0, speed, speed, cc])
+		# DTR puts the chip into flashing mode, pseudo terminals have none.
+		try:
+			fcntl.ioctl(self.fd, termios.TIOCMBIC, struct.pack("I", termios.TIOCM_DTR))
+		except OSError:
+			pass
+		termios.tcflush(self.fd, termios.TCIOFLUSH)
+		asyncio.get_running_loop().add_reader(self.fd, self._readable)
+
+	def close(self):
+		if self.fd is not None:
+			asyncio.get_running_loop().remove_reader(self.fd)
+			os.close(self.fd)
+			self.fd = None
+
+	def _readable(self):
+		self.received += os.read(self.fd, 256).decode("latin-1")
+		self.readable.set()
+
+	async def _read(self):
+		while self.received == "":
+			self.readable.clear()
+			await self.readable.wait()
+		char = self.received[0]
+		self.received = self.received[1:]
+		return char
+
+	async def _write(self, text):
+		data = text.encode("latin-1")
+		while len(data) > 0:
+			try:
+				data = data[os.write(self.fd, data):]
+			except BlockingIOError:
+				await asyncio.sleep(0.001)
+
+	async def _response(self, cmd):
+		reply = ""
+		while True:
+			char = await self._read()
+			if reply == "" and char == STATS_FRAME:
+				# Binary, so it may hold ACK and NAK bytes itself.
+				length = await self._read()
+				reply = char + length
+				while len(reply) < 2 + ord(length):
+					reply += await self._read()
+			elif char == ACK:
+				return reply
+			elif char == NAK:
+				raise KurumiError("%s: syntax error: %s" % (self.port, cmd))
+			else:
+				reply += char
+
+	async def machine_mode(self):
+		await self._write("\r")
+		await asyncio.sleep(0.1)
+		self.received = ""
+		await self._write("mode machine\r")
+		while await self._read() != ACK:
+			pass
+
+	async def commands(self, cmds):
+		"""Same receive window as Kurumi._commands()."""
+		pending = []
+		in_flight = 0
+		for cmd in cmds:
+			while len(pending) > 0 and in_flight + len(cmd) + 1 > RECV_WINDOW:
+				done = pending.pop(0)
+				await self._response(done)
+				in_flight -= len(done) + 1
+			await self._write(cmd + "\r")
+			pending.append(cmd)
+			in_flight += len(cmd) + 1
+		for cmd in pending:
+			await self._response(cmd)
+
+	async def upload(self, lines):
+		start = time.monotonic()
+		await self.machine_mode()
+		cmds = UPLOAD_PREAMBLE[:]
+		cmds += ["%s %s" % (line_no, line) for line_no, line in enumerate(lines)]
+		await self.commands(cmds)
+		self.upload_time = time.monotonic() - start
+
+	async def run_acknowledged(self):
+		await self._response("run")
+		self.run_acked = time.monotonic()
+
+async def wall(ports, filename):
+	"""Uploads a script to every board in parallel, then starts them all
+	at once and reports the upload times and the start skew."""
+	compiler = ScriptCompiler()
+	with open(filename) as fh:
+		lines = compiler.compile([line.strip() for line in fh])
+	print("compiled %d commands into %d instructions" % (compiler.lines_in, len(lines)))
+
+	boards = [KurumiBoard(port) for port in ports]
+	try:
+		for board in boards:
+			board.open()
+		await asyncio.gather(*[board.upload(lines) for board in boards])
+
+		# The run barrier: every board is idle and waiting for a line, so
+		# write them all back to back before looking at any answers.
+		for board in boards:
+			os.write(board.fd, b"run\r")
+			board.run_sent = time.monotonic()
+		await asyncio.gather(*[board.run_acknowledged() for board in boards])
+	finally:
+		for board in boards:
+			board.close()
+
+	first = boards[0].run_sent
+	for board in boards:
+		print("%s: upload %.2f s, run sent +%.1f ms, acknowledged +%.1f ms" %
+		      (board.port, board.upload_time, (board.run_sent - first) * 1000,
+		       (board.run_acked - first) * 1000))
+	acked = [board.run_acked for board in boards]
+	print("start skew: %.1f ms" % ((max(acked) - min(acked)) * 1000))
+
+BENCH_MIX = ["red on", "green 128", "blue 255", "fade red 0 50", "red off",
+             "green off", "blue off", "stop"] # Commands cycled through.
+BENCH_TIMEOUT = 1.0 # Seconds to wait for an answer before counting it lost.
+BENCH_QUIET = 0.5   # Seconds without output that end a flood.
+STATS_RX_DROPPED = 5 # Index in the "stats binary" frame, see stats.h.
+
+class KurumiBench(KurumiBoard):
+	"""A board that keeps the arrival time of every character it receives,
+	for measuring the console from the host. Human mode is used too."""
+
+	def __init__(self, label, port, baud=9600):
+		KurumiBoard.__init__(self, port, baud)
+		self.label = label
+		self.arrivals = []
+		self.arrived = None # Arrival time of the last character read.
+		self.results = []
+
+	def _readable(self):
+		data = os.read(self.fd, 256).decode("latin-1")
+		self.received += data
+		self.arrivals += [time.monotonic()] * len(data)
+		self.readable.set()
+
+	async def _read(self):
+		# The base class throws away what it received at times.
+		del self.arrivals[:len(self.arrivals) - len(self.received)]
+		char = await KurumiBoard._read(self)
+		self.arrived = self.arrivals.pop(0)
+		return char
+
+	async def _expect(self, text):
+		"""Reads up to the end of text, False if it did not come in time."""
+		reply = ""
+		while not reply.endswith(text):
+			try:
+				reply += await asyncio.wait_for(self._read(), BENCH_TIMEOUT)
+			except asyncio.TimeoutError:
+				return False
+		return True
+
+	async def _quiet(self):
+		"""Skips everything up to BENCH_QUIET seconds of silence."""
+		count = 0
+		while True:
+			try:
+				await asyncio.wait_for(self._read(), BENCH_QUIET)
+				count += 1
+			except asyncio.TimeoutError:
+				return count
+
+	async def machine_mode(self):
+		try:
+			await asyncio.wait_for(KurumiBoard.machine_mode(self), BENCH_TIMEOUT + 0.1)
+		except asyncio.TimeoutError:
+			raise KurumiError("%s: no answer to mode machine" % (self.port))
+
+	async def human_mode(self):
+		await self._write("\rmode human\r")
+		await self._quiet() # The ACK or the prompts.
+
+	def _result(self, test, latencies, elapsed, count, dropped):
+		self.results.append((test, latencies, count, count / elapsed if elapsed > 0 else 0.0,
+		                     dropped))
+
+	async def echo(self, count):
+		"""Types the commands a character at a time, as a person would, and
+		times each echo, then the prompt after the carriage return."""
+		await self.human_mode()
+		echoes = []
+		prompts = []
+		dropped = 0
+		start = time.monotonic()
+		for i in range(count):
+			for char in BENCH_MIX[i % len(BENCH_MIX)]:
+				await self._write(char)
+				sent = time.monotonic()
+				if await self._expect(char):
+					echoes.append(self.arrived - sent)
+				else:
+					dropped += 1
+			await self._write("\r")
+			sent = time.monotonic()
+			if await self._expect(PROMPT):
+				prompts.append(self.arrived - sent)
+			else:
+				dropped += 1
+		elapsed = time.monotonic() - start
+		self._result("echo", echoes, elapsed, len(echoes), dropped)
+		self._result("prompt", prompts, elapsed, len(prompts), 0)
+
+	async def ack(self, count):
+		"""One line at a time in machine mode, from sending the line to its
+		ACK, which the shell sends once the command has taken effect."""
+		await self.machine_mode()
+		latencies = []
+		dropped = 0
+		start = time.monotonic()
+		for i in range(count):
+			await self._write(BENCH_MIX[i % len(BENCH_MIX)] + "\r")
+			sent = time.monotonic()
+			try:
+				await asyncio.wait_for(self._response(BENCH_MIX[i % len(BENCH_MIX)]),
+				                       BENCH_TIMEOUT)
+				latencies.append(self.arrived - sent)
+			except asyncio.TimeoutError:
+				dropped += 1
+				await self.machine_mode()
+		self._result("ack", latencies, time.monotonic() - start, len(latencies), dropped)
+
+	async def throughput(self, count):
+		"""Lines sent ahead within the receive window, as for uploads."""
+		await self.machine_mode()
+		cmds = [BENCH_MIX[i % len(BENCH_MIX)] for i in range(count)]
+		start = time.monotonic()
+		await self.commands(cmds)
+		self._result("throughput", [], time.monotonic() - start, count, 0)
+
+	async def _rx_dropped(self):
+		await self._write("\r") # End whatever is left of a mangled line.
+		await self._quiet()
+		await self._write("stats binary\r")
+		frame = await asyncio.wait_for(self._response("stats binary"), BENCH_TIMEOUT)
+		offset = 2 + STATS_RX_DROPPED * 4
+		return struct.unpack("<I", frame[offset:offset + 4].encode("latin-1"))[0]
+
+	async def flood(self, count):
+		"""Every line at once, ignoring the receive window, then counts the
+		answers and the bytes the shell had to drop."""
+		await self.machine_mode()
+		await self.commands(["stats clear"])
+		cmds = [BENCH_MIX[i % len(BENCH_MIX)] for i in range(count)]
+		start = time.monotonic()
+		await self._write("".join([cmd + "\r" for cmd in cmds]))
+		answers = 0
+		last = start
+		while True:
+			try:
+				char = await asyncio.wait_for(self._read(), BENCH_QUIET)
+			except asyncio.TimeoutError:
+				break
+			if char == ACK or char == NAK:
+				answers += 1
+				last = self.arrived
+		dropped = await self._rx_dropped()
+		self._result("flood", [], last - start, answers, dropped)
+
+	async def run(self, count):
+		self.open()
+		try:
+			await self.echo(count)
+			await self.ack(count)
+			await self.throughput(count)
+			await self.flood(count)
+			await self.human_mode()
+		finally:
+			self.close()
+
+def percentile(values, p):
+	values = sorted(values)
+	return values[int(round((len(values) - 1) * p / 100.0))]
+
+async def bench(targets, count):
+	"""Measures each target in turn: "label=port", "label=port@baud" or
+	"label=emu:kurumi.elf", which starts the emulator and uses its pty."""
+	emu = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+	                   "..", "kurumi-shell", "emu", "kurumi-emu")
+	print("%-12s %7s %-10s %6s %9s %9s %9s %7s" %
+	      ("target", "baud", "test", "count", "p50 ms", "p99 ms", "cmds/s", "dropped"))
+	for target in targets:
+		label, port = target.split("=", 1)
+		baud = 9600
+		if "@" in port:
+			port, baud = port.rsplit("@", 1)
+			baud = int(baud)
+
+		proc = None
+		if port.startswith("emu:"):
+			proc = await asyncio.create_subprocess_exec(emu, port[4:],
+				stdout=asyncio.subprocess.DEVNULL, stderr=asyncio.subprocess.PIPE)
+			line = (await proc.stderr.readline()).decode()
+			if not line.startswith("uart0: "):
+				raise KurumiError("%s: %s" % (emu, line.strip()))
+			port = line.split(" ", 1)[1].strip()
+
+		board = KurumiBench(label, port, baud)
+		try:
+			await board.run(count)
+		finally:
+			if proc is not None:
+				proc.send_signal(signal.SIGINT)
+				await proc.communicate()
+
+		for test, latencies, done, rate, dropped in board.results:
+			if len(latencies) > 0:
+				p50 = "%9.2f" % (percentile(latencies, 50) * 1000)
+				p99 = "%9.2f" % (percentile(latencies, 99) * 1000)
+			else:
+				p50 = p99 = "%9s" % ("-")
+			print("%-12s %7d %-10s %6d %s %s %9.1f %7d" %
+			      (label, baud, test, done, p50, p99, rate, dropped))
 
 if __name__ == "__main__":
 	import sys
+
+	if len(sys.argv) > 3 and sys.argv[1] == "-w":
+		asyncio.run(wall(sys.argv[3:], sys.argv[2]))
+		sys.exit(0)
+
+	if len(sys.argv) > 2 and sys.argv[1] == "-b":
+		if sys.argv[2] == "-n" and len(sys.argv) > 4:
+			asyncio.run(bench(sys.argv[4:], int(sys.argv[3])))
+		else:
+			asyncio.run(bench(sys.argv[2:], 100))
+		sys.exit(0)
+
 	k = Kurumi("/dev/ttyUSB0")
 
 	if len(sys.argv) > 1:
@@ -87,11 +820,15 @@ if __name__ == "__main__":
 		except ValueError:
 			times = None
 
-		if times == None:
+		if sys.argv[1] == "-s" and len(sys.argv) > 2:
+			k.sync(sys.argv[2])
+		elif times == None:
 			k.script(sys.argv[1])
 		else:
 			k.blink(times)
 
 	else:
-		print "Usage: %s <script file | times to blink>" % (sys.argv[0])
+		print("Usage: %s <script file | -s script file | times to blink>" % (sys.argv[0]))
+		print("       %s -w <script file> <port>..." % (sys.argv[0]))
+		print("       %s -b [-n count] <label=port[@baud] | label=emu:kurumi.elf>..." % (sys.argv[0]))
 
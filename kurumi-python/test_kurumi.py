@@ -0,0 +1,82 @@
+#!/usr/bin/python3
+
+# Regression tests of the script compiler, run with "python3 test_kurumi.py".
+
+import sys
+import types
+import unittest
+
+try:
+	import serial
+except ImportError:
+	sys.modules["serial"] = types.ModuleType("serial") # Only needed for boards.
+
+import kurumi
+
+BLINK = ["red on", "sleep 100", "red off", "sleep 100"]
+
+class TestFold(unittest.TestCase):
+	def compile(self, lines):
+		return kurumi.ScriptCompiler().compile(lines)
+
+	def test_unrolled(self):
+		self.assertEqual(self.compile(BLINK * 5), ["repeat 5"] + BLINK + ["end"])
+
+	def test_nested(self):
+		inner = ["green on", "sleep 10", "green off", "sleep 10"]
+		block = inner * 3 + ["blue on", "sleep 50", "blue off", "sleep 50"]
+		self.assertEqual(self.compile(block * 4),
+			["repeat 4", "repeat 3"] + inner + ["end"] + block[12:] + ["end"])
+
+	def test_nested_written(self):
+		lines = ["repeat 3", "repeat 2"] + BLINK + ["end", "sleep 5", "end"]
+		self.assertEqual(self.compile(lines), lines)
+
+	def test_nesting_limit(self):
+		# Already as deep as the shell goes, so nothing more is folded.
+		depth = kurumi.SCRIPT_NESTING
+		lines = ["repeat 2"] * depth + BLINK * 3 + ["end"] * depth
+		self.assertEqual(self.compile(lines), lines)
+
+	def test_no_saving(self):
+		# Two lines twice take as much space as a repeat around them.
+		lines = ["red toggle", "sleep 10"] * 2
+		self.assertEqual(self.compile(lines), lines)
+
+	def test_targets(self):
+		# Folding would move the lines that are jumped to.
+		lines = BLINK * 3 + ["goto 4"]
+		self.assertEqual(self.compile(lines), lines)
+
+	def test_flow(self):
+		# Blocks never cross a flow command, the loops are kept as written.
+		block = ["repeat 2"] + BLINK + ["end"]
+		self.assertEqual(self.compile(block * 3), block * 3)
+
+	def test_merged(self):
+		compiler = kurumi.ScriptCompiler()
+		lines = compiler.compile(["red on", "red off", "green on", "sleep 10", "sleep 20"])
+		self.assertEqual(lines, ["red off", "green on", "sleep 30"])
+		self.assertEqual(compiler.lines_in, 5)
+
+class TestLimits(unittest.TestCase):
+	def pairs(self, count):
+		# Different levels, so nothing is merged or folded: 5 bytes per pair.
+		return sum([["red %d" % (n + 1), "sleep 1"] for n in range(count)], [])
+
+	def test_size(self):
+		count = kurumi.SCRIPT_SIZE // 5
+		self.assertEqual(len(kurumi.ScriptCompiler().compile(self.pairs(count))), count * 2)
+		with self.assertRaises(kurumi.KurumiError):
+			kurumi.ScriptCompiler().compile(self.pairs(count + 1))
+
+	def test_lines(self):
+		# Too many lines unrolled, but folded they fit.
+		lines = ["state"] * (kurumi.SCRIPT_LINES + 1)
+		self.assertEqual(kurumi.ScriptCompiler().compile(lines),
+			["repeat %d" % (kurumi.SCRIPT_LINES + 1), "state", "end"])
+		with self.assertRaises(kurumi.KurumiError):
+			kurumi.ScriptCompiler().compile(["call 2", "return"] + lines[2:])
+
+if __name__ == "__main__":
+	unittest.main()
@@ -1,105 +1,78 @@
+#include <stddef.h>
 #include "uart.h"
 #include "script.h"
 #include "opcode.h"
+#include "command.h"
+#include "event.h"
+#include "stats.h"
+#include "stream.h"
+#include "timer.h"
 
-#define COMMAND_MAX 20
+#define COMMAND_MAX 32 /* Fits "999 fade green 255 65535" and more. */
 
-static int command_match(char *cmd, signed char len, char *pattern)
-{
-  int i = 0;
-  for (i = 0; pattern[i] != '\0'; i++) {
-    if (i == len) {
-      return 0;
-    }
-    if (cmd[i] != pattern[i]) {
-      return 0;
-    }
-  }
-  if (len == i) {
-    return 1;
-  } else {
-    return 0;
-  }
-}
+#define COMMAND_STATUS_ACK 0x06 /* Line accepted and executed. */
+#define COMMAND_STATUS_NAK 0x15 /* Syntax error. */
+
+static COMMAND_MODE command_mode = COMMAND_MODE_HUMAN;
 
-static opcode_t command_eval(char *cmd, signed char len)
+static opcode_t command_eval(char *cmd, signed char len, unsigned char *insn)
 {
-  int script_line;
-  opcode_t op = OPCODE_EVAL_ERROR;
+  int i, script_line;
+  opcode_t op;
+
+  insn[0] = OPCODE_NONE;
 
   if (len <= 0) {
     return OPCODE_NONE;
   }
 
   if (cmd[0] >= 0x30 && cmd[0] <= 0x39) {
-    if (cmd[1] >= 0x30 && cmd[1] <= 0x39) {
-      if (cmd[2] == ' ') {
-        script_line = ((cmd[0] - 0x30) * 10) + (cmd[1] - 0x30);
-        op = command_eval(&cmd[3], len - 3);
-      } else {
-        script_line = ((cmd[0] - 0x30) * 10) + (cmd[1] - 0x30);
-        op = command_eval(&cmd[2], len - 2);
-      }
-
-    } else {
-      if (cmd[1] == ' ') {
-        script_line = cmd[0] - 0x30;
-        op = command_eval(&cmd[2], len - 2);
-      } else {
-        script_line = cmd[0] - 0x30;
-        op = command_eval(&cmd[1], len - 1);
+    script_line = 0;
+    for (i = 0; i < len && cmd[i] >= 0x30 && cmd[i] <= 0x39; i++) {
+      script_line = (script_line * 10) + (cmd[i] - 0x30);
+      if (script_line >= SCRIPT_LINES) {
+        return OPCODE_EVAL_ERROR;
       }
     }
+    if (i < len && cmd[i] == ' ') {
+      i++;
+    }
 
+    op = command_eval(&cmd[i], len - i, insn);
     if (op == OPCODE_EVAL_ERROR) {
       return OPCODE_EVAL_ERROR;
-    } else {
-      script_program(script_line, op);
-      return OPCODE_NONE;
     }
+    if (script_program(script_line, insn) != 0) {
+      return OPCODE_EVAL_ERROR; /* Script is full. */
+    }
+    insn[0] = OPCODE_NONE;
+    return OPCODE_NONE;
   }
 
-  if (command_match(cmd, len, opcode_command(OPCODE_SLEEP_10))) {
-    return OPCODE_SLEEP_10;
-  } else if (command_match(cmd, len, opcode_command(OPCODE_SLEEP_50))) {
-    return OPCODE_SLEEP_50;
-  } else if (command_match(cmd, len, opcode_command(OPCODE_SLEEP_100))) {
-    return OPCODE_SLEEP_100;
-  } else if (command_match(cmd, len, opcode_command(OPCODE_SLEEP_500))) {
-    return OPCODE_SLEEP_500;
-  } else if (command_match(cmd, len, opcode_command(OPCODE_SLEEP_1000))) {
-    return OPCODE_SLEEP_1000;
-  } else if (command_match(cmd, len, opcode_command(OPCODE_RED_OFF))) {
-    return OPCODE_RED_OFF;
-  } else if (command_match(cmd, len, opcode_command(OPCODE_RED_ON))) {
-    return OPCODE_RED_ON;
-  } else if (command_match(cmd, len, opcode_command(OPCODE_RED_TOGGLE))) {
-    return OPCODE_RED_TOGGLE;
-  } else if (command_match(cmd, len, opcode_command(OPCODE_GREEN_OFF))) {
-    return OPCODE_GREEN_OFF;
-  } else if (command_match(cmd, len, opcode_command(OPCODE_GREEN_ON))) {
-    return OPCODE_GREEN_ON;
-  } else if (command_match(cmd, len, opcode_command(OPCODE_GREEN_TOGGLE))) {
-    return OPCODE_GREEN_TOGGLE;
-  } else if (command_match(cmd, len, opcode_command(OPCODE_BLUE_OFF))) {
-    return OPCODE_BLUE_OFF;
-  } else if (command_match(cmd, len, opcode_command(OPCODE_BLUE_ON))) {
-    return OPCODE_BLUE_ON;
-  } else if (command_match(cmd, len, opcode_command(OPCODE_BLUE_TOGGLE))) {
-    return OPCODE_BLUE_TOGGLE;
-  } else if (command_match(cmd, len, opcode_command(OPCODE_SCRIPT_RUN))) {
-    return OPCODE_SCRIPT_RUN;
-  } else if (command_match(cmd, len, opcode_command(OPCODE_SCRIPT_STOP))) {
-    return OPCODE_SCRIPT_STOP;
-  } else if (command_match(cmd, len, opcode_command(OPCODE_SCRIPT_DUMP))) {
-    return OPCODE_SCRIPT_DUMP;
-  } else if (command_match(cmd, len, opcode_command(OPCODE_SCRIPT_CLEAR))) {
-    return OPCODE_SCRIPT_CLEAR;
-  } else if (command_match(cmd, len, opcode_command(OPCODE_SCRIPT_STATE))) {
-    return OPCODE_SCRIPT_STATE;
+  return opcode_lookup(cmd, len, insn);
+}
+
+void command_mode_set(COMMAND_MODE mode)
+{
+  command_mode = mode;
+}
+
+/* The error is only shown to humans, machines get a NAK for any. */
+static void command_status(opcode_t op, char *error)
+{
+  char status[2];
+
+  if (command_mode == COMMAND_MODE_MACHINE) {
+    status[0] = (op == OPCODE_EVAL_ERROR) ? COMMAND_STATUS_NAK : COMMAND_STATUS_ACK;
+    status[1] = '\0';
+    uart0_send(status);
+    return;
   }
 
-  return OPCODE_EVAL_ERROR;
+  if (op == OPCODE_EVAL_ERROR) {
+    uart0_send(error);
+  }
+  uart0_send("\r\nkurumi> ");
 }
 
 void command_loop(void)
@@ -107,68 +80,103 @@ void command_loop(void)
   char c;
   char echo[2];
   char command[COMMAND_MAX];
+  unsigned char insn[OPCODE_INSN_MAX];
   signed char command_len;
+  unsigned char command_overflow;
   opcode_t op;
+  unsigned long deadline, stream_deadline;
+  unsigned char pending;
 
-  script_clear();
+  stats_clear();
   uart0_start();
   
   command_len = 0;
+  command_overflow = 0;
 
   while(1) {
-    asm("halt");
-
-    script_execute();
+    event_wait(EVENT_BIT(EVENT_RX) | EVENT_BIT(EVENT_TIMER));
+    stats_count(STATS_LOOPS);
+
+    while (uart0_recv(&c)) {
+      /* Binary frames while streaming, up to the escape byte. */
+      if (stream_active()) {
+        if (stream_input(c)) {
+          stream_report();
+          command_status(OPCODE_NONE, NULL);
+        }
+        continue;
+      }
 
-    c = uart0_recv();
-    if (c == '\0') {
-      continue;
-    }
+      /* Handling of backspace. */
+      if (c == 0x7f) {
+        command_len--;
+        if (command_len < 0) {
+          command_len = 0;
+          continue;
+        }
+
+        if (command_mode == COMMAND_MODE_MACHINE) {
+          continue;
+        }
+
+        echo[0] = 0x08;
+        echo[1] = '\0';
+        uart0_send(echo);
+        echo[0] = ' ';
+        echo[1] = '\0';
+        uart0_send(echo);
+        echo[0] = 0x08;
+        echo[1] = '\0';
+        uart0_send(echo);
 
-    /* Handling of backspace. */
-    if (c == 0x7f) {
-      command_len--;
-      if (command_len < 0) {
-        command_len = 0;
         continue;
       }
-      
-      echo[0] = 0x08;
-      echo[1] = '\0';
-      uart0_send(echo);
-      echo[0] = ' ';
-      echo[1] = '\0';
-      uart0_send(echo);
-      echo[0] = 0x08;
-      echo[1] = '\0';
-      uart0_send(echo);
-
-      continue;
-    }
 
-    if (c == '\r') {
-      op = command_eval(command, command_len);
-      command_len = 0;
+      if (c == '\r') {
+        if (command_overflow) {
+          command_overflow = 0;
+          command_len = 0;
+          command_status(OPCODE_EVAL_ERROR, "\r\nline too long!");
+          continue;
+        }
+
+        op = command_eval(command, command_len, insn);
+        command_len = 0;
       
-      if (op == OPCODE_EVAL_ERROR) {
-        uart0_send("\r\nsyntax error!");
+        if (op != OPCODE_EVAL_ERROR) {
+          opcode_execute(insn);
+          /* Any returned delay is just ignored. */
+        }
+
+        /* The mode may have been changed by the command just executed. */
+        command_status(op, "\r\nsyntax error!");
+      } else if (command_len >= COMMAND_MAX - 1) {
+        /* Rest of the line dropped and not echoed, rejected at its end. */
+        command_overflow = 1;
       } else {
-        opcode_execute(op);
-        /* Any returned delay is just ignored. */
-      }
+        command[command_len] = c;
+        command_len++;
 
-      uart0_send("\r\nkurumi> ");
-    } else {
-      command[command_len] = c;
-      command_len++;
-      if (command_len >= COMMAND_MAX) {
-        command_len = 0;
+        if (command_mode == COMMAND_MODE_MACHINE) {
+          continue;
+        }
+
+        echo[0] = c;
+        echo[1] = '\0';
+        uart0_send(echo);
       }
+    }
 
-      echo[0] = c;
-      echo[1] = '\0';
-      uart0_send(echo);
+    /* Also after commands, which may have started or stopped scripts. */
+    pending = script_execute(&deadline);
+    if (stream_execute(&stream_deadline)) {
+      if (pending == 0 || (long)(stream_deadline - deadline) < 0) {
+        deadline = stream_deadline;
+      }
+      pending = 1;
+    }
+    if (pending) {
+      timer_alarm(deadline);
     }
   }
 }
-
@@ -1,6 +1,12 @@
 #ifndef _COMMAND_H
 #define _COMMAND_H
 
+typedef enum {
+  COMMAND_MODE_HUMAN   = 0, /* Echo, prompts and error messages. */
+  COMMAND_MODE_MACHINE = 1, /* No echo, one status byte per line. */
+} COMMAND_MODE;
+
 void command_loop(void);
+void command_mode_set(COMMAND_MODE mode);
 
 #endif /* _COMMAND_H */
@@ -0,0 +1,1468 @@
+#include <stdio.h>
+#include "cpu.h"
+#include "periph.h"
+
+/* RL78 core, one instruction at a time. Registers, PSW, SP, CS and ES live
+ * in the memory map as on the chip, so register banks and SFR accesses to
+ * them need no special handling. Clock counts follow the instruction table
+ * of the RL78 family user's manual for accesses to RAM and SFRs. */
+
+/* ALU operations in the order of the opcode map rows. */
+#define CPU_ADD  0
+#define CPU_ADDC 1
+#define CPU_SUB  2
+#define CPU_SUBC 3
+#define CPU_CMP  4
+#define CPU_AND  5
+#define CPU_OR   6
+#define CPU_XOR  7
+
+/* Register numbers in instruction encodings. */
+#define CPU_X 0
+#define CPU_A 1
+#define CPU_C 2
+#define CPU_B 3
+#define CPU_E 4
+#define CPU_D 5
+#define CPU_L 6
+#define CPU_H 7
+
+#define CPU_AX 0
+#define CPU_BC 1
+#define CPU_DE 2
+#define CPU_HL 3
+
+#define CPU_MASK 0xfffff
+
+#define CPU_SOURCE_BRK 0x3d /* Vector 0x7e. */
+
+static unsigned long cpu_pc_now = 0;
+static unsigned long cpu_pc_start = 0; /* Of the instruction being executed. */
+static unsigned char cpu_halt = 0;
+static unsigned char cpu_es_prefix = 0;
+static unsigned char cpu_hold = 0; /* Interrupts held after this instruction. */
+static unsigned char cpu_flow_last = CPU_FLOW_NONE;
+static int cpu_clocks = 0;
+static char cpu_message[64];
+
+/* Instruction lengths of the first map, with 0 for prefixes. */
+static const unsigned char cpu_length[256] = {
+  1, 1, 3, 1, 3, 1, 2, 1, 1, 3, 3, 2, 2, 1, 2, 3, /* 0x00 */
+  2, 0, 1, 1, 1, 1, 1, 1, 3, 4, 3, 2, 2, 1, 2, 3, /* 0x10 */
+  2, 1, 3, 1, 3, 1, 2, 1, 3, 3, 3, 2, 2, 1, 2, 3, /* 0x20 */
+  3, 0, 3, 1, 3, 1, 3, 1, 4, 4, 3, 2, 2, 1, 2, 3, /* 0x30 */
+  4, 2, 3, 1, 3, 1, 2, 1, 3, 3, 3, 2, 2, 1, 2, 3, /* 0x40 */
+  2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 2, 2, 1, 2, 3, /* 0x50 */
+  1, 0, 1, 1, 1, 1, 1, 1, 3, 3, 3, 2, 2, 1, 2, 3, /* 0x60 */
+  1, 0, 1, 1, 1, 1, 1, 1, 3, 3, 3, 2, 2, 1, 2, 3, /* 0x70 */
+  1, 1, 1, 1, 1, 1, 1, 1, 2, 1, 2, 1, 2, 2, 2, 3, /* 0x80 */
+  1, 1, 1, 1, 1, 1, 1, 1, 2, 1, 2, 1, 2, 2, 2, 3, /* 0x90 */
+  3, 1, 3, 1, 2, 1, 2, 1, 2, 1, 2, 1, 2, 2, 2, 3, /* 0xa0 */
+  3, 1, 3, 1, 2, 1, 2, 1, 2, 1, 2, 1, 2, 2, 2, 3, /* 0xb0 */
+  1, 1, 1, 1, 1, 1, 1, 1, 3, 4, 3, 4, 3, 3, 3, 4, /* 0xc0 */
+  1, 1, 1, 1, 2, 3, 1, 1, 2, 3, 2, 3, 2, 2, 2, 2, /* 0xd0 */
+  1, 1, 1, 1, 2, 3, 1, 1, 2, 3, 2, 3, 4, 3, 3, 2, /* 0xe0 */
+  1, 1, 1, 1, 2, 3, 1, 1, 2, 3, 2, 3, 4, 3, 3, 1, /* 0xf0 */
+};
+
+static unsigned char cpu_psw_get(void)
+{
+  return periph_memory[CPU_PSW];
+}
+
+static void cpu_psw_set(unsigned char psw)
+{
+  periph_memory[CPU_PSW] = psw;
+}
+
+static void cpu_flag(unsigned char flag, int set)
+{
+  if (set) {
+    periph_memory[CPU_PSW] |= flag;
+  } else {
+    periph_memory[CPU_PSW] &= ~flag;
+  }
+}
+
+static unsigned long cpu_bank(void)
+{
+  unsigned char psw;
+  int bank;
+
+  psw = cpu_psw_get();
+  bank = ((psw & CPU_PSW_RBS1) ? 2 : 0) + ((psw & CPU_PSW_RBS0) ? 1 : 0);
+  return CPU_REGISTERS + (3 - bank) * 8;
+}
+
+static unsigned char cpu_r(int r)
+{
+  return periph_memory[cpu_bank() + r];
+}
+
+static void cpu_r_set(int r, unsigned char value)
+{
+  periph_memory[cpu_bank() + r] = value;
+}
+
+static unsigned int cpu_rp(int rp)
+{
+  unsigned long addr;
+
+  addr = cpu_bank() + rp * 2;
+  return periph_memory[addr] | (periph_memory[addr + 1] << 8);
+}
+
+static void cpu_rp_set(int rp, unsigned int value)
+{
+  unsigned long addr;
+
+  addr = cpu_bank() + rp * 2;
+  periph_memory[addr] = value & 0xff;
+  periph_memory[addr + 1] = (value >> 8) & 0xff;
+}
+
+unsigned int cpu_sp(void)
+{
+  return periph_memory[CPU_SPL] | (periph_memory[CPU_SPH] << 8);
+}
+
+static void cpu_sp_set(unsigned int sp)
+{
+  periph_memory[CPU_SPL] = sp & 0xfe;
+  periph_memory[CPU_SPH] = (sp >> 8) & 0xff;
+}
+
+static unsigned char cpu_read8(unsigned long addr)
+{
+  return periph_read(addr & CPU_MASK);
+}
+
+static unsigned int cpu_read16(unsigned long addr)
+{
+  addr &= ~1UL;
+  return cpu_read8(addr) | (cpu_read8(addr + 1) << 8);
+}
+
+static void cpu_write8(unsigned long addr, unsigned char value)
+{
+  addr &= CPU_MASK;
+
+  /* Writes to PSW and the interrupt flag, mask and priority registers
+   * hold off interrupts until after the next instruction. */
+  if (addr == CPU_PSW || (addr >= 0xfffd0 && addr <= 0xfffef)) {
+    cpu_hold = 1;
+  }
+  periph_write(addr, value);
+}
+
+static void cpu_write16(unsigned long addr, unsigned int value)
+{
+  addr &= ~1UL;
+  cpu_write8(addr, value & 0xff);
+  cpu_write8(addr + 1, (value >> 8) & 0xff);
+}
+
+static unsigned char cpu_fetch8(void)
+{
+  unsigned char value;
+
+  value = cpu_read8(cpu_pc_now);
+  cpu_pc_now = (cpu_pc_now + 1) & CPU_MASK;
+  return value;
+}
+
+static unsigned int cpu_fetch16(void)
+{
+  unsigned int value;
+
+  value = cpu_fetch8();
+  return value | (cpu_fetch8() << 8);
+}
+
+/* Upper address bits for data, from ES after an ES: prefix. */
+static unsigned long cpu_data(unsigned int addr16)
+{
+  if (cpu_es_prefix) {
+    return ((unsigned long)(periph_memory[CPU_ES] & 0x0f) << 16) | (addr16 & 0xffff);
+  }
+  return 0xf0000 | (addr16 & 0xffff);
+}
+
+static unsigned long cpu_addr16(void)
+{
+  return cpu_data(cpu_fetch16());
+}
+
+static unsigned long cpu_saddr(void)
+{
+  unsigned char offset;
+
+  offset = cpu_fetch8();
+  return (offset >= 0x20) ? 0xffe00 + offset : 0xfff00 + offset;
+}
+
+static unsigned long cpu_sfr(void)
+{
+  return 0xfff00 + cpu_fetch8();
+}
+
+static unsigned long cpu_stack(unsigned char offset)
+{
+  return 0xf0000 | ((cpu_sp() + offset) & 0xffff);
+}
+
+static unsigned long cpu_indexed(int rp, unsigned int offset)
+{
+  return cpu_data(cpu_rp(rp) + offset);
+}
+
+static void cpu_push16(unsigned int value)
+{
+  unsigned int sp;
+
+  sp = (cpu_sp() - 2) & 0xffff;
+  cpu_sp_set(sp);
+  periph_write(0xf0000 | sp, value & 0xff);
+  periph_write(0xf0000 | ((sp + 1) & 0xffff), (value >> 8) & 0xff);
+}
+
+static unsigned int cpu_pop16(void)
+{
+  unsigned int sp, value;
+
+  sp = cpu_sp();
+  value = periph_read(0xf0000 | sp) | (periph_read(0xf0000 | ((sp + 1) & 0xffff)) << 8);
+  cpu_sp_set(sp + 2);
+  return value;
+}
+
+static void cpu_call(unsigned long target)
+{
+  unsigned int sp;
+
+  sp = (cpu_sp() - 4) & 0xffff;
+  cpu_sp_set(sp);
+  periph_write(0xf0000 | sp, cpu_pc_now & 0xff);
+  periph_write(0xf0000 | ((sp + 1) & 0xffff), (cpu_pc_now >> 8) & 0xff);
+  periph_write(0xf0000 | ((sp + 2) & 0xffff), (cpu_pc_now >> 16) & 0x0f);
+  periph_write(0xf0000 | ((sp + 3) & 0xffff), 0);
+  cpu_pc_now = target & CPU_MASK;
+  cpu_flow_last = CPU_FLOW_CALL;
+}
+
+void cpu_return(void)
+{
+  unsigned int sp;
+
+  sp = cpu_sp();
+  cpu_pc_now = periph_read(0xf0000 | sp) |
+    (periph_read(0xf0000 | ((sp + 1) & 0xffff)) << 8) |
+    ((unsigned long)(periph_read(0xf0000 | ((sp + 2) & 0xffff)) & 0x0f) << 16);
+  cpu_sp_set(sp + 4);
+  cpu_flow_last = CPU_FLOW_RETURN;
+}
+
+static void cpu_return_interrupt(void)
+{
+  unsigned int sp;
+
+  sp = cpu_sp();
+  cpu_return();
+  cpu_psw_set(periph_read(0xf0000 | ((sp + 3) & 0xffff)));
+  cpu_hold = 1;
+}
+
+static void cpu_branch(int taken, signed char offset)
+{
+  if (taken) {
+    cpu_pc_now = (cpu_pc_now + offset) & CPU_MASK;
+    cpu_clocks = 4;
+  } else {
+    cpu_clocks = 2;
+  }
+}
+
+static unsigned char cpu_alu8(int op, unsigned char a, unsigned char b)
+{
+  unsigned int result, carry;
+
+  carry = (cpu_psw_get() & CPU_PSW_CY) ? 1 : 0;
+
+  switch (op) {
+  case CPU_ADD:
+  case CPU_ADDC:
+    if (op == CPU_ADD) {
+      carry = 0;
+    }
+    result = a + b + carry;
+    cpu_flag(CPU_PSW_AC, (a & 0x0f) + (b & 0x0f) + carry > 0x0f);
+    cpu_flag(CPU_PSW_CY, result > 0xff);
+    break;
+  case CPU_SUB:
+  case CPU_SUBC:
+  case CPU_CMP:
+    if (op != CPU_SUBC) {
+      carry = 0;
+    }
+    result = a - b - carry;
+    cpu_flag(CPU_PSW_AC, (a & 0x0f) < (b & 0x0f) + carry);
+    cpu_flag(CPU_PSW_CY, a < b + carry);
+    break;
+  case CPU_AND:
+    result = a & b;
+    break;
+  case CPU_OR:
+    result = a | b;
+    break;
+  default:
+    result = a ^ b;
+    break;
+  }
+
+  cpu_flag(CPU_PSW_Z, (result & 0xff) == 0);
+  return result & 0xff;
+}
+
+/* ADDW, SUBW and CMPW, on AX. */
+static void cpu_alu16(int op, unsigned int b)
+{
+  unsigned int a, result;
+
+  a = cpu_rp(CPU_AX);
+  if (op == CPU_ADD) {
+    result = a + b;
+    cpu_flag(CPU_PSW_AC, (a & 0x0f) + (b & 0x0f) > 0x0f);
+    cpu_flag(CPU_PSW_CY, result > 0xffff);
+  } else {
+    result = a - b;
+    cpu_flag(CPU_PSW_AC, (a & 0x0f) < (b & 0x0f));
+    cpu_flag(CPU_PSW_CY, a < b);
+  }
+  cpu_flag(CPU_PSW_Z, (result & 0xffff) == 0);
+
+  if (op != CPU_CMP) {
+    cpu_rp_set(CPU_AX, result & 0xffff);
+  }
+}
+
+static unsigned char cpu_inc8(unsigned char value, int delta)
+{
+  unsigned char result;
+
+  result = value + delta;
+  cpu_flag(CPU_PSW_Z, result == 0);
+  if (delta > 0) {
+    cpu_flag(CPU_PSW_AC, (value & 0x0f) == 0x0f);
+  } else {
+    cpu_flag(CPU_PSW_AC, (value & 0x0f) == 0x00);
+  }
+  return result;
+}
+
+/* Read-modify-write of memory with an ALU operation, except CMP. */
+static void cpu_alu8_memory(int op, unsigned long addr, unsigned char b)
+{
+  unsigned char result;
+
+  result = cpu_alu8(op, cpu_read8(addr), b);
+  if (op != CPU_CMP) {
+    cpu_write8(addr, result);
+  }
+}
+
+static void cpu_alu8_a(int op, unsigned char b)
+{
+  unsigned char result;
+
+  result = cpu_alu8(op, cpu_r(CPU_A), b);
+  if (op != CPU_CMP) {
+    cpu_r_set(CPU_A, result);
+  }
+}
+
+static void cpu_skip(int skip)
+{
+  unsigned char op;
+  int length;
+
+  cpu_hold = 1;
+  if (skip == 0) {
+    return;
+  }
+
+  op = cpu_read8(cpu_pc_now);
+  length = cpu_length[op];
+  if (length == 0) {
+    /* Prefixed, see the maps below for the lengths. */
+    unsigned char op2 = cpu_read8(cpu_pc_now + 1);
+    unsigned char hi = op2 >> 4, lo = op2 & 0x0f;
+
+    switch (op) {
+    case 0x11: /* ES:, the length of the prefixed instruction plus one. */
+      length = 1 + cpu_length[op2];
+      break;
+    case 0x31:
+      length = (lo <= 5) ? ((lo & 1) ? 3 : 4) : 2;
+      break;
+    case 0x61:
+      length = 2;
+      if ((lo == 9 && hi <= 8) || op2 == 0xa8 || op2 == 0xab || op2 == 0xad ||
+        op2 == 0xaf || op2 == 0xb8 || op2 == 0xce || op2 == 0xde ||
+        op2 == 0xc3 || op2 == 0xd3) {
+        length = 3;
+      } else if (op2 == 0xaa) {
+        length = 4;
+      }
+      break;
+    default: /* 0x71 */
+      if (hi >= 8) {
+        length = 2;
+      } else {
+        length = (lo == 0 || lo == 8) ? 4 : 3;
+      }
+      break;
+    }
+  }
+
+  cpu_pc_now = (cpu_pc_now + length) & CPU_MASK;
+  cpu_clocks++;
+}
+
+static void cpu_multiply(unsigned char op)
+{
+  unsigned long ax, bc, de, hl, a, b, result;
+
+  ax = cpu_rp(CPU_AX);
+  bc = cpu_rp(CPU_BC);
+  de = cpu_rp(CPU_DE);
+  hl = cpu_rp(CPU_HL);
+
+  switch (op) {
+  case 0x01: /* MULHU */
+    result = ax * bc;
+    cpu_rp_set(CPU_AX, result & 0xffff);
+    cpu_rp_set(CPU_BC, (result >> 16) & 0xffff);
+    cpu_clocks = 2;
+    break;
+  case 0x02: /* MULH */
+    result = (unsigned long)((long)(short)ax * (long)(short)bc);
+    cpu_rp_set(CPU_AX, result & 0xffff);
+    cpu_rp_set(CPU_BC, (result >> 16) & 0xffff);
+    cpu_clocks = 2;
+    break;
+  case 0x03: /* DIVHU */
+    if (de == 0) {
+      cpu_rp_set(CPU_DE, ax);
+      cpu_rp_set(CPU_AX, 0xffff);
+    } else {
+      cpu_rp_set(CPU_AX, ax / de);
+      cpu_rp_set(CPU_DE, ax % de);
+    }
+    cpu_clocks = 9;
+    break;
+  case 0x05: /* MACHU */
+  case 0x06: /* MACH */
+    if (op == 0x05) {
+      result = ax * bc;
+    } else {
+      result = (unsigned long)((long)(short)ax * (long)(short)bc);
+    }
+    a = periph_memory[0xffff0] | (periph_memory[0xffff1] << 8) |
+      ((unsigned long)periph_memory[0xffff2] << 16) | ((unsigned long)periph_memory[0xffff3] << 24);
+    b = (a + result) & 0xffffffffUL;
+    cpu_flag(CPU_PSW_CY, b < a);
+    periph_memory[0xffff0] = b & 0xff;
+    periph_memory[0xffff1] = (b >> 8) & 0xff;
+    periph_memory[0xffff2] = (b >> 16) & 0xff;
+    periph_memory[0xffff3] = (b >> 24) & 0xff;
+    cpu_clocks = 3;
+    break;
+  case 0x0b: /* DIVWU */
+    a = (bc << 16) | ax;
+    b = (hl << 16) | de;
+    if (b == 0) {
+      result = 0xffffffffUL;
+      b = a;
+    } else {
+      result = a / b;
+      b = a % b;
+    }
+    cpu_rp_set(CPU_AX, result & 0xffff);
+    cpu_rp_set(CPU_BC, (result >> 16) & 0xffff);
+    cpu_rp_set(CPU_DE, b & 0xffff);
+    cpu_rp_set(CPU_HL, (b >> 16) & 0xffff);
+    cpu_clocks = 17;
+    break;
+  default:
+    cpu_clocks = -1;
+    break;
+  }
+}
+
+/* Second map, 0x61 prefix. */
+static void cpu_map2(void)
+{
+  unsigned char op, hi, lo, value;
+  unsigned long addr;
+  unsigned int word;
+
+  op = cpu_fetch8();
+  hi = op >> 4;
+  lo = op & 0x0f;
+
+  if (hi < 8) {
+    if (lo < 8) {
+      /* op r,A */
+      value = cpu_alu8(hi, cpu_r(lo), cpu_r(CPU_A));
+      if (hi != CPU_CMP) {
+        cpu_r_set(lo, value);
+      }
+    } else if (lo != 9) {
+      /* op A,r */
+      cpu_alu8_a(hi, cpu_r(lo - 8));
+    } else {
+      addr = cpu_indexed(CPU_HL, cpu_fetch8());
+      switch (hi) {
+      case CPU_ADD:
+      case CPU_SUB:
+      case CPU_CMP:
+        cpu_alu16(hi, cpu_read16(addr)); /* ADDW, SUBW, CMPW AX,[HL+byte] */
+        break;
+      case 5: /* INC [HL+byte] */
+        cpu_write8(addr, cpu_inc8(cpu_read8(addr), 1));
+        cpu_clocks = 2;
+        break;
+      case 6: /* DEC [HL+byte] */
+        cpu_write8(addr, cpu_inc8(cpu_read8(addr), -1));
+        cpu_clocks = 2;
+        break;
+      case 7: /* INCW [HL+byte] */
+        cpu_write16(addr, cpu_read16(addr) + 1);
+        cpu_clocks = 2;
+        break;
+      default:
+        cpu_clocks = -1;
+        break;
+      }
+    }
+    return;
+  }
+
+  /* op A,[HL+B] and op A,[HL+C] */
+  if (lo == 0 || lo == 2) {
+    word = cpu_rp(CPU_HL) + cpu_r(lo == 0 ? CPU_B : CPU_C);
+    cpu_alu8_a(hi - 8, cpu_read8(cpu_data(word)));
+    cpu_clocks = 2;
+    return;
+  }
+
+  /* CALLT [0080h] to [00BEh] */
+  if (lo >= 4 && lo <= 7) {
+    addr = 0x80 + ((lo - 4) * 8 + (hi - 8)) * 2;
+    cpu_call(periph_memory[addr] | (periph_memory[addr + 1] << 8));
+    cpu_clocks = 5;
+    return;
+  }
+
+  switch (op) {
+  case 0x89: /* DECW [HL+byte] */
+    addr = cpu_indexed(CPU_HL, cpu_fetch8());
+    cpu_write16(addr, cpu_read16(addr) - 1);
+    cpu_clocks = 2;
+    break;
+
+  case 0x8a: case 0x8b: case 0x8c: case 0x8d: case 0x8e: case 0x8f: /* XCH A,r */
+    value = cpu_r(CPU_A);
+    cpu_r_set(CPU_A, cpu_r(lo - 8));
+    cpu_r_set(lo - 8, value);
+    break;
+
+  case 0xa8: /* XCH A,saddr */
+  case 0xa9: /* XCH A,[HL+C] */
+  case 0xaa: /* XCH A,!addr16 */
+  case 0xab: /* XCH A,sfr */
+  case 0xac: /* XCH A,[HL] */
+  case 0xad: /* XCH A,[HL+byte] */
+  case 0xae: /* XCH A,[DE] */
+  case 0xaf: /* XCH A,[DE+byte] */
+  case 0xb9: /* XCH A,[HL+B] */
+    switch (op) {
+    case 0xa8: addr = cpu_saddr(); break;
+    case 0xa9: addr = cpu_data(cpu_rp(CPU_HL) + cpu_r(CPU_C)); break;
+    case 0xaa: addr = cpu_addr16(); break;
+    case 0xab: addr = cpu_sfr(); break;
+    case 0xac: addr = cpu_indexed(CPU_HL, 0); break;
+    case 0xad: addr = cpu_indexed(CPU_HL, cpu_fetch8()); break;
+    case 0xae: addr = cpu_indexed(CPU_DE, 0); break;
+    case 0xaf: addr = cpu_indexed(CPU_DE, cpu_fetch8()); break;
+    default: addr = cpu_data(cpu_rp(CPU_HL) + cpu_r(CPU_B)); break;
+    }
+    value = cpu_read8(addr);
+    cpu_write8(addr, cpu_r(CPU_A));
+    cpu_r_set(CPU_A, value);
+    cpu_clocks = 2;
+    break;
+
+  case 0xb8: /* MOV ES,saddr */
+    periph_memory[CPU_ES] = cpu_read8(cpu_saddr()) & 0x0f;
+    break;
+
+  case 0xc3: /* BH $addr20 */
+  case 0xd3: /* BNH $addr20 */
+    value = cpu_fetch8();
+    word = ((cpu_psw_get() & CPU_PSW_Z) == 0 && (cpu_psw_get() & CPU_PSW_CY) == 0);
+    cpu_branch(op == 0xc3 ? word : !word, (signed char)value);
+    cpu_clocks++;
+    break;
+
+  case 0xc8: /* SKC */
+    cpu_skip(cpu_psw_get() & CPU_PSW_CY);
+    break;
+  case 0xd8: /* SKNC */
+    cpu_skip(!(cpu_psw_get() & CPU_PSW_CY));
+    break;
+  case 0xe8: /* SKZ */
+    cpu_skip(cpu_psw_get() & CPU_PSW_Z);
+    break;
+  case 0xf8: /* SKNZ */
+    cpu_skip(!(cpu_psw_get() & CPU_PSW_Z));
+    break;
+  case 0xe3: /* SKH */
+    cpu_skip(!(cpu_psw_get() & (CPU_PSW_Z | CPU_PSW_CY)));
+    break;
+  case 0xf3: /* SKNH */
+    cpu_skip(cpu_psw_get() & (CPU_PSW_Z | CPU_PSW_CY));
+    break;
+
+  case 0xc9: /* MOV A,[HL+B] */
+    cpu_r_set(CPU_A, cpu_read8(cpu_data(cpu_rp(CPU_HL) + cpu_r(CPU_B))));
+    break;
+  case 0xd9: /* MOV [HL+B],A */
+    cpu_write8(cpu_data(cpu_rp(CPU_HL) + cpu_r(CPU_B)), cpu_r(CPU_A));
+    break;
+  case 0xe9: /* MOV A,[HL+C] */
+    cpu_r_set(CPU_A, cpu_read8(cpu_data(cpu_rp(CPU_HL) + cpu_r(CPU_C))));
+    break;
+  case 0xf9: /* MOV [HL+C],A */
+    cpu_write8(cpu_data(cpu_rp(CPU_HL) + cpu_r(CPU_C)), cpu_r(CPU_A));
+    break;
+
+  case 0xca: /* CALL AX */
+  case 0xda: /* CALL BC */
+  case 0xea: /* CALL DE */
+  case 0xfa: /* CALL HL */
+    cpu_call(((unsigned long)(periph_memory[CPU_CS] & 0x0f) << 16) | cpu_rp(hi - 0x0c));
+    cpu_clocks = 3;
+    break;
+  case 0xcb: /* BR AX */
+    cpu_pc_now = ((unsigned long)(periph_memory[CPU_CS] & 0x0f) << 16) | cpu_rp(CPU_AX);
+    cpu_clocks = 3;
+    break;
+
+  case 0xcc: /* BRK */
+    cpu_interrupt(CPU_SOURCE_BRK, (cpu_psw_get() & CPU_PSW_ISP) >> 1); /* ISP unchanged. */
+    cpu_clocks = 5;
+    break;
+  case 0xec: /* RETB */
+  case 0xfc: /* RETI */
+    cpu_return_interrupt();
+    cpu_clocks = 6;
+    break;
+  case 0xed: /* HALT */
+  case 0xfd: /* STOP, woken up the same way here. */
+    cpu_halt = 1;
+    cpu_clocks = 3;
+    break;
+
+  case 0xcd: /* POP PSW */
+    cpu_psw_set((cpu_pop16() >> 8) & 0xff);
+    cpu_hold = 1;
+    cpu_clocks = 3;
+    break;
+  case 0xdd: /* PUSH PSW */
+    cpu_push16(cpu_psw_get() << 8);
+    break;
+
+  case 0xce: /* MOVS [HL+byte],X */
+    addr = cpu_indexed(CPU_HL, cpu_fetch8());
+    value = cpu_r(CPU_X);
+    cpu_write8(addr, value);
+    cpu_flag(CPU_PSW_Z, value == 0);
+    cpu_flag(CPU_PSW_CY, value == 0 || cpu_r(CPU_A) == 0);
+    break;
+  case 0xde: /* CMPS X,[HL+byte] */
+    addr = cpu_indexed(CPU_HL, cpu_fetch8());
+    value = cpu_read8(addr);
+    cpu_flag(CPU_PSW_Z, value == cpu_r(CPU_X));
+    cpu_flag(CPU_PSW_CY, cpu_r(CPU_X) == 0 || cpu_r(CPU_A) == 0);
+    cpu_clocks = 2;
+    break;
+
+  case 0xcf: /* SEL RB0 */
+  case 0xdf: /* SEL RB1 */
+  case 0xef: /* SEL RB2 */
+  case 0xff: /* SEL RB3 */
+    value = cpu_psw_get() & ~(CPU_PSW_RBS1 | CPU_PSW_RBS0);
+    if ((hi - 0x0c) & 1) {
+      value |= CPU_PSW_RBS0;
+    }
+    if ((hi - 0x0c) & 2) {
+      value |= CPU_PSW_RBS1;
+    }
+    cpu_psw_set(value);
+    break;
+
+  case 0xdb: /* ROR A,1 */
+    value = cpu_r(CPU_A);
+    cpu_flag(CPU_PSW_CY, value & 0x01);
+    cpu_r_set(CPU_A, (value >> 1) | (value << 7));
+    break;
+  case 0xeb: /* ROL A,1 */
+    value = cpu_r(CPU_A);
+    cpu_flag(CPU_PSW_CY, value & 0x80);
+    cpu_r_set(CPU_A, (value << 1) | (value >> 7));
+    break;
+  case 0xfb: /* RORC A,1 */
+    value = cpu_r(CPU_A);
+    word = cpu_psw_get() & CPU_PSW_CY;
+    cpu_flag(CPU_PSW_CY, value & 0x01);
+    cpu_r_set(CPU_A, (value >> 1) | (word ? 0x80 : 0));
+    break;
+  case 0xdc: /* ROLC A,1 */
+    value = cpu_r(CPU_A);
+    word = cpu_psw_get() & CPU_PSW_CY;
+    cpu_flag(CPU_PSW_CY, value & 0x80);
+    cpu_r_set(CPU_A, (value << 1) | (word ? 0x01 : 0));
+    break;
+  case 0xee: /* ROLWC AX,1 */
+  case 0xfe: /* ROLWC BC,1 */
+    word = cpu_rp(op == 0xee ? CPU_AX : CPU_BC);
+    value = cpu_psw_get() & CPU_PSW_CY;
+    cpu_flag(CPU_PSW_CY, word & 0x8000);
+    cpu_rp_set(op == 0xee ? CPU_AX : CPU_BC, ((word << 1) | (value ? 1 : 0)) & 0xffff);
+    break;
+
+  default:
+    cpu_clocks = -1;
+    break;
+  }
+}
+
+/* Third map, 0x71 prefix: bit manipulation. */
+static void cpu_map3(void)
+{
+  unsigned char op, lo, bit, value, carry;
+  unsigned long addr;
+  int is_a;
+
+  op = cpu_fetch8();
+  lo = op & 0x0f;
+  bit = 1 << ((op >> 4) & 7);
+  carry = cpu_psw_get() & CPU_PSW_CY;
+
+  if (op < 0x80) {
+    if (lo == 0 || lo == 8) {
+      addr = cpu_addr16(); /* SET1 and CLR1 !addr16.bit */
+    } else if (lo < 8) {
+      addr = cpu_saddr();
+    } else {
+      addr = cpu_sfr();
+    }
+    is_a = 0;
+  } else {
+    switch (op) {
+    case 0x80: /* SET1 CY */
+      cpu_flag(CPU_PSW_CY, 1);
+      return;
+    case 0x88: /* CLR1 CY */
+      cpu_flag(CPU_PSW_CY, 0);
+      return;
+    case 0xc0: /* NOT1 CY */
+      cpu_flag(CPU_PSW_CY, !carry);
+      return;
+    }
+    if (lo == 0 || lo == 8) {
+      cpu_clocks = -1;
+      return;
+    }
+    addr = cpu_indexed(CPU_HL, 0);
+    is_a = (lo > 8);
+  }
+
+  value = is_a ? cpu_r(CPU_A) : cpu_read8(addr);
+
+  switch (lo & 7) {
+  case 0: /* SET1 !addr16.bit, CLR1 !addr16.bit */
+  case 2: /* SET1 */
+  case 3: /* CLR1 */
+  case 1: /* MOV1 x.bit,CY */
+    if ((lo & 7) == 1) {
+      value = carry ? (value | bit) : (value & ~bit);
+    } else if (lo == 0 || (lo & 7) == 2) {
+      value |= bit;
+    } else {
+      value &= ~bit;
+    }
+    if (is_a) {
+      cpu_r_set(CPU_A, value);
+    } else {
+      cpu_write8(addr, value);
+      cpu_clocks = 2;
+    }
+    break;
+  case 4: /* MOV1 CY,x.bit */
+    cpu_flag(CPU_PSW_CY, value & bit);
+    break;
+  case 5: /* AND1 CY,x.bit */
+    cpu_flag(CPU_PSW_CY, carry && (value & bit));
+    break;
+  case 6: /* OR1 CY,x.bit */
+    cpu_flag(CPU_PSW_CY, carry || (value & bit));
+    break;
+  default: /* XOR1 CY,x.bit */
+    cpu_flag(CPU_PSW_CY, (carry != 0) != ((value & bit) != 0));
+    break;
+  }
+}
+
+/* Fourth map, 0x31 prefix: bit tests with branches, and shifts. */
+static void cpu_map4(void)
+{
+  unsigned char op, hi, lo, bit, value, offset;
+  unsigned long addr = 0;
+  unsigned int word;
+  int is_a, taken;
+
+  op = cpu_fetch8();
+  hi = op >> 4;
+  lo = op & 0x0f;
+
+  if (lo <= 5) {
+    bit = 1 << (hi & 7);
+    is_a = 0;
+    if (hi < 8) {
+      if (lo & 1) {
+        is_a = 1;
+      } else {
+        addr = cpu_saddr();
+      }
+    } else {
+      addr = (lo & 1) ? cpu_indexed(CPU_HL, 0) : cpu_sfr();
+    }
+    offset = cpu_fetch8();
+    value = is_a ? cpu_r(CPU_A) : cpu_read8(addr);
+
+    if (lo <= 1) { /* BTCLR */
+      taken = (value & bit) != 0;
+      if (taken) {
+        if (is_a) {
+          cpu_r_set(CPU_A, value & ~bit);
+        } else {
+          cpu_write8(addr, value & ~bit);
+        }
+      }
+    } else if (lo <= 3) { /* BT */
+      taken = (value & bit) != 0;
+    } else { /* BF */
+      taken = (value & bit) == 0;
+    }
+    cpu_branch(taken, (signed char)offset);
+    cpu_clocks++;
+    return;
+  }
+
+  switch (lo) {
+  case 0x7: /* SHL C,n */
+  case 0x8: /* SHL B,n */
+  case 0x9: /* SHL A,n */
+    value = cpu_r(lo == 0x7 ? CPU_C : (lo == 0x8 ? CPU_B : CPU_A));
+    if (hi > 0) {
+      cpu_flag(CPU_PSW_CY, (value << (hi - 1)) & 0x80);
+      value = (value << hi) & 0xff;
+    }
+    cpu_r_set(lo == 0x7 ? CPU_C : (lo == 0x8 ? CPU_B : CPU_A), value);
+    break;
+  case 0xa: /* SHR A,n */
+  case 0xb: /* SAR A,n */
+    value = cpu_r(CPU_A);
+    if (hi > 0) {
+      cpu_flag(CPU_PSW_CY, (value >> (hi - 1)) & 0x01);
+      if (lo == 0xa) {
+        value = value >> hi;
+      } else {
+        value = (unsigned char)((signed char)value >> hi);
+      }
+    }
+    cpu_r_set(CPU_A, value);
+    break;
+  case 0xc: /* SHLW BC,n */
+  case 0xd: /* SHLW AX,n */
+    word = cpu_rp(lo == 0xc ? CPU_BC : CPU_AX);
+    if (hi > 0) {
+      cpu_flag(CPU_PSW_CY, (word << (hi - 1)) & 0x8000);
+      word = (word << hi) & 0xffff;
+    }
+    cpu_rp_set(lo == 0xc ? CPU_BC : CPU_AX, word);
+    break;
+  case 0xe: /* SHRW AX,n */
+  case 0xf: /* SARW AX,n */
+    word = cpu_rp(CPU_AX);
+    if (hi > 0) {
+      cpu_flag(CPU_PSW_CY, (word >> (hi - 1)) & 0x0001);
+      if (lo == 0xe) {
+        word = word >> hi;
+      } else {
+        word = (unsigned int)((short)word >> hi) & 0xffff;
+      }
+    }
+    cpu_rp_set(CPU_AX, word);
+    break;
+  default:
+    cpu_clocks = -1;
+    break;
+  }
+}
+
+/* The first map, which also dispatches to the others. */
+static void cpu_map1(unsigned char op)
+{
+  unsigned char value, lo, row;
+  unsigned int word;
+  unsigned long addr;
+
+  lo = op & 0x0f;
+  row = op >> 4;
+
+  /* ALU columns of rows 0 to 7. */
+  if (op < 0x80 && lo >= 0x0a) {
+    switch (lo) {
+    case 0x0a: /* op saddr,#byte */
+      addr = cpu_saddr();
+      cpu_alu8_memory(row, addr, cpu_fetch8());
+      cpu_clocks = 2;
+      break;
+    case 0x0b: /* op A,saddr */
+      cpu_alu8_a(row, cpu_read8(cpu_saddr()));
+      break;
+    case 0x0c: /* op A,#byte */
+      cpu_alu8_a(row, cpu_fetch8());
+      break;
+    case 0x0d: /* op A,[HL] */
+      cpu_alu8_a(row, cpu_read8(cpu_indexed(CPU_HL, 0)));
+      break;
+    case 0x0e: /* op A,[HL+byte] */
+      addr = cpu_indexed(CPU_HL, cpu_fetch8());
+      cpu_alu8_a(row, cpu_read8(addr));
+      break;
+    default: /* op A,!addr16 */
+      cpu_alu8_a(row, cpu_read8(cpu_addr16()));
+      break;
+    }
+    return;
+  }
+
+  switch (op) {
+  case 0x00: /* NOP */
+    break;
+
+  case 0x01: case 0x03: case 0x05: case 0x07: /* ADDW AX,rp */
+  case 0x23: case 0x25: case 0x27: /* SUBW AX,rp */
+  case 0x43: case 0x45: case 0x47: /* CMPW AX,rp */
+    cpu_alu16(row, cpu_rp((op >> 1) & 3));
+    break;
+  case 0x02: case 0x22: case 0x42: /* ADDW, SUBW, CMPW AX,!addr16 */
+    cpu_alu16(row, cpu_read16(cpu_addr16()));
+    break;
+  case 0x04: case 0x24: case 0x44: /* ADDW, SUBW, CMPW AX,#word */
+    cpu_alu16(row, cpu_fetch16());
+    break;
+  case 0x06: case 0x26: case 0x46: /* ADDW, SUBW, CMPW AX,saddrp */
+    cpu_alu16(row, cpu_read16(cpu_saddr()));
+    break;
+
+  case 0x08: /* XCH A,X */
+    value = cpu_r(CPU_A);
+    cpu_r_set(CPU_A, cpu_r(CPU_X));
+    cpu_r_set(CPU_X, value);
+    break;
+
+  case 0x09: /* MOV A,word[B] */
+  case 0x29: /* MOV A,word[C] */
+  case 0x49: /* MOV A,word[BC] */
+    word = cpu_fetch16();
+    word += (op == 0x09) ? cpu_r(CPU_B) : ((op == 0x29) ? cpu_r(CPU_C) : cpu_rp(CPU_BC));
+    cpu_r_set(CPU_A, cpu_read8(cpu_data(word)));
+    break;
+  case 0x18: /* MOV word[B],A */
+  case 0x28: /* MOV word[C],A */
+  case 0x48: /* MOV word[BC],A */
+    word = cpu_fetch16();
+    word += (op == 0x18) ? cpu_r(CPU_B) : ((op == 0x28) ? cpu_r(CPU_C) : cpu_rp(CPU_BC));
+    cpu_write8(cpu_data(word), cpu_r(CPU_A));
+    break;
+  case 0x19: /* MOV word[B],#byte */
+  case 0x38: /* MOV word[C],#byte */
+  case 0x39: /* MOV word[BC],#byte */
+    word = cpu_fetch16();
+    word += (op == 0x19) ? cpu_r(CPU_B) : ((op == 0x38) ? cpu_r(CPU_C) : cpu_rp(CPU_BC));
+    cpu_write8(cpu_data(word), cpu_fetch8());
+    break;
+  case 0x59: /* MOVW AX,word[B] */
+  case 0x69: /* MOVW AX,word[C] */
+  case 0x79: /* MOVW AX,word[BC] */
+    word = cpu_fetch16();
+    word += (op == 0x59) ? cpu_r(CPU_B) : ((op == 0x69) ? cpu_r(CPU_C) : cpu_rp(CPU_BC));
+    cpu_rp_set(CPU_AX, cpu_read16(cpu_data(word)));
+    break;
+  case 0x58: /* MOVW word[B],AX */
+  case 0x68: /* MOVW word[C],AX */
+  case 0x78: /* MOVW word[BC],AX */
+    word = cpu_fetch16();
+    word += (op == 0x58) ? cpu_r(CPU_B) : ((op == 0x68) ? cpu_r(CPU_C) : cpu_rp(CPU_BC));
+    cpu_write16(cpu_data(word), cpu_rp(CPU_AX));
+    break;
+
+  case 0x10: /* ADDW SP,#byte */
+    cpu_sp_set(cpu_sp() + cpu_fetch8());
+    break;
+  case 0x20: /* SUBW SP,#byte */
+    cpu_sp_set(cpu_sp() - cpu_fetch8());
+    break;
+
+  case 0x11: /* ES: prefix */
+    cpu_es_prefix = 1;
+    cpu_map1(cpu_fetch8());
+    break;
+
+  case 0x12: case 0x14: case 0x16: /* MOVW rp,AX */
+    cpu_rp_set((op >> 1) & 3, cpu_rp(CPU_AX));
+    break;
+  case 0x13: case 0x15: case 0x17: /* MOVW AX,rp */
+    cpu_rp_set(CPU_AX, cpu_rp((op >> 1) & 3));
+    break;
+
+  case 0x30: case 0x32: case 0x34: case 0x36: /* MOVW rp,#word */
+    cpu_rp_set((op >> 1) & 3, cpu_fetch16());
+    break;
+  case 0x33: case 0x35: case 0x37: /* XCHW AX,rp */
+    word = cpu_rp(CPU_AX);
+    cpu_rp_set(CPU_AX, cpu_rp((op >> 1) & 3));
+    cpu_rp_set((op >> 1) & 3, word);
+    break;
+
+  case 0x31:
+    cpu_map4();
+    break;
+
+  case 0x40: /* CMP !addr16,#byte */
+    addr = cpu_addr16();
+    cpu_alu8(CPU_CMP, cpu_read8(addr), cpu_fetch8());
+    break;
+  case 0x41: /* MOV ES,#byte */
+    periph_memory[CPU_ES] = cpu_fetch8() & 0x0f;
+    break;
+
+  case 0x50: case 0x51: case 0x52: case 0x53:
+  case 0x54: case 0x55: case 0x56: case 0x57: /* MOV r,#byte */
+    cpu_r_set(op & 7, cpu_fetch8());
+    break;
+
+  case 0x60: case 0x62: case 0x63: case 0x64:
+  case 0x65: case 0x66: case 0x67: /* MOV A,r */
+    cpu_r_set(CPU_A, cpu_r(op & 7));
+    break;
+  case 0x70: case 0x72: case 0x73: case 0x74:
+  case 0x75: case 0x76: case 0x77: /* MOV r,A */
+    cpu_r_set(op & 7, cpu_r(CPU_A));
+    break;
+
+  case 0x61:
+    cpu_map2();
+    break;
+  case 0x71:
+    cpu_map3();
+    break;
+
+  case 0x80: case 0x81: case 0x82: case 0x83:
+  case 0x84: case 0x85: case 0x86: case 0x87: /* INC r */
+    cpu_r_set(op & 7, cpu_inc8(cpu_r(op & 7), 1));
+    break;
+  case 0x90: case 0x91: case 0x92: case 0x93:
+  case 0x94: case 0x95: case 0x96: case 0x97: /* DEC r */
+    cpu_r_set(op & 7, cpu_inc8(cpu_r(op & 7), -1));
+    break;
+
+  case 0x88: /* MOV A,[SP+byte] */
+    cpu_r_set(CPU_A, cpu_read8(cpu_stack(cpu_fetch8())));
+    break;
+  case 0x89: /* MOV A,[DE] */
+    cpu_r_set(CPU_A, cpu_read8(cpu_indexed(CPU_DE, 0)));
+    break;
+  case 0x8a: /* MOV A,[DE+byte] */
+    cpu_r_set(CPU_A, cpu_read8(cpu_indexed(CPU_DE, cpu_fetch8())));
+    break;
+  case 0x8b: /* MOV A,[HL] */
+    cpu_r_set(CPU_A, cpu_read8(cpu_indexed(CPU_HL, 0)));
+    break;
+  case 0x8c: /* MOV A,[HL+byte] */
+    cpu_r_set(CPU_A, cpu_read8(cpu_indexed(CPU_HL, cpu_fetch8())));
+    break;
+  case 0x8d: /* MOV A,saddr */
+    cpu_r_set(CPU_A, cpu_read8(cpu_saddr()));
+    break;
+  case 0x8e: /* MOV A,sfr */
+    cpu_r_set(CPU_A, cpu_read8(cpu_sfr()));
+    break;
+  case 0x8f: /* MOV A,!addr16 */
+    cpu_r_set(CPU_A, cpu_read8(cpu_addr16()));
+    break;
+
+  case 0x98: /* MOV [SP+byte],A */
+    cpu_write8(cpu_stack(cpu_fetch8()), cpu_r(CPU_A));
+    break;
+  case 0x99: /* MOV [DE],A */
+    cpu_write8(cpu_indexed(CPU_DE, 0), cpu_r(CPU_A));
+    break;
+  case 0x9a: /* MOV [DE+byte],A */
+    cpu_write8(cpu_indexed(CPU_DE, cpu_fetch8()), cpu_r(CPU_A));
+    break;
+  case 0x9b: /* MOV [HL],A */
+    cpu_write8(cpu_indexed(CPU_HL, 0), cpu_r(CPU_A));
+    break;
+  case 0x9c: /* MOV [HL+byte],A */
+    cpu_write8(cpu_indexed(CPU_HL, cpu_fetch8()), cpu_r(CPU_A));
+    break;
+  case 0x9d: /* MOV saddr,A */
+    cpu_write8(cpu_saddr(), cpu_r(CPU_A));
+    break;
+  case 0x9e: /* MOV sfr,A */
+    cpu_write8(cpu_sfr(), cpu_r(CPU_A));
+    break;
+  case 0x9f: /* MOV !addr16,A */
+    cpu_write8(cpu_addr16(), cpu_r(CPU_A));
+    break;
+
+  case 0xa0: /* INC !addr16 */
+  case 0xa4: /* INC saddr */
+  case 0xb0: /* DEC !addr16 */
+  case 0xb4: /* DEC saddr */
+    addr = (lo == 0) ? cpu_addr16() : cpu_saddr();
+    cpu_write8(addr, cpu_inc8(cpu_read8(addr), (row == 0xa) ? 1 : -1));
+    cpu_clocks = 2;
+    break;
+  case 0xa2: /* INCW !addr16 */
+  case 0xa6: /* INCW saddrp */
+  case 0xb2: /* DECW !addr16 */
+  case 0xb6: /* DECW saddrp */
+    addr = (lo == 2) ? cpu_addr16() : cpu_saddr();
+    cpu_write16(addr, cpu_read16(addr) + ((row == 0xa) ? 1 : -1));
+    cpu_clocks = 2;
+    break;
+  case 0xa1: case 0xa3: case 0xa5: case 0xa7: /* INCW rp */
+    cpu_rp_set((op >> 1) & 3, (cpu_rp((op >> 1) & 3) + 1) & 0xffff);
+    break;
+  case 0xb1: case 0xb3: case 0xb5: case 0xb7: /* DECW rp */
+    cpu_rp_set((op >> 1) & 3, (cpu_rp((op >> 1) & 3) - 1) & 0xffff);
+    break;
+
+  case 0xa8: /* MOVW AX,[SP+byte] */
+    cpu_rp_set(CPU_AX, cpu_read16(cpu_stack(cpu_fetch8())));
+    break;
+  case 0xa9: /* MOVW AX,[DE] */
+    cpu_rp_set(CPU_AX, cpu_read16(cpu_indexed(CPU_DE, 0)));
+    break;
+  case 0xaa: /* MOVW AX,[DE+byte] */
+    cpu_rp_set(CPU_AX, cpu_read16(cpu_indexed(CPU_DE, cpu_fetch8())));
+    break;
+  case 0xab: /* MOVW AX,[HL] */
+    cpu_rp_set(CPU_AX, cpu_read16(cpu_indexed(CPU_HL, 0)));
+    break;
+  case 0xac: /* MOVW AX,[HL+byte] */
+    cpu_rp_set(CPU_AX, cpu_read16(cpu_indexed(CPU_HL, cpu_fetch8())));
+    break;
+  case 0xad: /* MOVW AX,saddrp */
+    cpu_rp_set(CPU_AX, cpu_read16(cpu_saddr()));
+    break;
+  case 0xae: /* MOVW AX,sfrp */
+    cpu_rp_set(CPU_AX, cpu_read16(cpu_sfr()));
+    break;
+  case 0xaf: /* MOVW AX,!addr16 */
+    cpu_rp_set(CPU_AX, cpu_read16(cpu_addr16()));
+    break;
+
+  case 0xb8: /* MOVW [SP+byte],AX */
+    cpu_write16(cpu_stack(cpu_fetch8()), cpu_rp(CPU_AX));
+    break;
+  case 0xb9: /* MOVW [DE],AX */
+    cpu_write16(cpu_indexed(CPU_DE, 0), cpu_rp(CPU_AX));
+    break;
+  case 0xba: /* MOVW [DE+byte],AX */
+    cpu_write16(cpu_indexed(CPU_DE, cpu_fetch8()), cpu_rp(CPU_AX));
+    break;
+  case 0xbb: /* MOVW [HL],AX */
+    cpu_write16(cpu_indexed(CPU_HL, 0), cpu_rp(CPU_AX));
+    break;
+  case 0xbc: /* MOVW [HL+byte],AX */
+    cpu_write16(cpu_indexed(CPU_HL, cpu_fetch8()), cpu_rp(CPU_AX));
+    break;
+  case 0xbd: /* MOVW saddrp,AX */
+    cpu_write16(cpu_saddr(), cpu_rp(CPU_AX));
+    break;
+  case 0xbe: /* MOVW sfrp,AX */
+    cpu_write16(cpu_sfr(), cpu_rp(CPU_AX));
+    break;
+  case 0xbf: /* MOVW !addr16,AX */
+    cpu_write16(cpu_addr16(), cpu_rp(CPU_AX));
+    break;
+
+  case 0xc0: case 0xc2: case 0xc4: case 0xc6: /* POP rp */
+    cpu_rp_set((op >> 1) & 3, cpu_pop16());
+    break;
+  case 0xc1: case 0xc3: case 0xc5: case 0xc7: /* PUSH rp */
+    cpu_push16(cpu_rp((op >> 1) & 3));
+    break;
+
+  case 0xc8: /* MOV [SP+byte],#byte */
+    addr = cpu_stack(cpu_fetch8());
+    cpu_write8(addr, cpu_fetch8());
+    break;
+  case 0xc9: /* MOVW saddrp,#word */
+    addr = cpu_saddr();
+    cpu_write16(addr, cpu_fetch16());
+    break;
+  case 0xca: /* MOV [DE+byte],#byte */
+    addr = cpu_indexed(CPU_DE, cpu_fetch8());
+    cpu_write8(addr, cpu_fetch8());
+    break;
+  case 0xcb: /* MOVW sfrp,#word */
+    addr = cpu_sfr();
+    cpu_write16(addr, cpu_fetch16());
+    break;
+  case 0xcc: /* MOV [HL+byte],#byte */
+    addr = cpu_indexed(CPU_HL, cpu_fetch8());
+    cpu_write8(addr, cpu_fetch8());
+    break;
+  case 0xcd: /* MOV saddr,#byte */
+    addr = cpu_saddr();
+    cpu_write8(addr, cpu_fetch8());
+    break;
+  case 0xce: /* MOV sfr,#byte, or multiply and divide on 0xfb. */
+    addr = cpu_sfr();
+    value = cpu_fetch8();
+    if (addr == 0xffffb) {
+      cpu_multiply(value);
+    } else {
+      cpu_write8(addr, value);
+    }
+    break;
+  case 0xcf: /* MOV !addr16,#byte */
+    addr = cpu_addr16();
+    cpu_write8(addr, cpu_fetch8());
+    break;
+
+  case 0xd0: case 0xd1: case 0xd2: case 0xd3: /* CMP0 r */
+  case 0xd4: /* CMP0 saddr */
+  case 0xd5: /* CMP0 !addr16 */
+    if (lo < 4) {
+      value = cpu_r(lo);
+    } else {
+      value = cpu_read8((lo == 4) ? cpu_saddr() : cpu_addr16());
+    }
+    cpu_flag(CPU_PSW_Z, value == 0);
+    cpu_flag(CPU_PSW_AC, 0);
+    cpu_flag(CPU_PSW_CY, 0);
+    break;
+  case 0xd6: /* MULU X */
+    cpu_rp_set(CPU_AX, cpu_r(CPU_A) * cpu_r(CPU_X));
+    break;
+  case 0xd7: /* RET */
+    cpu_return();
+    cpu_clocks = 6;
+    break;
+
+  case 0xd8: /* MOV X,saddr */
+  case 0xe8: /* MOV B,saddr */
+  case 0xf8: /* MOV C,saddr */
+    cpu_r_set(row == 0xd ? CPU_X : (row == 0xe ? CPU_B : CPU_C), cpu_read8(cpu_saddr()));
+    break;
+  case 0xd9: /* MOV X,!addr16 */
+  case 0xe9: /* MOV B,!addr16 */
+  case 0xf9: /* MOV C,!addr16 */
+    cpu_r_set(row == 0xd ? CPU_X : (row == 0xe ? CPU_B : CPU_C), cpu_read8(cpu_addr16()));
+    break;
+  case 0xda: /* MOVW BC,saddrp */
+  case 0xea: /* MOVW DE,saddrp */
+  case 0xfa: /* MOVW HL,saddrp */
+    cpu_rp_set(row - 0xc, cpu_read16(cpu_saddr()));
+    break;
+  case 0xdb: /* MOVW BC,!addr16 */
+  case 0xeb: /* MOVW DE,!addr16 */
+  case 0xfb: /* MOVW HL,!addr16 */
+    cpu_rp_set(row - 0xc, cpu_read16(cpu_addr16()));
+    break;
+
+  case 0xdc: /* BC $addr20 */
+    value = cpu_fetch8();
+    cpu_branch(cpu_psw_get() & CPU_PSW_CY, (signed char)value);
+    break;
+  case 0xdd: /* BZ $addr20 */
+    value = cpu_fetch8();
+    cpu_branch(cpu_psw_get() & CPU_PSW_Z, (signed char)value);
+    break;
+  case 0xde: /* BNC $addr20 */
+    value = cpu_fetch8();
+    cpu_branch(!(cpu_psw_get() & CPU_PSW_CY), (signed char)value);
+    break;
+  case 0xdf: /* BNZ $addr20 */
+    value = cpu_fetch8();
+    cpu_branch(!(cpu_psw_get() & CPU_PSW_Z), (signed char)value);
+    break;
+
+  case 0xe0: case 0xe1: case 0xe2: case 0xe3: /* ONEB r */
+    cpu_r_set(lo, 1);
+    break;
+  case 0xf0: case 0xf1: case 0xf2: case 0xf3: /* CLRB r */
+    cpu_r_set(lo, 0);
+    break;
+  case 0xe4: /* ONEB saddr */
+  case 0xf4: /* CLRB saddr */
+    cpu_write8(cpu_saddr(), (row == 0xe) ? 1 : 0);
+    break;
+  case 0xe5: /* ONEB !addr16 */
+  case 0xf5: /* CLRB !addr16 */
+    cpu_write8(cpu_addr16(), (row == 0xe) ? 1 : 0);
+    break;
+  case 0xe6: /* ONEW AX */
+  case 0xe7: /* ONEW BC */
+  case 0xf6: /* CLRW AX */
+  case 0xf7: /* CLRW BC */
+    cpu_rp_set(lo - 6, (row == 0xe) ? 1 : 0);
+    break;
+
+  case 0xec: /* BR !!addr20 */
+    word = cpu_fetch16();
+    cpu_pc_now = word | ((unsigned long)(cpu_fetch8() & 0x0f) << 16);
+    cpu_clocks = 3;
+    break;
+  case 0xed: /* BR !addr16 */
+    cpu_pc_now = cpu_fetch16();
+    cpu_clocks = 3;
+    break;
+  case 0xee: /* BR $!addr20 */
+    word = cpu_fetch16();
+    cpu_pc_now = (cpu_pc_now + (short)word) & CPU_MASK;
+    cpu_clocks = 3;
+    break;
+  case 0xef: /* BR $addr20 */
+    value = cpu_fetch8();
+    cpu_pc_now = (cpu_pc_now + (signed char)value) & CPU_MASK;
+    cpu_clocks = 3;
+    break;
+
+  case 0xfc: /* CALL !!addr20 */
+    word = cpu_fetch16();
+    addr = word | ((unsigned long)(cpu_fetch8() & 0x0f) << 16);
+    cpu_call(addr);
+    cpu_clocks = 3;
+    break;
+  case 0xfd: /* CALL !addr16 */
+    cpu_call(cpu_fetch16());
+    cpu_clocks = 3;
+    break;
+  case 0xfe: /* CALL $!addr20 */
+    word = cpu_fetch16();
+    cpu_call(cpu_pc_now + (short)word);
+    cpu_clocks = 3;
+    break;
+
+  default: /* 0x21 and 0xff */
+    cpu_clocks = -1;
+    break;
+  }
+}
+
+void cpu_reset(void)
+{
+  cpu_pc_now = periph_memory[0] | (periph_memory[1] << 8);
+  cpu_psw_set(CPU_PSW_ISP);
+  periph_memory[CPU_CS] = 0;
+  periph_memory[CPU_ES] = 0x0f;
+  cpu_halt = 0;
+  cpu_hold = 0;
+}
+
+/* Returns the clocks taken, or -1 for an instruction that is not
+ * implemented, with the reason from cpu_error(). */
+int cpu_step(void)
+{
+  unsigned char op;
+
+  cpu_pc_start = cpu_pc_now;
+  cpu_es_prefix = 0;
+  cpu_hold = 0;
+  cpu_flow_last = CPU_FLOW_NONE;
+  cpu_clocks = 1;
+
+  op = cpu_fetch8();
+  cpu_map1(op);
+
+  if (cpu_clocks < 0) {
+    snprintf(cpu_message, sizeof(cpu_message), "unknown instruction %02x %02x %02x at 0x%05lx",
+      periph_memory[cpu_pc_start], periph_memory[(cpu_pc_start + 1) & CPU_MASK],
+      periph_memory[(cpu_pc_start + 2) & CPU_MASK], cpu_pc_start);
+    cpu_pc_now = cpu_pc_start;
+  }
+
+  return cpu_clocks;
+}
+
+void cpu_interrupt(int source, unsigned char level)
+{
+  unsigned char psw;
+  unsigned long vector;
+
+  psw = cpu_psw_get();
+  cpu_call(0); /* Same frame as a call, with PSW in the top byte. */
+  periph_write(0xf0000 | ((cpu_sp() + 3) & 0xffff), psw);
+
+  cpu_psw_set((psw & ~(CPU_PSW_IE | CPU_PSW_ISP)) | ((level & 3) << 1));
+
+  vector = 0x04 + source * 2;
+  cpu_pc_now = periph_memory[vector] | (periph_memory[vector + 1] << 8);
+  cpu_halt = 0;
+}
+
+unsigned char cpu_halted(void)
+{
+  return cpu_halt;
+}
+
+void cpu_wakeup(void)
+{
+  cpu_halt = 0;
+}
+
+unsigned char cpu_held(void)
+{
+  return cpu_hold;
+}
+
+unsigned char cpu_flow(void)
+{
+  return cpu_flow_last;
+}
+
+unsigned long cpu_pc(void)
+{
+  return cpu_pc_now;
+}
+
+unsigned char cpu_psw(void)
+{
+  return cpu_psw_get();
+}
+
+const char *cpu_error(void)
+{
+  return cpu_message;
+}
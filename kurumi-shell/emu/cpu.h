@@ -0,0 +1,43 @@
+#ifndef _CPU_H
+#define _CPU_H
+
+#define CPU_HZ 32000000UL /* High-speed on-chip oscillator, as set up by main.c. */
+
+#define CPU_MEM_SIZE 0x100000 /* 20-bit address space. */
+
+/* Registers of the core that are mapped into the SFR area. */
+#define CPU_SPL 0xffff8
+#define CPU_SPH 0xffff9
+#define CPU_PSW 0xffffa
+#define CPU_CS  0xffffc
+#define CPU_ES  0xffffd
+
+#define CPU_PSW_IE   0x80
+#define CPU_PSW_Z    0x40
+#define CPU_PSW_RBS1 0x20
+#define CPU_PSW_AC   0x10
+#define CPU_PSW_RBS0 0x08
+#define CPU_PSW_ISP  0x06
+#define CPU_PSW_CY   0x01
+
+#define CPU_REGISTERS 0xffee0 /* Four banks of eight registers, bank 3 first. */
+
+/* Control flow of the last instruction, for following the call stack. */
+#define CPU_FLOW_NONE   0
+#define CPU_FLOW_CALL   1 /* Including CALLT and BRK. */
+#define CPU_FLOW_RETURN 2 /* RET, RETI and RETB. */
+
+void cpu_reset(void);
+int cpu_step(void);
+void cpu_interrupt(int source, unsigned char level);
+void cpu_return(void);
+unsigned char cpu_halted(void);
+void cpu_wakeup(void);
+unsigned char cpu_held(void);
+unsigned char cpu_flow(void);
+unsigned long cpu_pc(void);
+unsigned int cpu_sp(void);
+unsigned char cpu_psw(void);
+const char *cpu_error(void);
+
+#endif /* _CPU_H */
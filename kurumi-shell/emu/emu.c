@@ -0,0 +1,709 @@
+/* Kurumi Shell emulator, runs the firmware image on an emulated RL78/G13.
+ *
+ * Unlike the simulator, nothing of the shell is rebuilt for the host: the
+ * ELF or binary image from the firmware Makefile is loaded into the code
+ * flash and started from the reset vector, so every cycle of the command
+ * parser, the scripts and the interrupt handlers is counted as the chip
+ * would spend it. UART0 is connected to a pty, or to a file and stdout,
+ * and the data flash library is emulated on its entry points. */
+
+#define _GNU_SOURCE /* For the pty functions. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <elf.h>
+
+#include "cpu.h"
+#include "periph.h"
+#include "profile.h"
+
+#define EMU_INTERRUPT_CLOCKS 9 /* From the request to the first handler instruction. */
+
+#define EMU_PACE_CLOCKS (CPU_HZ / 1000) /* Real time is checked every 1ms. */
+
+#define EMU_QUIET_CLOCKS (CPU_HZ / 10) /* Silence after the input file ends. */
+
+#define EMU_GPR 0xffef0 /* R8 to R15, return values of called functions. */
+
+#define EMU_DFLCTL 0xf0090
+
+#define EMU_DATA_FLASH_BLOCK 1024
+
+/* Data flash library commands and status codes, as in its pfdl_types.h, so
+ * the emulator builds without the library. */
+#define EMU_PFDL_CMD_READ_BYTES 0x00
+#define EMU_PFDL_CMD_ERASE_BLOCK 0x03
+#define EMU_PFDL_CMD_WRITE_BYTES 0x04
+#define EMU_PFDL_CMD_IVERIFY_BYTES 0x06
+#define EMU_PFDL_CMD_BLANKCHECK_BYTES 0x08
+
+#define EMU_PFDL_OK 0x00
+#define EMU_PFDL_ERR_PARAMETER 0x05
+#define EMU_PFDL_ERR_MARGIN 0x1b
+
+static unsigned long emu_instructions = 0;
+static unsigned long emu_interrupts[PERIPH_SOURCES];
+
+/* Data flash library entry points, 0 if not linked in. */
+static unsigned long emu_pfdl_open = 0;
+static unsigned long emu_pfdl_close = 0;
+static unsigned long emu_pfdl_execute = 0;
+static unsigned long emu_pfdl_handler = 0;
+
+/* UART0 connection. */
+static int emu_pty = -1;
+static FILE *emu_input = NULL;
+static unsigned long emu_input_end = 0; /* Clock when the file ran out. */
+static unsigned long emu_output_last = 0;
+
+static int emu_registers = 0; /* Halting for good ends the run, for test programs. */
+
+static FILE *emu_vcd = NULL;
+static unsigned char emu_leds = 0x07; /* Red, green and blue in bits 0 to 2, on at reset. */
+static unsigned char emu_port1 = 0;
+static unsigned char emu_port5 = 0;
+
+static volatile sig_atomic_t emu_stop = 0;
+
+static void emu_signal(int sig)
+{
+  (void)sig;
+  emu_stop = 1;
+}
+
+static void emu_symbols(unsigned char *image, unsigned long size, Elf32_Ehdr *ehdr)
+{
+  Elf32_Shdr *shdr, *strtab;
+  Elf32_Sym *sym;
+  unsigned long i, count, n;
+  unsigned int bss_end, stack_top;
+  char *name;
+
+  if (ehdr->e_shoff == 0 || ehdr->e_shoff + (unsigned long)ehdr->e_shnum * sizeof(Elf32_Shdr) > size) {
+    return;
+  }
+
+  bss_end = 0;
+  stack_top = 0;
+  for (i = 0; i < ehdr->e_shnum; i++) {
+    shdr = (Elf32_Shdr *)(image + ehdr->e_shoff) + i;
+    if (shdr->sh_type != SHT_SYMTAB || shdr->sh_link >= ehdr->e_shnum) {
+      continue;
+    }
+    strtab = (Elf32_Shdr *)(image + ehdr->e_shoff) + shdr->sh_link;
+    if (shdr->sh_offset + shdr->sh_size > size || strtab->sh_offset + strtab->sh_size > size) {
+      return;
+    }
+
+    count = shdr->sh_size / sizeof(Elf32_Sym);
+    for (n = 0; n < count; n++) {
+      sym = (Elf32_Sym *)(image + shdr->sh_offset) + n;
+      if (sym->st_shndx == SHN_UNDEF || sym->st_name >= strtab->sh_size) {
+        continue;
+      }
+      name = (char *)image + strtab->sh_offset + sym->st_name;
+
+      /* Set by the linker script, for the stack report. */
+      if (strcmp(name, "__bssend") == 0) {
+        bss_end = sym->st_value & 0xffff;
+      } else if (strcmp(name, "__stack") == 0) {
+        stack_top = sym->st_value & 0xffff;
+      }
+
+      if (ELF32_ST_TYPE(sym->st_info) != STT_FUNC || sym->st_value >= CPU_MEM_SIZE) {
+        continue;
+      }
+      if (name[0] == '_') {
+        name++; /* C names get a leading underscore. */
+      }
+      profile_symbol(name, sym->st_value);
+    }
+    break;
+  }
+
+  profile_symbols_done();
+  profile_stack_limits(bss_end, stack_top);
+
+  emu_pfdl_open = profile_lookup("PFDL_Open");
+  emu_pfdl_close = profile_lookup("PFDL_Close");
+  emu_pfdl_execute = profile_lookup("PFDL_Execute");
+  emu_pfdl_handler = profile_lookup("PFDL_Handler");
+}
+
+static int emu_load(char *filename)
+{
+  FILE *fh;
+  unsigned char *image;
+  long size;
+  Elf32_Ehdr *ehdr;
+  Elf32_Phdr *phdr;
+  int i;
+
+  fh = fopen(filename, "rb");
+  if (fh == NULL) {
+    perror(filename);
+    return -1;
+  }
+  fseek(fh, 0, SEEK_END);
+  size = ftell(fh);
+  fseek(fh, 0, SEEK_SET);
+
+  image = malloc(size > 0 ? size : 1);
+  if (image == NULL || fread(image, 1, size, fh) != (size_t)size) {
+    fprintf(stderr, "%s: read failed\n", filename);
+    fclose(fh);
+    free(image);
+    return -1;
+  }
+  fclose(fh);
+
+  ehdr = (Elf32_Ehdr *)image;
+  if (size < (long)sizeof(Elf32_Ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0) {
+    /* Raw binary from objcopy, starting at address 0. */
+    if (size > 0x40000) {
+      fprintf(stderr, "%s: larger than the code flash\n", filename);
+      free(image);
+      return -1;
+    }
+    memcpy(periph_memory, image, size);
+    free(image);
+    return 0;
+  }
+
+  if (ehdr->e_ident[EI_CLASS] != ELFCLASS32 || ehdr->e_machine != EM_RL78 ||
+    ehdr->e_phoff + (unsigned long)ehdr->e_phnum * sizeof(Elf32_Phdr) > (unsigned long)size) {
+    fprintf(stderr, "%s: not an RL78 executable\n", filename);
+    free(image);
+    return -1;
+  }
+
+  /* Loadable segments at their flash addresses, which for .data is where
+   * crt0.S copies it from. */
+  for (i = 0; i < ehdr->e_phnum; i++) {
+    phdr = (Elf32_Phdr *)(image + ehdr->e_phoff) + i;
+    if (phdr->p_type != PT_LOAD || phdr->p_filesz == 0 || phdr->p_paddr >= 0x40000) {
+      continue;
+    }
+    if (phdr->p_paddr + phdr->p_filesz > 0x40000 || phdr->p_offset + phdr->p_filesz > (unsigned long)size) {
+      fprintf(stderr, "%s: segment %d does not fit\n", filename, i);
+      free(image);
+      return -1;
+    }
+    memcpy(&periph_memory[phdr->p_paddr], image + phdr->p_offset, phdr->p_filesz);
+  }
+
+  emu_symbols(image, size, ehdr);
+  free(image);
+  return 0;
+}
+
+/* Data flash library, called with the argument on the stack. */
+
+static unsigned int emu_word(unsigned long addr)
+{
+  return periph_memory[addr] | (periph_memory[addr + 1] << 8);
+}
+
+static int emu_pfdl_request(unsigned long request)
+{
+  unsigned int index, data, count, i;
+  unsigned char command, *flash;
+
+  index = emu_word(request);
+  data = emu_word(request + 2);
+  count = emu_word(request + 4);
+  command = periph_memory[request + 6];
+  flash = periph_data_flash();
+
+  if (command == EMU_PFDL_CMD_ERASE_BLOCK) {
+    if ((index + 1) * EMU_DATA_FLASH_BLOCK > PERIPH_DATA_FLASH_SIZE) {
+      return EMU_PFDL_ERR_PARAMETER;
+    }
+    memset(&flash[index * EMU_DATA_FLASH_BLOCK], 0xff, EMU_DATA_FLASH_BLOCK);
+    return EMU_PFDL_OK;
+  }
+
+  if (index + count > PERIPH_DATA_FLASH_SIZE) {
+    return EMU_PFDL_ERR_PARAMETER;
+  }
+
+  switch (command) {
+  case EMU_PFDL_CMD_READ_BYTES:
+    for (i = 0; i < count; i++) {
+      periph_memory[0xf0000 | ((data + i) & 0xffff)] = flash[index + i];
+    }
+    return EMU_PFDL_OK;
+
+  case EMU_PFDL_CMD_WRITE_BYTES:
+    /* Programming can only clear bits. */
+    for (i = 0; i < count; i++) {
+      flash[index + i] &= periph_memory[0xf0000 | ((data + i) & 0xffff)];
+    }
+    return EMU_PFDL_OK;
+
+  case EMU_PFDL_CMD_BLANKCHECK_BYTES:
+    for (i = 0; i < count; i++) {
+      if (flash[index + i] != 0xff) {
+        return EMU_PFDL_ERR_MARGIN;
+      }
+    }
+    return EMU_PFDL_OK;
+
+  case EMU_PFDL_CMD_IVERIFY_BYTES:
+    return EMU_PFDL_OK;
+
+  default:
+    return EMU_PFDL_ERR_PARAMETER;
+  }
+}
+
+/* Returns 1 if the instruction at the PC was a library call handled here. */
+static int emu_pfdl(unsigned long pc)
+{
+  unsigned long argument;
+  int status;
+
+  if (pc == 0) {
+    return 0;
+  }
+
+  argument = 0xf0000 | emu_word(0xf0000 | ((cpu_sp() + 4) & 0xffff));
+  if (pc == emu_pfdl_open) {
+    periph_memory[EMU_DFLCTL] = 0x01;
+    status = EMU_PFDL_OK;
+  } else if (pc == emu_pfdl_close) {
+    periph_memory[EMU_DFLCTL] = 0x00;
+    status = EMU_PFDL_OK;
+  } else if (pc == emu_pfdl_execute) {
+    status = emu_pfdl_request(argument);
+  } else if (pc == emu_pfdl_handler) {
+    status = EMU_PFDL_OK;
+  } else {
+    return 0;
+  }
+
+  periph_memory[EMU_GPR] = status & 0xff;
+  periph_memory[EMU_GPR + 1] = 0;
+  cpu_return();
+  profile_return(cpu_sp(), periph_now());
+  return 1;
+}
+
+/* UART0 and ports, called by the peripherals. */
+
+int emu_uart_recv(void)
+{
+  unsigned char c;
+  int value;
+
+  if (emu_input != NULL) {
+    if (emu_input_end != 0) {
+      return -1;
+    }
+    value = fgetc(emu_input);
+    if (value == EOF) {
+      emu_input_end = periph_now();
+      return -1;
+    }
+    return value;
+  }
+
+  if (emu_pty >= 0 && read(emu_pty, &c, 1) == 1) {
+    return c;
+  }
+  return -1;
+}
+
+void emu_uart_send(unsigned char c)
+{
+  emu_output_last = periph_now();
+
+  if (emu_input != NULL) {
+    fputc(c, stdout);
+    fflush(stdout);
+  } else if (emu_pty >= 0) {
+    if (write(emu_pty, &c, 1) != 1) {
+      /* Dropped, as by a board with nothing connected. */
+    }
+  }
+}
+
+static void emu_vcd_time(void)
+{
+  fprintf(emu_vcd, "#%lu\n", periph_now() * 125 / 4); /* In ns at 32 MHz. */
+}
+
+void emu_port_write(int port, unsigned char value)
+{
+  unsigned char leds;
+  int i;
+  static const char ids[3] = { 'r', 'g', 'b' };
+
+  if (port == 1) {
+    emu_port1 = value;
+  } else if (port == 5) {
+    emu_port5 = value;
+  } else {
+    return;
+  }
+
+  /* Active low: red on P1.7, green on P5.1 and blue on P5.0. */
+  leds = 0;
+  leds |= (emu_port1 & 0x80) ? 0 : 0x01;
+  leds |= (emu_port5 & 0x02) ? 0 : 0x02;
+  leds |= (emu_port5 & 0x01) ? 0 : 0x04;
+  if (leds == emu_leds) {
+    return;
+  }
+
+  if (emu_vcd != NULL) {
+    emu_vcd_time();
+    for (i = 0; i < 3; i++) {
+      if ((leds ^ emu_leds) & (1 << i)) {
+        fprintf(emu_vcd, "%d%c\n", (leds >> i) & 1, ids[i]);
+      }
+    }
+  }
+  emu_leds = leds;
+}
+
+static void emu_vcd_header(void)
+{
+  fprintf(emu_vcd, "$timescale 1ns $end\n");
+  fprintf(emu_vcd, "$scope module kurumi $end\n");
+  fprintf(emu_vcd, "$var wire 1 r red $end\n");
+  fprintf(emu_vcd, "$var wire 1 g green $end\n");
+  fprintf(emu_vcd, "$var wire 1 b blue $end\n");
+  fprintf(emu_vcd, "$upscope $end\n");
+  fprintf(emu_vcd, "$enddefinitions $end\n");
+  fprintf(emu_vcd, "#0\n");
+  fprintf(emu_vcd, "%dr\n%dg\n%db\n", emu_leds & 1, (emu_leds >> 1) & 1, (emu_leds >> 2) & 1);
+}
+
+static int emu_pty_open(void)
+{
+  int slave;
+  char *name;
+  struct termios tio;
+
+  emu_pty = posix_openpt(O_RDWR | O_NOCTTY);
+  if (emu_pty < 0 || grantpt(emu_pty) != 0 || unlockpt(emu_pty) != 0) {
+    perror("posix_openpt");
+    return -1;
+  }
+  name = ptsname(emu_pty);
+
+  /* Kept open, so the master does not see a hangup between clients. */
+  slave = open(name, O_RDWR | O_NOCTTY);
+  if (slave < 0) {
+    perror(name);
+    return -1;
+  }
+  if (tcgetattr(slave, &tio) == 0) {
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+  }
+
+  fcntl(emu_pty, F_SETFL, fcntl(emu_pty, F_GETFL) | O_NONBLOCK);
+  fprintf(stderr, "uart0: %s\n", name);
+  return 0;
+}
+
+/* Sleeps while the emulated clock is ahead of the real one. */
+static void emu_pace(void)
+{
+  static struct timespec start;
+  static int started = 0;
+  struct timespec now, delay;
+  unsigned long virtual_ns, real_ns;
+
+  if (!started) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    started = 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  real_ns = (now.tv_sec - start.tv_sec) * 1000000000UL + now.tv_nsec - start.tv_nsec;
+  virtual_ns = periph_now() * 125 / 4;
+  if (virtual_ns > real_ns) {
+    delay.tv_sec = (virtual_ns - real_ns) / 1000000000UL;
+    delay.tv_nsec = (virtual_ns - real_ns) % 1000000000UL;
+    nanosleep(&delay, NULL);
+  }
+}
+
+/* Runs until the duration in clocks is over, the input file has been
+ * answered, or the emulation is interrupted. Returns -1 on a CPU fault. */
+static int emu_run(unsigned long duration, int realtime)
+{
+  unsigned long now, next, pace, pc;
+  unsigned char level;
+  int source, clocks;
+
+  pace = EMU_PACE_CLOCKS;
+
+  while (!emu_stop) {
+    now = periph_now();
+    if (duration != 0 && now >= duration) {
+      break;
+    }
+    if (emu_input_end != 0 && now - emu_input_end >= EMU_QUIET_CLOCKS &&
+      now - emu_output_last >= EMU_QUIET_CLOCKS) {
+      break;
+    }
+    if (realtime && now >= pace) {
+      emu_pace();
+      pace = now + EMU_PACE_CLOCKS;
+    }
+
+    if (!cpu_held()) {
+      source = periph_interrupt(cpu_psw(), &level);
+      if (source >= 0) {
+        periph_acknowledge(source);
+        cpu_interrupt(source, level);
+        emu_interrupts[source]++;
+        profile_interrupt(cpu_pc(), cpu_sp(), now);
+        profile_charge(cpu_pc(), EMU_INTERRUPT_CLOCKS);
+        profile_sp(cpu_sp());
+        periph_advance(EMU_INTERRUPT_CLOCKS);
+        continue;
+      }
+    }
+
+    if (cpu_halted()) {
+      if (periph_wakeup()) {
+        cpu_wakeup();
+        continue;
+      }
+      next = periph_idle();
+      if (duration != 0 && next > duration) {
+        next = duration;
+      }
+      if (next == ~0UL && emu_registers) {
+        return 0;
+      }
+      if (next == ~0UL) {
+        fprintf(stderr, "halted with no interrupt source running at 0x%05lx\n", cpu_pc());
+        return -1;
+      }
+      profile_halt(next - now);
+      periph_advance(next - now);
+      continue;
+    }
+
+    pc = cpu_pc();
+    if (emu_pfdl(pc)) {
+      continue;
+    }
+
+    clocks = cpu_step();
+    if (clocks < 0) {
+      fprintf(stderr, "%s\n", cpu_error());
+      return -1;
+    }
+    emu_instructions++;
+    profile_charge(pc, clocks);
+    if (cpu_flow() == CPU_FLOW_CALL) {
+      profile_call(cpu_pc(), cpu_sp(), now);
+    } else if (cpu_flow() == CPU_FLOW_RETURN) {
+      profile_return(cpu_sp(), now + clocks);
+    }
+    profile_sp(cpu_sp());
+    periph_advance(clocks);
+  }
+
+  return 0;
+}
+
+static void emu_report(void)
+{
+  int i;
+
+  profile_report(stderr, periph_now());
+
+  fprintf(stderr, "\nemulated: %.3f ms, %lu cycles, %lu instructions\n",
+    periph_now() / (CPU_HZ / 1000.0), periph_now(), emu_instructions);
+
+  for (i = 0; i < PERIPH_SOURCES; i++) {
+    if (emu_interrupts[i] == 0) {
+      continue;
+    }
+    fprintf(stderr, "interrupt %2d %-16s %lu\n", i, profile_name(emu_word(0x04 + i * 2)),
+      emu_interrupts[i]);
+  }
+}
+
+/* On stdout, for comparing the end state of test programs. */
+static void emu_registers_print(void)
+{
+  unsigned long bank;
+  unsigned char psw;
+
+  psw = cpu_psw();
+  bank = CPU_REGISTERS + (3 - (((psw & CPU_PSW_RBS1) ? 2 : 0) + ((psw & CPU_PSW_RBS0) ? 1 : 0))) * 8;
+
+  printf("ax %04x bc %04x de %04x hl %04x\n", emu_word(bank), emu_word(bank + 2),
+    emu_word(bank + 4), emu_word(bank + 6));
+  printf("sp %04x psw %02x cs %02x es %02x pc %05lx\n", cpu_sp(), psw,
+    periph_memory[CPU_CS], periph_memory[CPU_ES], cpu_pc());
+  printf("cycles %lu instructions %lu\n", periph_now(), emu_instructions);
+}
+
+static int emu_data_flash(char *filename, int save)
+{
+  FILE *fh;
+
+  fh = fopen(filename, save ? "wb" : "rb");
+  if (fh == NULL) {
+    if (!save) {
+      return 0; /* Starts erased. */
+    }
+    perror(filename);
+    return -1;
+  }
+  if (save) {
+    fwrite(periph_data_flash(), 1, PERIPH_DATA_FLASH_SIZE, fh);
+  } else if (fread(periph_data_flash(), 1, PERIPH_DATA_FLASH_SIZE, fh) == 0) {
+    fprintf(stderr, "%s: empty, starting erased\n", filename);
+  }
+  fclose(fh);
+  return 0;
+}
+
+static void usage(char *prog)
+{
+  printf("Usage: %s [-t ms] [-i file] [-f] [-v file.vcd] [-d file] [-p file.folded] [-r] <kurumi.elf|kurumi.bin>\n", prog);
+  printf("  -t  Emulated time, default until interrupted\n");
+  printf("  -i  Send the file to UART0 and print the answers, instead of a pty\n");
+  printf("  -f  Run as fast as possible instead of in real time\n");
+  printf("  -v  Write the LED pins as a VCD timeline\n");
+  printf("  -d  Load and save the data flash from the file\n");
+  printf("  -p  Write cycles per call path as folded stacks, for flamegraph.pl\n");
+  printf("  -r  End when halted with no interrupt source and print the registers\n");
+}
+
+int main(int argc, char *argv[])
+{
+  int c, realtime, result;
+  unsigned long duration;
+  char *input_file, *vcd_file, *flash_file, *folded_file;
+  FILE *fh;
+
+  duration = 0;
+  realtime = 1;
+  input_file = NULL;
+  vcd_file = NULL;
+  flash_file = NULL;
+  folded_file = NULL;
+
+  while ((c = getopt(argc, argv, "ht:i:fv:d:p:r")) != -1) {
+    switch (c) {
+    case 'h':
+      usage(argv[0]);
+      return EXIT_SUCCESS;
+
+    case 't':
+      duration = strtoul(optarg, NULL, 10) * (CPU_HZ / 1000);
+      break;
+
+    case 'i':
+      input_file = optarg;
+      break;
+
+    case 'f':
+      realtime = 0;
+      break;
+
+    case 'v':
+      vcd_file = optarg;
+      break;
+
+    case 'd':
+      flash_file = optarg;
+      break;
+
+    case 'p':
+      folded_file = optarg;
+      break;
+
+    case 'r':
+      emu_registers = 1;
+      break;
+
+    case '?':
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (optind >= argc) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  periph_reset();
+  if (emu_load(argv[optind]) != 0) {
+    return EXIT_FAILURE;
+  }
+  if (flash_file != NULL && emu_data_flash(flash_file, 0) != 0) {
+    return EXIT_FAILURE;
+  }
+
+  if (input_file != NULL) {
+    emu_input = fopen(input_file, "rb");
+    if (emu_input == NULL) {
+      perror(input_file);
+      return EXIT_FAILURE;
+    }
+  } else if (emu_pty_open() != 0) {
+    return EXIT_FAILURE;
+  }
+
+  if (vcd_file != NULL) {
+    emu_vcd = fopen(vcd_file, "w");
+    if (emu_vcd == NULL) {
+      perror(vcd_file);
+      return EXIT_FAILURE;
+    }
+    emu_vcd_header();
+  }
+
+  signal(SIGINT, emu_signal);
+  signal(SIGTERM, emu_signal);
+
+  cpu_reset();
+  profile_call(cpu_pc(), 0x10000, 0); /* Never returns, above any SP. */
+  result = emu_run(duration, realtime);
+  emu_report();
+  if (emu_registers && result == 0) {
+    emu_registers_print();
+  }
+
+  if (emu_vcd != NULL) {
+    emu_vcd_time();
+    fclose(emu_vcd);
+  }
+  if (flash_file != NULL && emu_data_flash(flash_file, 1) != 0) {
+    result = -1;
+  }
+  if (folded_file != NULL) {
+    fh = fopen(folded_file, "w");
+    if (fh == NULL) {
+      perror(folded_file);
+      result = -1;
+    } else {
+      profile_folded(fh);
+      fclose(fh);
+    }
+  }
+
+  return (result == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
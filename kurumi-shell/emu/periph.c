@@ -0,0 +1,621 @@
+#include <string.h>
+#include "cpu.h"
+#include "periph.h"
+
+/* The peripherals used by the shell firmware: the interrupt controller,
+ * UART0 on SAU0 channels 0 and 1, TAU0, the interval timer, the MDU and
+ * the ports. Everything else reads back what was written. Time is counted
+ * in CPU clocks, and each peripheral keeps the clock of its next event. */
+
+#define PERIPH_NEVER (~0UL)
+
+#define PERIPH_FLASH_SIZE 0x40000
+#define PERIPH_MIRROR     0xf3000
+#define PERIPH_MIRROR_END 0xfaf00
+#define PERIPH_RAM        0xfaf00
+
+/* Interrupt flag registers for each group of eight sources, the mask and
+ * priority registers follow at fixed offsets. */
+#define PERIPH_MK  0x04
+#define PERIPH_PR0 0x08
+#define PERIPH_PR1 0x0c
+
+#define PERIPH_SOURCE_ST0   13
+#define PERIPH_SOURCE_SR0   14
+#define PERIPH_SOURCE_SRE0  15
+#define PERIPH_SOURCE_IT    26
+#define PERIPH_SOURCE_MD    45
+
+#define PERIPH_P0     0xfff00
+#define PERIPH_P14    0xfff0e
+#define PERIPH_SDR00  0xfff10
+#define PERIPH_SDR01  0xfff12
+#define PERIPH_TDR00  0xfff18
+#define PERIPH_TDR01  0xfff1a
+#define PERIPH_TDR02  0xfff64
+#define PERIPH_ITMC   0xfff90
+#define PERIPH_MDAL   0xffff0
+#define PERIPH_MDAH   0xffff2
+#define PERIPH_MDBH   0xffff4
+#define PERIPH_MDBL   0xffff6
+
+#define PERIPH_DFLCTL 0xf0090
+#define PERIPH_MDCL   0xf00e0
+#define PERIPH_MDCH   0xf00e2
+#define PERIPH_MDUC   0xf00e8
+#define PERIPH_PER0   0xf00f0
+#define PERIPH_OSMC   0xf00f3
+#define PERIPH_SSR00  0xf0100
+#define PERIPH_SSR01  0xf0102
+#define PERIPH_SIR01  0xf010a
+#define PERIPH_SMR00  0xf0110
+#define PERIPH_SCR01  0xf011a
+#define PERIPH_SE0    0xf0120
+#define PERIPH_SS0    0xf0122
+#define PERIPH_ST0    0xf0124
+#define PERIPH_SPS0   0xf0126
+#define PERIPH_TCR00  0xf0180
+#define PERIPH_TMR00  0xf0190
+#define PERIPH_TE0    0xf01b0
+#define PERIPH_TS0    0xf01b2
+#define PERIPH_TT0    0xf01b4
+#define PERIPH_TPS0   0xf01b6
+
+#define PERIPH_PER0_TAU0EN 0x01
+#define PERIPH_PER0_RTCEN  0x80
+
+#define PERIPH_SSR_TSF 0x40
+#define PERIPH_SSR_BFF 0x20
+#define PERIPH_SSR_OVF 0x01
+
+#define PERIPH_UART_BITS 10 /* Start, eight data bits and stop. */
+
+#define PERIPH_TAU_CHANNELS 8
+
+unsigned char periph_memory[CPU_MEM_SIZE];
+
+static const unsigned long periph_if[PERIPH_SOURCES / 8] = {
+  0xfffe0, 0xfffe1, 0xfffe2, 0xfffe3, 0xfffd0, 0xfffd1, 0xfffd2,
+};
+
+static const unsigned char periph_tau_source[PERIPH_TAU_CHANNELS] = {
+  20, 21, 22, 23, 31, 32, 33, 34,
+};
+
+static unsigned long periph_clock = 0;
+
+/* UART0, transmit on channel 0 and receive on channel 1. */
+static unsigned long periph_tx_done = PERIPH_NEVER;
+static int periph_tx_shift = -1; /* Byte being sent. */
+static int periph_tx_buffer = -1; /* Byte waiting behind it. */
+static unsigned long periph_rx_next = PERIPH_NEVER;
+
+/* TAU0 channels in interval timer mode. */
+typedef struct {
+  unsigned long start; /* Clock at the last reload. */
+  unsigned long next; /* Clock of the next count of zero. */
+  unsigned int reload; /* Count at the last reload. */
+  unsigned char shift; /* Prescaler of the selected clock. */
+} periph_tau_t;
+
+static periph_tau_t periph_tau[PERIPH_TAU_CHANNELS];
+static unsigned char periph_tcr_high[PERIPH_TAU_CHANNELS];
+
+/* Interval timer. */
+static unsigned long periph_it_start = 0;
+static unsigned long periph_it_count = 0; /* Interrupts since start. */
+static unsigned long periph_it_next = PERIPH_NEVER;
+
+static unsigned int periph_get16(unsigned long addr)
+{
+  return periph_memory[addr] | (periph_memory[addr + 1] << 8);
+}
+
+static void periph_set16(unsigned long addr, unsigned int value)
+{
+  periph_memory[addr] = value & 0xff;
+  periph_memory[addr + 1] = (value >> 8) & 0xff;
+}
+
+static void periph_request(int source)
+{
+  periph_memory[periph_if[source / 8]] |= 1 << (source % 8);
+}
+
+void periph_acknowledge(int source)
+{
+  periph_memory[periph_if[source / 8]] &= ~(1 << (source % 8));
+}
+
+/* Returns the source with the highest priority that may interrupt with the
+ * given PSW, or -1 if none, and its level. */
+int periph_interrupt(unsigned char psw, unsigned char *level)
+{
+  int group, bit, source, best;
+  unsigned char pending, l, best_level;
+  unsigned long addr;
+
+  if ((psw & CPU_PSW_IE) == 0) {
+    return -1;
+  }
+
+  best = -1;
+  best_level = 4;
+  for (group = 0; group < PERIPH_SOURCES / 8; group++) {
+    addr = periph_if[group];
+    pending = periph_memory[addr] & ~periph_memory[addr + PERIPH_MK];
+    if (pending == 0) {
+      continue;
+    }
+    for (bit = 0; bit < 8; bit++) {
+      if ((pending & (1 << bit)) == 0) {
+        continue;
+      }
+      source = group * 8 + bit;
+      l = ((periph_memory[addr + PERIPH_PR1] >> bit) & 1) << 1;
+      l |= (periph_memory[addr + PERIPH_PR0] >> bit) & 1;
+      if (l < best_level) {
+        best = source;
+        best_level = l;
+      }
+    }
+  }
+
+  if (best < 0 || best_level > ((psw & CPU_PSW_ISP) >> 1)) {
+    return -1;
+  }
+
+  *level = best_level;
+  return best;
+}
+
+/* HALT is released by any unmasked request, even with interrupts disabled. */
+unsigned char periph_wakeup(void)
+{
+  int group;
+  unsigned long addr;
+
+  for (group = 0; group < PERIPH_SOURCES / 8; group++) {
+    addr = periph_if[group];
+    if (periph_memory[addr] & ~periph_memory[addr + PERIPH_MK]) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static unsigned long periph_uart_bit(void)
+{
+  unsigned int smr, sdr;
+  unsigned char shift;
+
+  smr = periph_get16(PERIPH_SMR00);
+  shift = periph_memory[PERIPH_SPS0];
+  shift = (smr & 0x8000) ? (shift >> 4) : (shift & 0x0f);
+  sdr = periph_get16(PERIPH_SDR00);
+
+  return ((unsigned long)((sdr >> 9) + 1) * 2) << shift;
+}
+
+unsigned long periph_uart_baud(void)
+{
+  return CPU_HZ / periph_uart_bit();
+}
+
+static void periph_uart_send(void)
+{
+  periph_tx_done = periph_clock + periph_uart_bit() * PERIPH_UART_BITS;
+  periph_memory[PERIPH_SSR00] |= PERIPH_SSR_TSF;
+}
+
+static void periph_uart_tx_event(void)
+{
+  emu_uart_send(periph_tx_shift);
+  periph_tx_shift = -1;
+  periph_tx_done = PERIPH_NEVER;
+  periph_memory[PERIPH_SSR00] &= ~PERIPH_SSR_TSF;
+
+  if (periph_tx_buffer >= 0) {
+    periph_tx_shift = periph_tx_buffer;
+    periph_tx_buffer = -1;
+    periph_memory[PERIPH_SSR00] &= ~PERIPH_SSR_BFF;
+    periph_uart_send();
+  }
+
+  /* Transfer end interrupt, or buffer empty with MD0 set. */
+  periph_request(PERIPH_SOURCE_ST0);
+}
+
+static void periph_uart_rx_event(void)
+{
+  int c;
+
+  periph_rx_next += periph_uart_bit() * PERIPH_UART_BITS;
+
+  c = emu_uart_recv();
+  if (c < 0) {
+    return;
+  }
+
+  if (periph_memory[PERIPH_SSR01] & PERIPH_SSR_BFF) {
+    periph_memory[PERIPH_SSR01] |= PERIPH_SSR_OVF;
+    if (periph_get16(PERIPH_SCR01) & 0x0400) { /* EOC */
+      periph_request(PERIPH_SOURCE_SRE0);
+    }
+  } else {
+    periph_memory[PERIPH_SSR01] |= PERIPH_SSR_BFF;
+  }
+  periph_memory[PERIPH_SDR01] = c;
+  periph_request(PERIPH_SOURCE_SR0);
+}
+
+static void periph_uart_control(unsigned long addr, unsigned char value)
+{
+  unsigned char enabled;
+
+  enabled = periph_memory[PERIPH_SE0];
+  if (addr == PERIPH_SS0) {
+    enabled |= value & 0x03;
+  } else if (addr == PERIPH_ST0) {
+    enabled &= ~(value & 0x03);
+  } else {
+    return;
+  }
+
+  if ((enabled & 0x02) && !(periph_memory[PERIPH_SE0] & 0x02)) {
+    periph_rx_next = periph_clock + periph_uart_bit() * PERIPH_UART_BITS;
+  } else if (!(enabled & 0x02)) {
+    periph_rx_next = PERIPH_NEVER;
+  }
+  if (!(enabled & 0x01)) {
+    periph_tx_done = PERIPH_NEVER;
+    periph_tx_shift = -1;
+    periph_tx_buffer = -1;
+    periph_memory[PERIPH_SSR00] &= ~(PERIPH_SSR_TSF | PERIPH_SSR_BFF);
+  }
+
+  periph_memory[PERIPH_SE0] = enabled;
+}
+
+static void periph_uart_write(unsigned char value)
+{
+  if (!(periph_memory[PERIPH_SE0] & 0x01)) {
+    return;
+  }
+
+  if (periph_tx_shift < 0) {
+    periph_tx_shift = value;
+    periph_uart_send();
+  } else {
+    /* Overwrites a byte still waiting, as the hardware would. */
+    periph_tx_buffer = value;
+    periph_memory[PERIPH_SSR00] |= PERIPH_SSR_BFF;
+  }
+}
+
+static unsigned long periph_tau_tdr(int channel)
+{
+  return (channel < 2) ? PERIPH_TDR00 + channel * 2 : PERIPH_TDR02 + (channel - 2) * 2;
+}
+
+static void periph_tau_reload(int channel, unsigned long start)
+{
+  periph_tau_t *tau;
+
+  tau = &periph_tau[channel];
+  tau->start = start;
+  tau->reload = periph_get16(periph_tau_tdr(channel));
+  tau->next = start + (((unsigned long)tau->reload + 1) << tau->shift);
+}
+
+static void periph_tau_start(int channel)
+{
+  unsigned int tmr, tps;
+
+  if (!(periph_memory[PERIPH_PER0] & PERIPH_PER0_TAU0EN)) {
+    return;
+  }
+
+  tmr = periph_get16(PERIPH_TMR00 + channel * 2);
+  tps = periph_get16(PERIPH_TPS0);
+  periph_tau[channel].shift = (tps >> ((tmr >> 14) * 4)) & 0x0f;
+
+  periph_memory[PERIPH_TE0] |= 1 << channel;
+  periph_tau_reload(channel, periph_clock);
+
+  if (tmr & 0x0001) { /* MD0, interrupt at count start. */
+    periph_request(periph_tau_source[channel]);
+  }
+}
+
+static void periph_tau_control(unsigned long addr, unsigned char value)
+{
+  int channel;
+
+  for (channel = 0; channel < PERIPH_TAU_CHANNELS; channel++) {
+    if ((value & (1 << channel)) == 0) {
+      continue;
+    }
+    if (addr == PERIPH_TS0) {
+      periph_tau_start(channel);
+    } else {
+      periph_memory[PERIPH_TE0] &= ~(1 << channel);
+      periph_tau[channel].next = PERIPH_NEVER;
+    }
+  }
+}
+
+static unsigned int periph_tau_count(int channel)
+{
+  periph_tau_t *tau;
+
+  tau = &periph_tau[channel];
+  if (!(periph_memory[PERIPH_TE0] & (1 << channel))) {
+    return periph_get16(PERIPH_TCR00 + channel * 2);
+  }
+
+  return tau->reload - ((periph_clock - tau->start) >> tau->shift);
+}
+
+static unsigned long periph_it_period(unsigned long n)
+{
+  unsigned long ticks, hz;
+
+  hz = (periph_memory[PERIPH_OSMC] & 0x10) ? 15000 : 32768;
+  ticks = (periph_get16(PERIPH_ITMC) & 0x0fff) + 1;
+
+  return periph_it_start + (n * ticks * CPU_HZ) / hz;
+}
+
+static void periph_it_control(void)
+{
+  if ((periph_get16(PERIPH_ITMC) & 0x8000) && (periph_memory[PERIPH_PER0] & PERIPH_PER0_RTCEN)) {
+    if (periph_it_next == PERIPH_NEVER) {
+      periph_it_start = periph_clock;
+      periph_it_count = 1;
+      periph_it_next = periph_it_period(periph_it_count);
+    }
+  } else {
+    periph_it_next = PERIPH_NEVER;
+  }
+}
+
+static void periph_mdu_multiply(void)
+{
+  unsigned int mduc;
+  unsigned long a, b, result, c;
+
+  mduc = periph_memory[PERIPH_MDUC];
+  if (mduc & 0x80) {
+    return; /* Division mode waits for DIVST. */
+  }
+
+  a = periph_get16(PERIPH_MDAL);
+  b = periph_get16(PERIPH_MDAH);
+  if (mduc & 0x08) { /* Signed. */
+    result = (unsigned long)((long)(short)a * (long)(short)b);
+  } else {
+    result = a * b;
+  }
+  result &= 0xffffffffUL;
+  periph_set16(PERIPH_MDBL, result & 0xffff);
+  periph_set16(PERIPH_MDBH, (result >> 16) & 0xffff);
+
+  if (mduc & 0x40) { /* Multiply and accumulate. */
+    c = ((unsigned long)periph_get16(PERIPH_MDCH) << 16) | periph_get16(PERIPH_MDCL);
+    c = (c + result) & 0xffffffffUL;
+    periph_set16(PERIPH_MDCL, c & 0xffff);
+    periph_set16(PERIPH_MDCH, (c >> 16) & 0xffff);
+  }
+}
+
+static void periph_mdu_divide(void)
+{
+  unsigned long a, b, q, r;
+
+  a = ((unsigned long)periph_get16(PERIPH_MDAH) << 16) | periph_get16(PERIPH_MDAL);
+  b = ((unsigned long)periph_get16(PERIPH_MDBH) << 16) | periph_get16(PERIPH_MDBL);
+  if (b == 0) {
+    q = 0xffffffffUL;
+    r = a;
+  } else {
+    q = a / b;
+    r = a % b;
+  }
+
+  periph_set16(PERIPH_MDAL, q & 0xffff);
+  periph_set16(PERIPH_MDAH, (q >> 16) & 0xffff);
+  periph_set16(PERIPH_MDCL, r & 0xffff);
+  periph_set16(PERIPH_MDCH, (r >> 16) & 0xffff);
+  periph_memory[PERIPH_MDUC] &= ~0x01;
+  periph_request(PERIPH_SOURCE_MD);
+}
+
+void periph_reset(void)
+{
+  int i;
+
+  memset(periph_memory, 0, sizeof(periph_memory));
+  memset(periph_memory, 0xff, PERIPH_FLASH_SIZE);
+  memset(&periph_memory[PERIPH_DATA_FLASH], 0xff, PERIPH_DATA_FLASH_SIZE);
+
+  for (i = 0; i < PERIPH_SOURCES / 8; i++) {
+    periph_memory[periph_if[i] + PERIPH_MK] = 0xff;
+    periph_memory[periph_if[i] + PERIPH_PR0] = 0xff;
+    periph_memory[periph_if[i] + PERIPH_PR1] = 0xff;
+  }
+
+  periph_clock = 0;
+  periph_tx_done = PERIPH_NEVER;
+  periph_tx_shift = -1;
+  periph_tx_buffer = -1;
+  periph_rx_next = PERIPH_NEVER;
+  for (i = 0; i < PERIPH_TAU_CHANNELS; i++) {
+    periph_tau[i].next = PERIPH_NEVER;
+  }
+  periph_it_next = PERIPH_NEVER;
+}
+
+unsigned char periph_read(unsigned long addr)
+{
+  int channel;
+  unsigned int count;
+
+  if (addr >= PERIPH_MIRROR && addr < PERIPH_MIRROR_END) {
+    return periph_memory[addr - 0xf0000];
+  }
+  if (addr >= PERIPH_DATA_FLASH && addr < PERIPH_DATA_FLASH + PERIPH_DATA_FLASH_SIZE &&
+    !(periph_memory[PERIPH_DFLCTL] & 0x01)) {
+    return 0;
+  }
+
+  if (addr >= PERIPH_TCR00 && addr < PERIPH_TCR00 + PERIPH_TAU_CHANNELS * 2) {
+    /* The count is taken on the low byte, as by a 16-bit read. */
+    channel = (addr - PERIPH_TCR00) / 2;
+    if (addr & 1) {
+      return periph_tcr_high[channel];
+    }
+    count = periph_tau_count(channel);
+    periph_tcr_high[channel] = (count >> 8) & 0xff;
+    return count & 0xff;
+  }
+
+  if (addr == PERIPH_SDR01) {
+    periph_memory[PERIPH_SSR01] &= ~PERIPH_SSR_BFF;
+  }
+
+  return periph_memory[addr];
+}
+
+void periph_write(unsigned long addr, unsigned char value)
+{
+  if (addr < PERIPH_RAM && addr >= PERIPH_MIRROR) {
+    return; /* Mirror of the code flash. */
+  }
+  if (addr < PERIPH_FLASH_SIZE ||
+    (addr >= PERIPH_DATA_FLASH && addr < PERIPH_DATA_FLASH + PERIPH_DATA_FLASH_SIZE)) {
+    return; /* Only written by the flash libraries. */
+  }
+
+  switch (addr) {
+  case PERIPH_SDR00:
+    periph_memory[addr] = value;
+    periph_uart_write(value);
+    return;
+  case PERIPH_SDR00 + 1:
+  case PERIPH_SDR01 + 1:
+    /* The transfer clock bits are fixed while the channel operates. */
+    if (periph_memory[PERIPH_SE0] & (1 << ((addr - PERIPH_SDR00) / 2))) {
+      return;
+    }
+    break;
+  case PERIPH_SIR01:
+    periph_memory[PERIPH_SSR01] &= ~(value & 0x07);
+    return;
+  case PERIPH_SS0:
+  case PERIPH_ST0:
+    periph_uart_control(addr, value);
+    return;
+  case PERIPH_SS0 + 1:
+  case PERIPH_ST0 + 1:
+  case PERIPH_TS0 + 1:
+  case PERIPH_TT0 + 1:
+  case PERIPH_SE0:
+  case PERIPH_SSR00:
+  case PERIPH_SSR01:
+  case PERIPH_TE0:
+    return; /* Trigger or read-only bits. */
+  case PERIPH_TS0:
+  case PERIPH_TT0:
+    periph_tau_control(addr, value);
+    return;
+  case PERIPH_ITMC:
+  case PERIPH_ITMC + 1:
+    periph_memory[addr] = value;
+    periph_it_control();
+    return;
+  case PERIPH_PER0:
+    periph_memory[addr] = value;
+    periph_it_control();
+    return;
+  case PERIPH_MDAL:
+  case PERIPH_MDAL + 1:
+  case PERIPH_MDAH:
+  case PERIPH_MDAH + 1:
+    periph_memory[addr] = value;
+    periph_mdu_multiply();
+    return;
+  case PERIPH_MDUC:
+    periph_memory[addr] = value;
+    if ((value & 0x81) == 0x81) {
+      periph_mdu_divide();
+    }
+    return;
+  }
+
+  periph_memory[addr] = value;
+
+  if (addr >= PERIPH_P0 && addr <= PERIPH_P14) {
+    emu_port_write(addr - PERIPH_P0, value);
+  }
+}
+
+unsigned long periph_now(void)
+{
+  return periph_clock;
+}
+
+/* Clock of the next peripheral event, or ~0 if there is none. */
+unsigned long periph_idle(void)
+{
+  unsigned long next;
+  int i;
+
+  next = periph_tx_done;
+  if (periph_rx_next < next) {
+    next = periph_rx_next;
+  }
+  if (periph_it_next < next) {
+    next = periph_it_next;
+  }
+  for (i = 0; i < PERIPH_TAU_CHANNELS; i++) {
+    if (periph_tau[i].next < next) {
+      next = periph_tau[i].next;
+    }
+  }
+
+  return next;
+}
+
+void periph_advance(unsigned long cycles)
+{
+  int i;
+
+  periph_clock += cycles;
+
+  while (periph_idle() <= periph_clock) {
+    if (periph_tx_done <= periph_clock) {
+      periph_uart_tx_event();
+    }
+    if (periph_rx_next <= periph_clock) {
+      periph_uart_rx_event();
+    }
+    if (periph_it_next <= periph_clock) {
+      periph_request(PERIPH_SOURCE_IT);
+      periph_it_count++;
+      periph_it_next = periph_it_period(periph_it_count);
+    }
+    for (i = 0; i < PERIPH_TAU_CHANNELS; i++) {
+      if (periph_tau[i].next <= periph_clock) {
+        periph_request(periph_tau_source[i]);
+        periph_tau_reload(i, periph_tau[i].next);
+      }
+    }
+  }
+}
+
+unsigned char *periph_data_flash(void)
+{
+  return &periph_memory[PERIPH_DATA_FLASH];
+}
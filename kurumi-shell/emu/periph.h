@@ -0,0 +1,33 @@
+#ifndef _PERIPH_H
+#define _PERIPH_H
+
+#define PERIPH_DATA_FLASH      0xf1000
+#define PERIPH_DATA_FLASH_SIZE 0x2000
+
+#define PERIPH_SOURCES 56 /* Interrupt sources, numbered as in the vector table. */
+
+/* Flash, RAM and SFRs. Reads and writes with side effects go through
+ * periph_read() and periph_write(), the core may use the rest directly. */
+extern unsigned char periph_memory[];
+
+void periph_reset(void);
+unsigned char periph_read(unsigned long addr);
+void periph_write(unsigned long addr, unsigned char value);
+
+unsigned long periph_now(void);
+void periph_advance(unsigned long cycles);
+unsigned long periph_idle(void);
+
+int periph_interrupt(unsigned char psw, unsigned char *level);
+unsigned char periph_wakeup(void);
+void periph_acknowledge(int source);
+
+unsigned char *periph_data_flash(void);
+unsigned long periph_uart_baud(void);
+
+/* Provided by the emulator around the peripherals. */
+int emu_uart_recv(void);
+void emu_uart_send(unsigned char c);
+void emu_port_write(int port, unsigned char value);
+
+#endif /* _PERIPH_H */
@@ -0,0 +1,404 @@
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+
+#define PROFILE_DEPTH 256 /* Far deeper than the shell ever calls. */
+
+#define PROFILE_UNKNOWN -1 /* Code outside of any symbol. */
+#define PROFILE_HALT    -2
+
+#define PROFILE_SP_RAM 0xaf00 /* Lower SP values are not set up yet. */
+
+typedef struct {
+  unsigned long addr;
+  unsigned long end;
+  char *name;
+  unsigned long self; /* Cycles in the function itself. */
+  unsigned long inclusive; /* Cycles until it returned, without interrupts. */
+  unsigned long calls;
+} profile_function_t;
+
+/* Call tree for the folded stacks, interrupts start from the root. */
+typedef struct {
+  int function;
+  int parent;
+  int child; /* First child, -1 if none. */
+  int sibling;
+  unsigned long cycles;
+} profile_node_t;
+
+typedef struct {
+  int function;
+  int node;
+  unsigned int sp; /* Just after the call, pointing at the return address. */
+  unsigned long entry;
+  unsigned long interrupted; /* Interrupt cycles at entry. */
+  unsigned char interrupt;
+} profile_frame_t;
+
+static profile_function_t *profile_functions = NULL;
+static int profile_function_count = 0;
+static int profile_function_size = 0;
+static profile_function_t *profile_current = NULL;
+static unsigned long profile_unknown = 0;
+static unsigned long profile_halted = 0;
+
+static profile_node_t *profile_nodes = NULL;
+static int profile_node_count = 0;
+static int profile_node_size = 0;
+
+static profile_frame_t profile_frames[PROFILE_DEPTH];
+static int profile_depth = 0;
+static unsigned long profile_overflows = 0;
+static int profile_interrupt_depth = 0;
+static unsigned long profile_interrupt_cycles = 0; /* Outermost handlers only. */
+
+static unsigned int profile_sp_lowest = 0x10000;
+static unsigned int profile_bss_end = 0;
+static unsigned int profile_stack_top = 0;
+
+void profile_symbol(char *name, unsigned long addr)
+{
+  profile_function_t *function;
+
+  if (profile_function_count == profile_function_size) {
+    profile_function_size = profile_function_size ? profile_function_size * 2 : 256;
+    profile_functions = realloc(profile_functions, profile_function_size * sizeof(profile_function_t));
+    if (profile_functions == NULL) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  function = &profile_functions[profile_function_count++];
+  memset(function, 0, sizeof(profile_function_t));
+  function->addr = addr;
+  function->name = strdup(name);
+}
+
+static int profile_addr_compare(const void *a, const void *b)
+{
+  const profile_function_t *fa = a, *fb = b;
+
+  if (fa->addr != fb->addr) {
+    return (fa->addr < fb->addr) ? -1 : 1;
+  }
+  return 0;
+}
+
+void profile_symbols_done(void)
+{
+  int i;
+
+  qsort(profile_functions, profile_function_count, sizeof(profile_function_t), profile_addr_compare);
+
+  /* Each function ends where the next one starts, which also covers
+   * assembler code without sizes. */
+  for (i = 0; i < profile_function_count; i++) {
+    profile_functions[i].end = (i + 1 < profile_function_count) ?
+      profile_functions[i + 1].addr : ~0UL;
+  }
+}
+
+static int profile_function(unsigned long addr)
+{
+  int low, high, mid;
+
+  low = 0;
+  high = profile_function_count - 1;
+  while (low <= high) {
+    mid = (low + high) / 2;
+    if (addr < profile_functions[mid].addr) {
+      high = mid - 1;
+    } else if (addr >= profile_functions[mid].end) {
+      low = mid + 1;
+    } else {
+      return mid;
+    }
+  }
+
+  return PROFILE_UNKNOWN;
+}
+
+unsigned long profile_lookup(char *name)
+{
+  int i;
+
+  for (i = 0; i < profile_function_count; i++) {
+    if (strcmp(profile_functions[i].name, name) == 0) {
+      return profile_functions[i].addr;
+    }
+  }
+
+  return 0;
+}
+
+static const char *profile_function_name(int function)
+{
+  if (function == PROFILE_HALT) {
+    return "[halt]";
+  }
+  if (function == PROFILE_UNKNOWN) {
+    return "[unknown]";
+  }
+  return profile_functions[function].name;
+}
+
+const char *profile_name(unsigned long addr)
+{
+  return profile_function_name(profile_function(addr));
+}
+
+void profile_stack_limits(unsigned int bss_end, unsigned int stack_top)
+{
+  profile_bss_end = bss_end;
+  profile_stack_top = stack_top;
+}
+
+static int profile_child(int parent, int function)
+{
+  int node;
+
+  if (profile_node_count == 0) {
+    parent = -1; /* Creating the root. */
+  } else {
+    for (node = profile_nodes[parent].child; node >= 0; node = profile_nodes[node].sibling) {
+      if (profile_nodes[node].function == function) {
+        return node;
+      }
+    }
+  }
+
+  if (profile_node_count == profile_node_size) {
+    profile_node_size = profile_node_size ? profile_node_size * 2 : 1024;
+    profile_nodes = realloc(profile_nodes, profile_node_size * sizeof(profile_node_t));
+    if (profile_nodes == NULL) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  node = profile_node_count++;
+  profile_nodes[node].function = function;
+  profile_nodes[node].parent = parent;
+  profile_nodes[node].child = -1;
+  profile_nodes[node].cycles = 0;
+  if (parent >= 0) {
+    profile_nodes[node].sibling = profile_nodes[parent].child;
+    profile_nodes[parent].child = node;
+  } else {
+    profile_nodes[node].sibling = -1;
+  }
+
+  return node;
+}
+
+/* The node cycles are charged to, the root before the first call. */
+static int profile_node(void)
+{
+  if (profile_node_count == 0) {
+    profile_child(-1, PROFILE_UNKNOWN);
+  }
+  return (profile_depth > 0) ? profile_frames[profile_depth - 1].node : 0;
+}
+
+void profile_charge(unsigned long pc, unsigned long cycles)
+{
+  if (profile_current == NULL || pc < profile_current->addr || pc >= profile_current->end) {
+    profile_current = NULL;
+    if (profile_function(pc) >= 0) {
+      profile_current = &profile_functions[profile_function(pc)];
+    }
+  }
+
+  if (profile_current != NULL) {
+    profile_current->self += cycles;
+  } else {
+    profile_unknown += cycles;
+  }
+  profile_nodes[profile_node()].cycles += cycles;
+}
+
+void profile_halt(unsigned long cycles)
+{
+  profile_halted += cycles;
+  profile_nodes[profile_child(profile_node(), PROFILE_HALT)].cycles += cycles;
+}
+
+static void profile_push(unsigned long target, unsigned int sp, unsigned long now, int parent,
+  unsigned char interrupt)
+{
+  profile_frame_t *frame;
+  int function;
+
+  function = profile_function(target);
+  if (function >= 0) {
+    profile_functions[function].calls++;
+  }
+
+  if (profile_depth == PROFILE_DEPTH) {
+    profile_overflows++;
+    return;
+  }
+
+  frame = &profile_frames[profile_depth++];
+  frame->function = function;
+  frame->node = profile_child(parent, function);
+  frame->sp = sp;
+  frame->entry = now;
+  frame->interrupted = profile_interrupt_cycles;
+  frame->interrupt = interrupt;
+  if (interrupt) {
+    profile_interrupt_depth++;
+  }
+}
+
+void profile_call(unsigned long target, unsigned int sp, unsigned long now)
+{
+  profile_push(target, sp, now, profile_node(), 0);
+}
+
+void profile_interrupt(unsigned long target, unsigned int sp, unsigned long now)
+{
+  profile_node(); /* Make sure the root exists. */
+  profile_push(target, sp, now, 0, 1);
+}
+
+static void profile_pop(unsigned long now)
+{
+  profile_frame_t *frame;
+  unsigned long cycles;
+  int i;
+
+  frame = &profile_frames[--profile_depth];
+  cycles = now - frame->entry;
+
+  if (frame->interrupt) {
+    profile_interrupt_depth--;
+    if (profile_interrupt_depth == 0) {
+      profile_interrupt_cycles += cycles;
+    }
+  } else {
+    cycles -= profile_interrupt_cycles - frame->interrupted;
+  }
+
+  /* Recursive calls are only counted once, at the outermost call. */
+  if (frame->function < 0) {
+    return;
+  }
+  for (i = 0; i < profile_depth; i++) {
+    if (profile_frames[i].function == frame->function) {
+      return;
+    }
+  }
+  profile_functions[frame->function].inclusive += cycles;
+}
+
+/* Pops every frame the stack pointer has moved above, so returns that
+ * skip a level, such as from the emulated library calls, stay in step. */
+void profile_return(unsigned int sp, unsigned long now)
+{
+  while (profile_depth > 0 && profile_frames[profile_depth - 1].sp < sp) {
+    profile_pop(now);
+  }
+}
+
+void profile_sp(unsigned int sp)
+{
+  if (sp >= PROFILE_SP_RAM && sp < profile_sp_lowest) {
+    profile_sp_lowest = sp;
+  }
+}
+
+static int profile_self_compare(const void *a, const void *b)
+{
+  const profile_function_t *fa = *(profile_function_t * const *)a;
+  const profile_function_t *fb = *(profile_function_t * const *)b;
+
+  if (fa->self != fb->self) {
+    return (fa->self > fb->self) ? -1 : 1;
+  }
+  return 0;
+}
+
+void profile_report(FILE *out, unsigned long total)
+{
+  profile_function_t **sorted;
+  int i, n;
+
+  /* Frames still open count up to now. */
+  while (profile_depth > 0) {
+    profile_pop(total);
+  }
+  if (total == 0) {
+    total = 1;
+  }
+
+  fprintf(out, "\n%10s %12s %7s %12s  %s\n", "calls", "self", "%", "inclusive", "function");
+  sorted = malloc((profile_function_count + 1) * sizeof(profile_function_t *));
+  n = 0;
+  for (i = 0; sorted != NULL && i < profile_function_count; i++) {
+    if (profile_functions[i].self > 0 || profile_functions[i].calls > 0) {
+      sorted[n++] = &profile_functions[i];
+    }
+  }
+  qsort(sorted, n, sizeof(profile_function_t *), profile_self_compare);
+  for (i = 0; i < n; i++) {
+    fprintf(out, "%10lu %12lu %6.2f%% %12lu  %s\n", sorted[i]->calls, sorted[i]->self,
+      sorted[i]->self * 100.0 / total, sorted[i]->inclusive, sorted[i]->name);
+  }
+  free(sorted);
+  if (profile_unknown > 0) {
+    fprintf(out, "%10s %12lu %6.2f%% %12s  [unknown]\n", "", profile_unknown,
+      profile_unknown * 100.0 / total, "");
+  }
+  fprintf(out, "%10s %12lu %6.2f%% %12s  [halt]\n", "", profile_halted, profile_halted * 100.0 / total, "");
+  if (profile_overflows > 0) {
+    fprintf(out, "call stack deeper than %d frames %lu times\n", PROFILE_DEPTH, profile_overflows);
+  }
+
+  if (profile_sp_lowest > 0xffff) {
+    return;
+  }
+  fprintf(out, "\nstack: lowest SP 0x%04x", profile_sp_lowest);
+  if (profile_stack_top != 0) {
+    fprintf(out, ", %u bytes used", profile_stack_top - profile_sp_lowest);
+  }
+  if (profile_bss_end != 0) {
+    if (profile_sp_lowest < profile_bss_end) {
+      fprintf(out, ", %u bytes into .bss", profile_bss_end - profile_sp_lowest);
+    } else {
+      fprintf(out, ", %u bytes above the end of .bss", profile_sp_lowest - profile_bss_end);
+    }
+  }
+  fprintf(out, "\n");
+}
+
+/* One line per call path with its self cycles, as flamegraph.pl takes. */
+void profile_folded(FILE *out)
+{
+  int node, n, depth;
+  int path[PROFILE_DEPTH + 2];
+
+  for (node = 1; node < profile_node_count; node++) {
+    if (profile_nodes[node].cycles == 0) {
+      continue;
+    }
+
+    depth = 0;
+    for (n = node; n > 0 && depth < PROFILE_DEPTH + 2; n = profile_nodes[n].parent) {
+      path[depth++] = n;
+    }
+    while (depth > 0) {
+      depth--;
+      fprintf(out, "%s%c", profile_function_name(profile_nodes[path[depth]].function),
+        depth > 0 ? ';' : ' ');
+    }
+    fprintf(out, "%lu\n", profile_nodes[node].cycles);
+  }
+
+  /* Cycles before the first call. */
+  if (profile_node_count > 0 && profile_nodes[0].cycles > 0) {
+    fprintf(out, "%s %lu\n", profile_function_name(PROFILE_UNKNOWN), profile_nodes[0].cycles);
+  }
+}
@@ -0,0 +1,26 @@
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include <stdio.h>
+
+/* Cycles and calls per function, from the symbols of the ELF image. The
+ * emulator reports every instruction, call, return and interrupt, and a
+ * shadow call stack gives the inclusive cycles and the folded stacks. */
+
+void profile_symbol(char *name, unsigned long addr);
+void profile_symbols_done(void);
+unsigned long profile_lookup(char *name);
+const char *profile_name(unsigned long addr);
+void profile_stack_limits(unsigned int bss_end, unsigned int stack_top);
+
+void profile_charge(unsigned long pc, unsigned long cycles);
+void profile_halt(unsigned long cycles);
+void profile_call(unsigned long target, unsigned int sp, unsigned long now);
+void profile_interrupt(unsigned long target, unsigned int sp, unsigned long now);
+void profile_return(unsigned int sp, unsigned long now);
+void profile_sp(unsigned int sp);
+
+void profile_report(FILE *out, unsigned long total);
+void profile_folded(FILE *out);
+
+#endif /* _PROFILE_H */
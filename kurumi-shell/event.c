@@ -0,0 +1,42 @@
+#include "event.h"
+
+/* One byte per event, so posting is a single store that needs no locking
+ * in either interrupt handlers or the main loop. */
+static volatile unsigned char event_pending[EVENT_MAX];
+
+void event_post(EVENT event)
+{
+  event_pending[event] = 1;
+}
+
+unsigned char event_wait(unsigned char mask)
+{
+  int i;
+  unsigned char events;
+
+  asm("di"); /* Disable interrupts */
+
+  while (1) {
+    events = 0;
+    for (i = 0; i < EVENT_MAX; i++) {
+      if ((mask & EVENT_BIT(i)) && event_pending[i]) {
+        event_pending[i] = 0;
+        events |= EVENT_BIT(i);
+      }
+    }
+    if (events != 0) {
+      break;
+    }
+
+    /* An interrupt request releases the HALT even with interrupts disabled,
+     * so nothing posted after the check above can be missed. */
+    asm("halt");
+    asm("ei");
+    asm("nop"); /* Service the pending interrupt. */
+    asm("di");
+  }
+
+  asm("ei"); /* Enable interrupts */
+
+  return events;
+}
@@ -0,0 +1,16 @@
+#ifndef _EVENT_H
+#define _EVENT_H
+
+typedef enum {
+  EVENT_RX    = 0, /* Data received on UART0. */
+  EVENT_TX    = 1, /* Transmission on UART0 done. */
+  EVENT_TIMER = 2, /* Timer alarm deadline reached. */
+  EVENT_MAX   = 3,
+} EVENT;
+
+#define EVENT_BIT(event) (1 << (event))
+
+void event_post(EVENT event);
+unsigned char event_wait(unsigned char mask);
+
+#endif /* _EVENT_H */
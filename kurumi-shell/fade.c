@@ -0,0 +1,40 @@
+#include "fade.h"
+#include "led.h"
+
+void fade_set(volatile fade_t *fade, unsigned char level)
+{
+  fade->periods = 0;
+  fade->level_fp = (unsigned int)level << 8;
+}
+
+void fade_start(volatile fade_t *fade, unsigned char level, unsigned int ms)
+{
+  unsigned long periods;
+
+  periods = ((unsigned long)ms * 1000) / LED_PWM_PERIOD_US;
+  if (periods == 0) {
+    fade_set(fade, level);
+    return;
+  }
+  if (periods > 0xffff) {
+    periods = 0xffff;
+  }
+
+  fade->target = level;
+  fade->step = (((long)level << 8) - (long)fade->level_fp) / (long)periods;
+  fade->periods = periods;
+}
+
+void fade_period(volatile fade_t *fade)
+{
+  if (fade->periods == 0) {
+    return;
+  }
+
+  fade->periods--;
+  if (fade->periods == 0) {
+    fade->level_fp = (unsigned int)fade->target << 8;
+  } else {
+    fade->level_fp = (long)fade->level_fp + fade->step;
+  }
+}
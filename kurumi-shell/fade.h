@@ -0,0 +1,19 @@
+#ifndef _FADE_H
+#define _FADE_H
+
+/* LED level in 8.8 fixed-point, moved towards a target once per PWM period.
+ * Kept apart from the hardware in led.c, so the simulator fades the same. */
+typedef struct {
+  unsigned int level_fp;
+  long step; /* Up to a full 255.0 per period. */
+  unsigned int periods; /* Left until the target, 0 when not fading. */
+  unsigned char target;
+} fade_t;
+
+#define FADE_LEVEL(fade) ((unsigned char)((fade)->level_fp >> 8))
+
+void fade_set(volatile fade_t *fade, unsigned char level);
+void fade_start(volatile fade_t *fade, unsigned char level, unsigned int ms);
+void fade_period(volatile fade_t *fade);
+
+#endif /* _FADE_H */
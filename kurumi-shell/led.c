@@ -1,67 +1,255 @@
 #include <iodefine.h>
 #include <iodefine_ext.h>
 #include "led.h"
+#include "fade.h"
 
-#define LED_RED   P1.BIT.bit7
-#define LED_GREEN P5.BIT.bit1
-#define LED_BLUE  P5.BIT.bit0
+#define LED_RED_PIN   P1.BIT.bit7
+#define LED_GREEN_PIN P5.BIT.bit1
+#define LED_BLUE_PIN  P5.BIT.bit0
 
-void led_setup(void)
+/* Software PWM timed by TAU0 channel 2: all LEDs with a level above zero are
+ * turned on at the start of each period, and the channel is restarted to
+ * interrupt at each point where one of them should be turned off again.
+ * Only the red LED is on a timer output (P17, TO02), so the TAU's own PWM
+ * mode cannot drive all three. That costs up to four interrupts per period,
+ * about 800 per second, while a LED is dimmed or fading, and none while
+ * they are all fully on or off. */
+
+/* Levels and fades, stepped once per PWM period. */
+static volatile fade_t led_fades[LED_MAX];
+
+/* Off edges for the current period, in level steps from its start. */
+static unsigned char led_edge_time[LED_MAX];
+static unsigned char led_edge_mask[LED_MAX];
+static unsigned char led_edge_count;
+static unsigned char led_edge_index;
+static unsigned char led_edge_last; /* Time of the edge just passed. */
+
+static volatile unsigned char led_pwm_running = 0;
+
+static void led_pins(unsigned char on_mask)
 {
-  /* Turn off all LEDs. */
-  LED_RED   = 1;
-  LED_GREEN = 1;
-  LED_BLUE  = 1;
+  /* LEDs are active low. */
+  LED_RED_PIN   = (on_mask & (1 << LED_RED))   ? 0 : 1;
+  LED_GREEN_PIN = (on_mask & (1 << LED_GREEN)) ? 0 : 1;
+  LED_BLUE_PIN  = (on_mask & (1 << LED_BLUE))  ? 0 : 1;
 }
 
-void led_red_command(LED_COMMAND cmd)
+static void led_pins_off(unsigned char off_mask)
 {
-  switch (cmd) {
-  case LED_OFF:
-    LED_RED = 1;
-    break;
+  if (off_mask & (1 << LED_RED)) {
+    LED_RED_PIN = 1;
+  }
+  if (off_mask & (1 << LED_GREEN)) {
+    LED_GREEN_PIN = 1;
+  }
+  if (off_mask & (1 << LED_BLUE)) {
+    LED_BLUE_PIN = 1;
+  }
+}
 
-  case LED_ON:
-    LED_RED = 0;
-    break;
+static void led_pwm_next(unsigned char steps)
+{
+  TT0.tt0 = 0x0004; /* Stop channel 2... */
+  TDR02.tdr02 = ((unsigned int)steps * LED_PWM_STEP_US) - 1;
+  TS0.ts0 = 0x0004; /* ...and restart it for the next edge. */
+}
 
-  case LED_TOGGLE:
-    LED_RED ^= 1;
-    break;
+static unsigned char led_pwm_static(void)
+{
+  int i;
+  unsigned char level;
+
+  /* No PWM is needed when all LEDs are fully on or off and not fading. */
+  for (i = 0; i < LED_MAX; i++) {
+    if (led_fades[i].periods > 0) {
+      return 0;
+    }
+    level = FADE_LEVEL(&led_fades[i]);
+    if (level != 0 && level != LED_LEVEL_MAX) {
+      return 0;
+    }
   }
+
+  return 1;
 }
 
-void led_green_command(LED_COMMAND cmd)
+static unsigned char led_on_mask(void)
 {
-  switch (cmd) {
-  case LED_OFF:
-    LED_GREEN = 1;
-    break;
+  int i;
+  unsigned char mask;
 
-  case LED_ON:
-    LED_GREEN = 0;
-    break;
+  mask = 0;
+  for (i = 0; i < LED_MAX; i++) {
+    if (FADE_LEVEL(&led_fades[i]) > 0) {
+      mask |= (1 << i);
+    }
+  }
 
-  case LED_TOGGLE:
-    LED_GREEN ^= 1;
-    break;
+  return mask;
+}
+
+static void led_period_start(void)
+{
+  int i, j;
+  unsigned char level, time, mask;
+
+  for (i = 0; i < LED_MAX; i++) {
+    fade_period(&led_fades[i]);
+  }
+
+  /* Sorted list of distinct off edges inside the period. */
+  led_edge_count = 0;
+  for (i = 0; i < LED_MAX; i++) {
+    level = FADE_LEVEL(&led_fades[i]);
+    if (level == 0 || level == LED_LEVEL_MAX) {
+      continue;
+    }
+    for (j = 0; j < led_edge_count; j++) {
+      if (led_edge_time[j] >= level) {
+        break;
+      }
+    }
+    if (j < led_edge_count && led_edge_time[j] == level) {
+      led_edge_mask[j] |= (1 << i);
+      continue;
+    }
+    for (time = led_edge_count; time > j; time--) {
+      led_edge_time[time] = led_edge_time[time - 1];
+      led_edge_mask[time] = led_edge_mask[time - 1];
+    }
+    led_edge_time[j] = level;
+    led_edge_mask[j] = (1 << i);
+    led_edge_count++;
+  }
+  led_edge_index = 0;
+  led_edge_last = 0;
+
+  mask = led_on_mask();
+  led_pins(mask);
+
+  if (led_edge_count > 0) {
+    led_pwm_next(led_edge_time[0]);
+  } else if (led_pwm_static()) {
+    TT0.tt0 = 0x0004; /* Stop channel 2, nothing left to do. */
+    led_pwm_running = 0;
+  } else {
+    led_pwm_next(LED_LEVEL_MAX);
   }
 }
 
-void led_blue_command(LED_COMMAND cmd)
+__attribute__((interrupt))
+void tm02_handler(void)
+{
+  if (led_edge_index == led_edge_count) {
+    led_period_start();
+    return;
+  }
+
+  led_pins_off(led_edge_mask[led_edge_index]);
+  led_edge_last = led_edge_time[led_edge_index];
+  led_edge_index++;
+
+  if (led_edge_index < led_edge_count) {
+    led_pwm_next(led_edge_time[led_edge_index] - led_edge_last);
+  } else {
+    led_pwm_next(LED_LEVEL_MAX - led_edge_last);
+  }
+}
+
+static void led_update(void)
+{
+  /* Called with interrupts disabled. */
+  if (led_pwm_static()) {
+    if (led_pwm_running) {
+      TT0.tt0 = 0x0004; /* Stop channel 2. */
+      led_pwm_running = 0;
+    }
+    led_pins(led_on_mask());
+  } else if (led_pwm_running == 0) {
+    led_pwm_running = 1;
+    led_period_start();
+  }
+}
+
+void led_setup(void)
+{
+  int i;
+
+  /* The timer backend may already have set up the unit and CK00. */
+  if (TAU0EN == 0) {
+    TAU0EN = 1; /* Supply input clock to timer array unit 0. */
+    TPS0.tps0 = 0x0005; /* Set CK00 to 1 MHz (32 MHz / 2^5). */
+  }
+
+  TT0.tt0 = 0x0004; /* Stop operation of channel 2. */
+
+  TMMK02 = 1; /* Disable INTTM02 interrupt... */
+  TMIF02 = 0; /* ...and clear the interrupt request flag. */
+
+  TMPR102 = 0; /* INTTM02 interrupt priority level... */
+  TMPR002 = 1; /* ...select level 1. */
+
+  TMR02.tmr02 = 0x0000; /* CK00, software trigger, interval timer mode. */
+
+  TMMK02 = 0; /* Enable timer interrupt. */
+
+  for (i = 0; i < LED_MAX; i++) {
+    fade_set(&led_fades[i], 0);
+  }
+
+  /* Turn off all LEDs. */
+  led_pins(0);
+}
+
+void led_level(LED_COLOR color, unsigned char level)
+{
+  asm("di"); /* Disable interrupts */
+  fade_set(&led_fades[color], level);
+  led_update();
+  asm("ei"); /* Enable interrupts */
+}
+
+void led_fade(LED_COLOR color, unsigned char level, unsigned int ms)
+{
+  asm("di"); /* Disable interrupts */
+  fade_start(&led_fades[color], level, ms);
+  led_update();
+  asm("ei"); /* Enable interrupts */
+}
+
+static void led_command(LED_COLOR color, LED_COMMAND cmd)
 {
   switch (cmd) {
   case LED_OFF:
-    LED_BLUE = 1;
+    led_level(color, 0);
     break;
 
   case LED_ON:
-    LED_BLUE = 0;
+    led_level(color, LED_LEVEL_MAX);
     break;
 
   case LED_TOGGLE:
-    LED_BLUE ^= 1;
+    if (FADE_LEVEL(&led_fades[color]) > 0) {
+      led_level(color, 0);
+    } else {
+      led_level(color, LED_LEVEL_MAX);
+    }
     break;
   }
 }
 
+void led_red_command(LED_COMMAND cmd)
+{
+  led_command(LED_RED, cmd);
+}
+
+void led_green_command(LED_COMMAND cmd)
+{
+  led_command(LED_GREEN, cmd);
+}
+
+void led_blue_command(LED_COMMAND cmd)
+{
+  led_command(LED_BLUE, cmd);
+}
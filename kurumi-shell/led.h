@@ -7,9 +7,23 @@ typedef enum {
   LED_TOGGLE = 2,
 } LED_COMMAND;
 
+typedef enum {
+  LED_RED   = 0,
+  LED_GREEN = 1,
+  LED_BLUE  = 2,
+  LED_MAX   = 3,
+} LED_COLOR;
+
+#define LED_LEVEL_MAX 255
+
+#define LED_PWM_STEP_US 20 /* One level step, 255 steps is a 5.1ms period. */
+#define LED_PWM_PERIOD_US ((unsigned long)LED_PWM_STEP_US * LED_LEVEL_MAX)
+
 void led_setup(void);
 void led_red_command(LED_COMMAND cmd);
 void led_green_command(LED_COMMAND cmd);
 void led_blue_command(LED_COMMAND cmd);
+void led_level(LED_COLOR color, unsigned char level);
+void led_fade(LED_COLOR color, unsigned char level, unsigned int ms);
 
 #endif /* _LED_H */
@@ -3,6 +3,8 @@
 #include "led.h"
 #include "uart.h"
 #include "timer.h"
+#include "script.h"
+#include "storage.h"
 #include "command.h"
 
 static void io_port_setup_default(void)
@@ -77,6 +79,13 @@ static void hardware_init(void)
 int main(void)
 {
   hardware_init();
+
+  /* Pick up the saved script, if any, and possibly start it right away. */
+  script_clear();
+  if (storage_load() == 0 && storage_autostart()) {
+    script_run();
+  }
+
   command_loop();
   return 0;
 }
@@ -1,54 +1,223 @@
 #include "opcode.h"
 #include "led.h"
 #include "script.h"
+#include "command.h"
+#include "uart.h"
+#include "storage.h"
+#include "stats.h"
+#include "stream.h"
+
+typedef struct {
+  char *command;
+  char *operands;
+  opcode_t op;
+} opcode_entry_t;
+
+#define OPCODE(op, value, command, operands) { command, operands, op },
+
+static const opcode_entry_t opcode_table[] = {
+  OPCODE_LIST
+};
+
+#undef OPCODE
+
+#define OPCODE_TABLE_SIZE (sizeof(opcode_table) / sizeof(opcode_entry_t))
+
+#define OPCODE(op, value, command, operands) case op: return operands;
+
+static char *opcode_operands(opcode_t op)
+{
+  switch (op) {
+  OPCODE_LIST
+  default:
+    return "";
+  }
+}
+
+#undef OPCODE
+
+static unsigned int opcode_word(unsigned char *operand)
+{
+  return operand[0] + ((unsigned int)operand[1] << 8);
+}
+
+static int opcode_compare(char *cmd, signed char len, const opcode_entry_t *entry)
+{
+  int i;
+  for (i = 0; entry->command[i] != '\0'; i++) {
+    if (i == len) {
+      return -1; /* Command is shorter than pattern. */
+    }
+    if (cmd[i] != entry->command[i]) {
+      return cmd[i] - entry->command[i];
+    }
+  }
+  if (len == i) {
+    return 0;
+  }
+
+  /* A space followed by a digit starts the operands, if any are expected. */
+  if (entry->operands[0] != '\0' && cmd[i] == ' ' &&
+      i + 1 < len && cmd[i + 1] >= 0x30 && cmd[i + 1] <= 0x39) {
+    return 0;
+  }
+
+  return 1; /* Command is longer than pattern. */
+}
+
+static int opcode_parse_operands(char *cmd, signed char len, char *operands, unsigned char *insn)
+{
+  int i, n;
+  unsigned long value;
+
+  i = 0;
+  n = 1;
+  while (*operands != '\0') {
+    if (i == len || cmd[i] != ' ') {
+      return -1;
+    }
+    i++;
+
+    if (i == len || cmd[i] < 0x30 || cmd[i] > 0x39) {
+      return -1;
+    }
+    value = 0;
+    while (i < len && cmd[i] >= 0x30 && cmd[i] <= 0x39) {
+      value = (value * 10) + (cmd[i] - 0x30);
+      if (value > 0xffff) {
+        return -1;
+      }
+      i++;
+    }
+
+    if (*operands == 'b') {
+      if (value > 0xff) {
+        return -1;
+      }
+      insn[n++] = value;
+    } else {
+      insn[n++] = value & 0xff;
+      insn[n++] = value >> 8;
+    }
+    operands++;
+  }
+
+  if (i != len) {
+    return -1; /* Trailing garbage. */
+  }
+
+  return 0;
+}
+
+opcode_t opcode_lookup(char *cmd, signed char len, unsigned char *insn)
+{
+  int low, high, middle, result, keyword_len;
+
+  /* Binary search in the sorted opcode table. */
+  low = 0;
+  high = OPCODE_TABLE_SIZE - 1;
+  while (low <= high) {
+    middle = (low + high) / 2;
+    result = opcode_compare(cmd, len, &opcode_table[middle]);
+    if (result < 0) {
+      high = middle - 1;
+    } else if (result > 0) {
+      low = middle + 1;
+    } else {
+      for (keyword_len = 0; opcode_table[middle].command[keyword_len] != '\0'; keyword_len++)
+        ;
+      if (opcode_parse_operands(&cmd[keyword_len], len - keyword_len,
+        opcode_table[middle].operands, insn) != 0) {
+        return OPCODE_EVAL_ERROR;
+      }
+      insn[0] = opcode_table[middle].op;
+      return opcode_table[middle].op;
+    }
+  }
+
+  return OPCODE_EVAL_ERROR;
+}
+
+#define OPCODE(op, value, command, operands) case op: return command;
 
 char *opcode_command(opcode_t op)
 {
   switch (op) {
-  case OPCODE_SLEEP_10:     return "sleep 10";
-  case OPCODE_SLEEP_50:     return "sleep 50";
-  case OPCODE_SLEEP_100:    return "sleep 100";
-  case OPCODE_SLEEP_500:    return "sleep 500";
-  case OPCODE_SLEEP_1000:   return "sleep 1000";
-  case OPCODE_RED_OFF:      return "red off";
-  case OPCODE_RED_ON:       return "red on";
-  case OPCODE_RED_TOGGLE:   return "red toggle";
-  case OPCODE_GREEN_OFF:    return "green off";
-  case OPCODE_GREEN_ON:     return "green on";
-  case OPCODE_GREEN_TOGGLE: return "green toggle";
-  case OPCODE_BLUE_OFF:     return "blue off";
-  case OPCODE_BLUE_ON:      return "blue on";
-  case OPCODE_BLUE_TOGGLE:  return "blue toggle";
-  case OPCODE_SCRIPT_RUN:   return "run";
-  case OPCODE_SCRIPT_STOP:  return "stop";
-  case OPCODE_SCRIPT_DUMP:  return "dump";
-  case OPCODE_SCRIPT_CLEAR: return "clear";
-  case OPCODE_SCRIPT_STATE: return "state";
+  OPCODE_LIST
   default: 
     return "";
   }
 }
 
-unsigned int opcode_execute(opcode_t op)
+#undef OPCODE
+
+unsigned char opcode_length(unsigned char *insn)
 {
-  switch (op) {
+  unsigned char len;
+  char *operands;
+
+  len = 1;
+  for (operands = opcode_operands(insn[0]); *operands != '\0'; operands++) {
+    if (*operands == 'b') {
+      len += 1;
+    } else {
+      len += 2;
+    }
+  }
+
+  return len;
+}
+
+void opcode_print(unsigned char *insn)
+{
+  char *operands;
+  unsigned char *operand;
+
+  uart0_send(opcode_command(insn[0]));
+
+  operand = &insn[1];
+  for (operands = opcode_operands(insn[0]); *operands != '\0'; operands++) {
+    uart0_send(" ");
+    if (*operands == 'b') {
+      uart0_send_decimal(operand[0]);
+      operand += 1;
+    } else {
+      uart0_send_decimal(opcode_word(operand));
+      operand += 2;
+    }
+  }
+}
+
+unsigned int opcode_execute(unsigned char *insn)
+{
+  int result;
+
+  switch (insn[0]) {
   case OPCODE_NONE:
     break;
 
-  case OPCODE_SLEEP_10:
-    return 10;
+  case OPCODE_SLEEP:
+    return opcode_word(&insn[1]);
 
-  case OPCODE_SLEEP_50:
-    return 50;
+  case OPCODE_GOTO:
+    script_goto(opcode_word(&insn[1]));
+    break;
 
-  case OPCODE_SLEEP_100:
-    return 100;
+  case OPCODE_CALL:
+    script_call(opcode_word(&insn[1]));
+    break;
+
+  case OPCODE_RETURN:
+    script_return();
+    break;
 
-  case OPCODE_SLEEP_500:
-    return 500;
+  case OPCODE_REPEAT:
+    script_repeat(opcode_word(&insn[1]));
+    break;
 
-  case OPCODE_SLEEP_1000:
-    return 1000;
+  case OPCODE_END:
+    script_end();
+    break;
 
   case OPCODE_RED_OFF:
     led_red_command(LED_OFF);
@@ -86,6 +255,30 @@ unsigned int opcode_execute(opcode_t op)
     led_blue_command(LED_TOGGLE);
     break;
 
+  case OPCODE_RED_LEVEL:
+    led_level(LED_RED, insn[1]);
+    break;
+
+  case OPCODE_GREEN_LEVEL:
+    led_level(LED_GREEN, insn[1]);
+    break;
+
+  case OPCODE_BLUE_LEVEL:
+    led_level(LED_BLUE, insn[1]);
+    break;
+
+  case OPCODE_RED_FADE:
+    led_fade(LED_RED, insn[1], opcode_word(&insn[2]));
+    break;
+
+  case OPCODE_GREEN_FADE:
+    led_fade(LED_GREEN, insn[1], opcode_word(&insn[2]));
+    break;
+
+  case OPCODE_BLUE_FADE:
+    led_fade(LED_BLUE, insn[1], opcode_word(&insn[2]));
+    break;
+
   case OPCODE_SCRIPT_RUN:
     script_run();
     break;
@@ -94,6 +287,14 @@ unsigned int opcode_execute(opcode_t op)
     script_stop();
     break;
 
+  case OPCODE_SCRIPT_SLOT:
+    script_select(insn[1]);
+    break;
+
+  case OPCODE_SCRIPT_START:
+    script_start(opcode_word(&insn[1]));
+    break;
+
   case OPCODE_SCRIPT_DUMP:
     script_dump();
     break;
@@ -106,6 +307,60 @@ unsigned int opcode_execute(opcode_t op)
     script_state_print();
     break;
 
+  case OPCODE_SCRIPT_TIMING:
+    script_timing_print();
+    break;
+
+  case OPCODE_SCRIPT_SAVE:
+    result = storage_save();
+    if (result == STORAGE_UNSUPPORTED) {
+      uart0_send("\r\nsave not supported!");
+    } else if (result != 0) {
+      uart0_send("\r\nsave failed!");
+    }
+    break;
+
+  case OPCODE_SCRIPT_LOAD:
+    result = storage_load();
+    if (result == STORAGE_UNSUPPORTED) {
+      uart0_send("\r\nload not supported!");
+    } else if (result != 0) {
+      uart0_send("\r\nload failed!");
+    }
+    break;
+
+  case OPCODE_AUTOSTART_OFF:
+    storage_autostart_set(0);
+    break;
+
+  case OPCODE_AUTOSTART_ON:
+    storage_autostart_set(1);
+    break;
+
+  case OPCODE_STATS:
+    stats_print();
+    break;
+
+  case OPCODE_STATS_BINARY:
+    stats_send_binary();
+    break;
+
+  case OPCODE_STATS_CLEAR:
+    stats_clear();
+    break;
+
+  case OPCODE_STREAM:
+    stream_start(opcode_word(&insn[1]));
+    break;
+
+  case OPCODE_MODE_HUMAN:
+    command_mode_set(COMMAND_MODE_HUMAN);
+    break;
+
+  case OPCODE_MODE_MACHINE:
+    command_mode_set(COMMAND_MODE_MACHINE);
+    break;
+
   default:
     break;
   }
@@ -1,38 +1,70 @@
 #ifndef _OPCODE_H
 #define _OPCODE_H
 
-typedef enum {
-  OPCODE_NONE         = 0x0,
-
-  OPCODE_EVAL_ERROR   = 0x1,
-
-  OPCODE_SLEEP_10     = 0x10,
-  OPCODE_SLEEP_50     = 0x11,
-  OPCODE_SLEEP_100    = 0x12,
-  OPCODE_SLEEP_500    = 0x13,
-  OPCODE_SLEEP_1000   = 0x14,
+/* Opcode definition list, used to generate the opcode enum, the command
+ * strings and the command lookup table. Must be kept sorted by command
+ * string, since opcode_lookup() does a binary search on it. Opcodes are
+ * stored as one byte, followed by the operands given by the operand
+ * string: 'b' for a byte (0-255) and 'w' for a word (0-65535). */
+#define OPCODE_LIST \
+  OPCODE(OPCODE_AUTOSTART_OFF, 0x8b, "autostart off", "")   \
+  OPCODE(OPCODE_AUTOSTART_ON,  0x8c, "autostart on",  "")   \
+  OPCODE(OPCODE_BLUE_LEVEL,    0x43, "blue",          "b")  \
+  OPCODE(OPCODE_BLUE_OFF,      0x40, "blue off",      "")   \
+  OPCODE(OPCODE_BLUE_ON,       0x41, "blue on",       "")   \
+  OPCODE(OPCODE_BLUE_TOGGLE,   0x42, "blue toggle",   "")   \
+  OPCODE(OPCODE_CALL,          0x51, "call",          "w")  \
+  OPCODE(OPCODE_SCRIPT_CLEAR,  0x84, "clear",         "")   \
+  OPCODE(OPCODE_SCRIPT_DUMP,   0x83, "dump",          "")   \
+  OPCODE(OPCODE_END,           0x54, "end",           "")   \
+  OPCODE(OPCODE_BLUE_FADE,     0x44, "fade blue",     "bw") \
+  OPCODE(OPCODE_GREEN_FADE,    0x34, "fade green",    "bw") \
+  OPCODE(OPCODE_RED_FADE,      0x24, "fade red",      "bw") \
+  OPCODE(OPCODE_GOTO,          0x50, "goto",          "w")  \
+  OPCODE(OPCODE_GREEN_LEVEL,   0x33, "green",         "b")  \
+  OPCODE(OPCODE_GREEN_OFF,     0x30, "green off",     "")   \
+  OPCODE(OPCODE_GREEN_ON,      0x31, "green on",      "")   \
+  OPCODE(OPCODE_GREEN_TOGGLE,  0x32, "green toggle",  "")   \
+  OPCODE(OPCODE_SCRIPT_LOAD,   0x8a, "load",          "")   \
+  OPCODE(OPCODE_MODE_HUMAN,    0x91, "mode human",    "")   \
+  OPCODE(OPCODE_MODE_MACHINE,  0x92, "mode machine",  "")   \
+  OPCODE(OPCODE_RED_LEVEL,     0x23, "red",           "b")  \
+  OPCODE(OPCODE_RED_OFF,       0x20, "red off",       "")   \
+  OPCODE(OPCODE_RED_ON,        0x21, "red on",        "")   \
+  OPCODE(OPCODE_RED_TOGGLE,    0x22, "red toggle",    "")   \
+  OPCODE(OPCODE_REPEAT,        0x53, "repeat",        "w")  \
+  OPCODE(OPCODE_RETURN,        0x52, "return",        "")   \
+  OPCODE(OPCODE_SCRIPT_RUN,    0x81, "run",           "")   \
+  OPCODE(OPCODE_SCRIPT_SAVE,   0x89, "save",          "")   \
+  OPCODE(OPCODE_SLEEP,         0x10, "sleep",         "w")  \
+  OPCODE(OPCODE_SCRIPT_SLOT,   0x87, "slot",          "b")  \
+  OPCODE(OPCODE_SCRIPT_START,  0x88, "start",         "w")  \
+  OPCODE(OPCODE_SCRIPT_STATE,  0x85, "state",         "")   \
+  OPCODE(OPCODE_STATS,         0xa0, "stats",         "")   \
+  OPCODE(OPCODE_STATS_BINARY,  0xa1, "stats binary",  "")   \
+  OPCODE(OPCODE_STATS_CLEAR,   0xa2, "stats clear",   "")   \
+  OPCODE(OPCODE_SCRIPT_STOP,   0x82, "stop",          "")   \
+  OPCODE(OPCODE_STREAM,        0xb0, "stream",        "w")  \
+  OPCODE(OPCODE_SCRIPT_TIMING, 0x86, "timing",        "")   \
 
-  OPCODE_RED_OFF      = 0x20,
-  OPCODE_RED_ON       = 0x21,
-  OPCODE_RED_TOGGLE   = 0x22,
+#define OPCODE_INSN_MAX 4 /* Opcode byte plus up to three operand bytes. */
 
-  OPCODE_GREEN_OFF    = 0x30,
-  OPCODE_GREEN_ON     = 0x31,
-  OPCODE_GREEN_TOGGLE = 0x32,
+#define OPCODE(op, value, command, operands) op = value,
 
-  OPCODE_BLUE_OFF     = 0x40,
-  OPCODE_BLUE_ON      = 0x41,
-  OPCODE_BLUE_TOGGLE  = 0x42,
+typedef enum {
+  OPCODE_NONE         = 0x0,
 
-  OPCODE_SCRIPT_RUN   = 0x101,
-  OPCODE_SCRIPT_STOP  = 0x102,
-  OPCODE_SCRIPT_DUMP  = 0x103,
-  OPCODE_SCRIPT_CLEAR = 0x104,
-  OPCODE_SCRIPT_STATE = 0x105,
+  OPCODE_EVAL_ERROR   = 0x1,
 
+  OPCODE_LIST
 } opcode_t;
 
+#undef OPCODE
+
+opcode_t opcode_lookup(char *cmd, signed char len, unsigned char *insn);
 char *opcode_command(opcode_t op);
-unsigned int opcode_execute(opcode_t op);
+unsigned char opcode_length(unsigned char *insn);
+void opcode_print(unsigned char *insn);
+unsigned int opcode_execute(unsigned char *insn);
 
 #endif /* _OPCODE_H */
@@ -1,96 +1,450 @@
+#include <stddef.h>
 #include "opcode.h"
+#include "script.h"
 #include "timer.h"
 #include "uart.h"
+#include "stats.h"
 
-#define SCRIPT_MAX 100
+#define SCRIPT_STACK_MAX 8 /* Nested repeat and call levels. */
+#define SCRIPT_BURST_MAX 100 /* Instructions per call without any sleep. */
+#define SCRIPT_SLOTS 4 /* Scripts running concurrently. */
 
-static opcode_t script[SCRIPT_MAX];
+/* Variable-length instructions back to back, one per line, where an empty
+ * line is a single OPCODE_NONE byte. */
+static unsigned char script[SCRIPT_SIZE];
+static unsigned int script_length = 0;
 
-static unsigned int script_pointer = 0;
-static unsigned int script_running = 0;
+/* Return offsets for "call" and loop offsets for "repeat", where a count of
+ * zero marks a call frame. */
+typedef struct {
+  unsigned int pointer;
+  unsigned int count;
+} script_frame_t;
+
+/* Each slot runs the shared script from its own program counter, with the
+ * absolute time when its next instruction is due. The deadline is advanced
+ * by each sleep so that time spent elsewhere in the main loop does not add
+ * up. */
+typedef struct {
+  unsigned int pointer; /* Offset of next instruction. */
+  unsigned char running;
+  unsigned char stack_depth;
+  unsigned long deadline;
+  script_frame_t stack[SCRIPT_STACK_MAX];
+} script_slot_t;
+
+static script_slot_t script_slots[SCRIPT_SLOTS];
+static script_slot_t *script_selected = &script_slots[0]; /* For commands. */
+static script_slot_t *script_task = &script_slots[0]; /* For flow control. */
+static unsigned char script_executing = 0;
+
+/* Timing statistics, in timer ticks where applicable. */
+static unsigned long script_deadlines = 0;
+static unsigned long script_overruns = 0;
+static unsigned long script_late_max = 0;
+static unsigned long script_late_total = 0;
+
+static void script_trim(void)
+{
+  unsigned int offset, end;
+
+  /* Trailing empty lines are not stored. */
+  end = 0;
+  for (offset = 0; offset < script_length; offset += opcode_length(&script[offset])) {
+    if (script[offset] != OPCODE_NONE) {
+      end = offset + opcode_length(&script[offset]);
+    }
+  }
+  script_length = end;
+}
+
+static unsigned int script_offset(int line_no)
+{
+  int i;
+  unsigned int offset;
+
+  offset = 0;
+  for (i = 0; i < line_no && offset < script_length; i++) {
+    offset += opcode_length(&script[offset]);
+  }
+
+  return offset;
+}
+
+static int script_push(unsigned int count)
+{
+  if (script_task->stack_depth == SCRIPT_STACK_MAX) {
+    script_task->running = 0; /* Runaway recursion, nothing sensible to do. */
+    return -1;
+  }
+
+  script_task->stack[script_task->stack_depth].pointer = script_task->pointer;
+  script_task->stack[script_task->stack_depth].count = count;
+  script_task->stack_depth++;
+  return 0;
+}
+
+static script_slot_t *script_earliest(void)
+{
+  int i;
+  script_slot_t *earliest;
+
+  earliest = NULL;
+  for (i = 0; i < SCRIPT_SLOTS; i++) {
+    if (script_slots[i].running == 0) {
+      continue;
+    }
+    if (earliest == NULL || (long)(script_slots[i].deadline - earliest->deadline) < 0) {
+      earliest = &script_slots[i];
+    }
+  }
+
+  return earliest;
+}
+
+static void script_slot_execute(script_slot_t *slot)
+{
+  unsigned char *insn;
+  unsigned int delay;
+  unsigned long late;
+  int burst;
+
+  late = timer_now() - slot->deadline;
+
+  script_deadlines++;
+  script_late_total += late;
+  if (late >= TIMER_TICKS_PER_MS) {
+    script_overruns++;
+  }
+  if (late > script_late_max) {
+    script_late_max = late;
+  }
+  stats_max(STATS_LATE_MAX, late);
+
+  if (script_length == 0) {
+    slot->running = 0; /* Nothing to run, it would only wrap around at once. */
+    return;
+  }
+
+  /* Possibly keep running until end of script, except delays. */
+  for (burst = 0; burst < SCRIPT_BURST_MAX; burst++) {
+    if (slot->pointer >= script_length) {
+      slot->pointer = 0;
+      slot->stack_depth = 0;
+      return;
+    }
+    insn = &script[slot->pointer];
+    slot->pointer += opcode_length(insn);
+    delay = opcode_execute(insn);
+    if (delay > 0) {
+      slot->deadline += (unsigned long)delay * TIMER_TICKS_PER_MS;
+      return;
+    }
+    if (slot->running == 0) {
+      return;
+    }
+  }
+  /* Loop without any sleep, let the main loop run before continuing. */
+}
+
+static void script_reset(void)
+{
+  int i;
+  for (i = 0; i < SCRIPT_SLOTS; i++) {
+    script_slots[i].pointer = 0;
+    script_slots[i].running = 0;
+    script_slots[i].stack_depth = 0;
+  }
+
+  script_deadlines = 0;
+  script_overruns = 0;
+  script_late_max = 0;
+  script_late_total = 0;
+}
 
 void script_clear(void)
 {
   int i;
-  for (i = 0; i < SCRIPT_MAX; i++) {
+  for (i = 0; i < SCRIPT_SIZE; i++) {
+    script[i] = OPCODE_NONE;
+  }
+  script_length = 0;
+
+  script_reset();
+}
+
+unsigned char *script_image(void)
+{
+  return script;
+}
+
+unsigned int script_image_length(void)
+{
+  return script_length;
+}
+
+void script_image_loaded(unsigned int length)
+{
+  unsigned int i;
+
+  /* The image has been written straight into the buffer, by storage. */
+  for (i = length; i < SCRIPT_SIZE; i++) {
     script[i] = OPCODE_NONE;
   }
-  script_pointer = 0;
-  script_running = 0;
+  script_length = length;
+  script_trim();
+
+  script_reset();
+}
+
+void script_select(int slot_no)
+{
+  if (slot_no >= SCRIPT_SLOTS) {
+    return;
+  }
+
+  script_selected = &script_slots[slot_no];
+  if (script_executing == 0) {
+    script_task = script_selected;
+  }
 }
 
 void script_stop(void)
 {
-  script_running = 0;
+  script_selected->running = 0;
 }
 
 void script_run(void)
 {
-  script_running = 1;
+  script_selected->deadline = timer_now();
+  script_selected->running = 1;
 }
 
-void script_execute(void)
+void script_start(int line_no)
 {
-  if (script_running == 0) {
-    return;
+  script_selected->pointer = script_offset(line_no);
+  script_selected->stack_depth = 0;
+  script_run();
+}
+
+unsigned char script_execute(unsigned long *deadline)
+{
+  int rounds;
+  script_slot_t *slot;
+
+  /* Earliest deadline first, with a bound so the console is not starved. */
+  for (rounds = 0; rounds < SCRIPT_SLOTS * 2; rounds++) {
+    slot = script_earliest();
+    if (slot == NULL) {
+      return 0;
+    }
+    if ((long)(timer_now() - slot->deadline) < 0) {
+      break;
+    }
+
+    script_task = slot;
+    script_executing = 1;
+    script_slot_execute(slot);
+    script_executing = 0;
+    script_task = script_selected;
   }
 
-  if (timer_read() > 0) {
-    return;
+  slot = script_earliest();
+  if (slot == NULL) {
+    return 0;
   }
 
-  /* Possibly keep running until end of script, except delays. */
-  while (script_pointer < SCRIPT_MAX) {
-    timer_set(opcode_execute(script[script_pointer]) / 10);
-    script_pointer++;
-    if (timer_read() > 0) {
+  *deadline = slot->deadline;
+  return 1;
+}
+
+void script_goto(int line_no)
+{
+  script_task->pointer = script_offset(line_no);
+}
+
+void script_call(int line_no)
+{
+  if (script_push(0) == 0) {
+    script_goto(line_no);
+  }
+}
+
+void script_return(void)
+{
+  /* Also drop any unfinished loops inside the subroutine. */
+  while (script_task->stack_depth > 0) {
+    script_task->stack_depth--;
+    if (script_task->stack[script_task->stack_depth].count == 0) {
+      script_task->pointer = script_task->stack[script_task->stack_depth].pointer;
       return;
     }
   }
-  script_pointer = 0;
+}
+
+void script_repeat(unsigned int count)
+{
+  int depth;
+  unsigned int pointer;
+
+  if (count > 0) {
+    script_push(count);
+    return;
+  }
+
+  /* Skip past the matching "end". */
+  depth = 1;
+  pointer = script_task->pointer;
+  while (pointer < script_length) {
+    if (script[pointer] == OPCODE_REPEAT) {
+      depth++;
+    } else if (script[pointer] == OPCODE_END) {
+      depth--;
+    }
+    pointer += opcode_length(&script[pointer]);
+    if (depth == 0) {
+      break;
+    }
+  }
+  script_task->pointer = pointer;
+}
+
+void script_end(void)
+{
+  script_frame_t *frame;
+
+  if (script_task->stack_depth == 0) {
+    return;
+  }
+
+  frame = &script_task->stack[script_task->stack_depth - 1];
+  if (frame->count == 0) {
+    return; /* Not inside a loop. */
+  }
+
+  frame->count--;
+  if (frame->count > 0) {
+    script_task->pointer = frame->pointer;
+  } else {
+    script_task->stack_depth--;
+  }
 }
 
 void script_dump(void)
 {
-  int i;
-  char output[7];
-
-  for (i = 0; i < SCRIPT_MAX; i++) {
-    if (script[i] != OPCODE_NONE) {
-      output[0] = '\r';
-      output[1] = '\n';
-      output[2] = (i / 10) + 0x30;
-      output[3] = (i % 10) + 0x30;
-      output[4] = ':';
-      output[5] = ' ';
-      output[6] = '\0';
-      uart0_send(output);
-
-      uart0_send(opcode_command(script[i]));
-
-      if ((int)script_pointer == i) {
-        output[0] = ' ';
-        output[1] = '<';
-        output[2] = '-';
-        output[3] = '-';
-        output[4] = '\0';
-        uart0_send(output);
+  int line_no;
+  unsigned int offset;
+
+  line_no = 0;
+  for (offset = 0; offset < script_length; offset += opcode_length(&script[offset])) {
+    if (script[offset] != OPCODE_NONE) {
+      uart0_send("\r\n");
+      if (line_no < 10) {
+        uart0_send("0");
+      }
+      uart0_send_decimal(line_no);
+      uart0_send(": ");
+
+      opcode_print(&script[offset]);
+
+      if (script_selected->pointer == offset) {
+        uart0_send(" <--");
       }
     }
+    line_no++;
   }
 }
 
 void script_state_print(void)
 {
-  if (script_running) {
-    uart0_send("\r\nrunning");
-  } else {
-    uart0_send("\r\nstopped");
+  int i;
+
+  for (i = 0; i < SCRIPT_SLOTS; i++) {
+    uart0_send("\r\nslot ");
+    uart0_send_decimal(i);
+    if (script_slots[i].running) {
+      uart0_send(": running");
+    } else {
+      uart0_send(": stopped");
+    }
+    if (&script_slots[i] == script_selected) {
+      uart0_send(" <--");
+    }
   }
 }
 
-void script_program(int line_no, opcode_t op)
+void script_timing_print(void)
 {
-  script[line_no] = op;
+  uart0_send("\r\ndeadlines: ");
+  uart0_send_decimal(script_deadlines);
+  uart0_send("\r\noverruns: ");
+  uart0_send_decimal(script_overruns);
+  uart0_send("\r\nlate max: ");
+  uart0_send_decimal(script_late_max);
+  uart0_send(" " TIMER_TICK_UNIT "\r\nlate total: ");
+  uart0_send_decimal(script_late_total);
+  uart0_send(" " TIMER_TICK_UNIT);
 }
 
+int script_program(int line_no, unsigned char *insn)
+{
+  int i;
+  unsigned int offset, old_len, new_len;
+  script_slot_t *slot;
+
+  /* Find the line, appending empty lines up to it when needed. */
+  offset = 0;
+  for (i = 0; i < line_no; i++) {
+    if (offset == script_length) {
+      if (script_length == SCRIPT_SIZE) {
+        script_trim();
+        return -1;
+      }
+      script[script_length++] = OPCODE_NONE;
+    }
+    offset += opcode_length(&script[offset]);
+  }
+
+  if (offset < script_length) {
+    old_len = opcode_length(&script[offset]);
+  } else {
+    old_len = 0;
+  }
+  new_len = opcode_length(insn);
+
+  if (script_length - old_len + new_len > SCRIPT_SIZE) {
+    script_trim();
+    return -1;
+  }
+
+  /* Move the following lines to fit the new instruction. */
+  if (new_len > old_len) {
+    for (i = script_length - 1; i >= (int)(offset + old_len); i--) {
+      script[i + new_len - old_len] = script[i];
+    }
+  } else if (new_len < old_len) {
+    for (i = offset + old_len; i < (int)script_length; i++) {
+      script[i + new_len - old_len] = script[i];
+    }
+  }
+  script_length = script_length - old_len + new_len;
+
+  for (i = 0; i < (int)new_len; i++) {
+    script[offset + i] = insn[i];
+  }
+
+  /* Keep the program counters and stacks on the same instructions. */
+  for (slot = script_slots; slot < &script_slots[SCRIPT_SLOTS]; slot++) {
+    if (slot->pointer > offset) {
+      slot->pointer = slot->pointer - old_len + new_len;
+    }
+    for (i = 0; i < slot->stack_depth; i++) {
+      if (slot->stack[i].pointer > offset) {
+        slot->stack[i].pointer = slot->stack[i].pointer - old_len + new_len;
+      }
+    }
+  }
+
+  script_trim();
+  return 0;
+}
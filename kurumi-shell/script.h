@@ -3,12 +3,26 @@
 
 #include "opcode.h"
 
+#define SCRIPT_LINES 1000 /* Line numbers 0 to 999. */
+#define SCRIPT_SIZE 1000 /* In bytes. */
+
 void script_clear(void);
+unsigned char *script_image(void);
+unsigned int script_image_length(void);
+void script_image_loaded(unsigned int length);
+void script_select(int slot_no);
 void script_stop(void);
 void script_run(void);
-void script_execute(void);
+void script_start(int line_no);
+unsigned char script_execute(unsigned long *deadline);
+void script_goto(int line_no);
+void script_call(int line_no);
+void script_return(void);
+void script_repeat(unsigned int count);
+void script_end(void);
 void script_dump(void);
 void script_state_print(void);
-void script_program(int line_no, opcode_t op);
+void script_timing_print(void);
+int script_program(int line_no, unsigned char *insn);
 
 #endif /* _SCRIPT_ */
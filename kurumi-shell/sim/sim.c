@@ -0,0 +1,476 @@
+/* Kurumi Shell simulator, runs scripts on the host in virtual time.
+ *
+ * The script and opcode modules of the shell are built as they are, with
+ * the hardware facing modules replaced by the functions below. The clock
+ * only moves when every running script is sleeping, straight to the next
+ * deadline, so hours of script time take milliseconds. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "opcode.h"
+#include "script.h"
+#include "led.h"
+#include "fade.h"
+#include "timer.h"
+#include "uart.h"
+#include "stats.h"
+#include "stream.h"
+#include "storage.h"
+#include "command.h"
+
+#define SIM_STALL_MAX 1000 /* Executions without time moving. */
+
+unsigned int opcode_execute_shell(unsigned char *insn);
+
+static unsigned long sim_now = 0; /* Microseconds. */
+
+static FILE *sim_vcd = NULL;
+static unsigned long sim_vcd_time = 0; /* Last time written. */
+static FILE *sim_csv = NULL;
+static unsigned long sim_csv_rows = 0;
+static unsigned long sim_changes = 0;
+
+/* LED levels and fades, stepped once per PWM period as in led.c. */
+static fade_t sim_fades[LED_MAX];
+static unsigned long sim_fade_next = 0; /* Time of the next fade step. */
+static unsigned char sim_level_shown[LED_MAX];
+
+/* Per line timing. */
+typedef struct {
+  unsigned long executions;
+  unsigned long first;
+  unsigned long last;
+  unsigned long sleep; /* Total requested sleep in ms. */
+} sim_line_t;
+
+static sim_line_t sim_lines[SCRIPT_LINES];
+static int sim_line_count = 0;
+
+static void sim_vcd_level(char id, unsigned char level)
+{
+  int i;
+
+  fputc('b', sim_vcd);
+  for (i = 7; i >= 0; i--) {
+    fputc((level & (1 << i)) ? '1' : '0', sim_vcd);
+  }
+  fprintf(sim_vcd, " %c\n", id);
+}
+
+static void sim_vcd_header(void)
+{
+  fprintf(sim_vcd, "$timescale 1us $end\n");
+  fprintf(sim_vcd, "$scope module kurumi $end\n");
+  fprintf(sim_vcd, "$var wire 8 r red $end\n");
+  fprintf(sim_vcd, "$var wire 8 g green $end\n");
+  fprintf(sim_vcd, "$var wire 8 b blue $end\n");
+  fprintf(sim_vcd, "$upscope $end\n");
+  fprintf(sim_vcd, "$enddefinitions $end\n");
+  fprintf(sim_vcd, "#0\n");
+  sim_vcd_level('r', 0);
+  sim_vcd_level('g', 0);
+  sim_vcd_level('b', 0);
+}
+
+static void sim_record(void)
+{
+  int i, changed;
+  unsigned char level;
+  static const char ids[LED_MAX] = { 'r', 'g', 'b' };
+
+  changed = 0;
+  for (i = 0; i < LED_MAX; i++) {
+    level = FADE_LEVEL(&sim_fades[i]);
+    if (level == sim_level_shown[i]) {
+      continue;
+    }
+    if (sim_vcd != NULL) {
+      if (sim_now != sim_vcd_time) {
+        fprintf(sim_vcd, "#%lu\n", sim_now);
+        sim_vcd_time = sim_now;
+      }
+      sim_vcd_level(ids[i], level);
+    }
+    sim_level_shown[i] = level;
+    changed = 1;
+  }
+
+  if (changed) {
+    sim_changes++;
+  }
+  /* The first row is the state at time 0, even if nothing was turned on. */
+  if (sim_csv != NULL && (changed || sim_csv_rows == 0)) {
+    fprintf(sim_csv, "%lu,%u,%u,%u\n", sim_now, sim_level_shown[LED_RED],
+      sim_level_shown[LED_GREEN], sim_level_shown[LED_BLUE]);
+    sim_csv_rows++;
+  }
+}
+
+static int sim_fading(void)
+{
+  int i;
+
+  for (i = 0; i < LED_MAX; i++) {
+    if (sim_fades[i].periods > 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void sim_fade_steps(void)
+{
+  int i;
+
+  while (sim_fading() && (long)(sim_now - sim_fade_next) >= 0) {
+    for (i = 0; i < LED_MAX; i++) {
+      fade_period(&sim_fades[i]);
+    }
+    sim_fade_next += LED_PWM_PERIOD_US;
+  }
+}
+
+/* LED module. */
+
+void led_level(LED_COLOR color, unsigned char level)
+{
+  fade_set(&sim_fades[color], level);
+}
+
+void led_fade(LED_COLOR color, unsigned char level, unsigned int ms)
+{
+  if (sim_fading() == 0) {
+    sim_fade_next = sim_now + LED_PWM_PERIOD_US;
+  }
+  fade_start(&sim_fades[color], level, ms);
+}
+
+static void sim_led_command(LED_COLOR color, LED_COMMAND cmd)
+{
+  switch (cmd) {
+  case LED_OFF:
+    led_level(color, 0);
+    break;
+
+  case LED_ON:
+    led_level(color, LED_LEVEL_MAX);
+    break;
+
+  case LED_TOGGLE:
+    led_level(color, FADE_LEVEL(&sim_fades[color]) > 0 ? 0 : LED_LEVEL_MAX);
+    break;
+  }
+}
+
+void led_red_command(LED_COMMAND cmd)
+{
+  sim_led_command(LED_RED, cmd);
+}
+
+void led_green_command(LED_COMMAND cmd)
+{
+  sim_led_command(LED_GREEN, cmd);
+}
+
+void led_blue_command(LED_COMMAND cmd)
+{
+  sim_led_command(LED_BLUE, cmd);
+}
+
+/* Timer module. */
+
+unsigned long timer_now(void)
+{
+  return sim_now;
+}
+
+/* UART module, output goes to stdout. */
+
+void uart0_send(char *s)
+{
+  fputs(s, stdout);
+}
+
+void uart0_write(char *data, unsigned int len)
+{
+  fwrite(data, 1, len, stdout);
+}
+
+void uart0_send_decimal(unsigned long value)
+{
+  printf("%lu", value);
+}
+
+/* Modules that have nothing to do in the simulator. */
+
+void stats_max(STATS counter, unsigned long value)
+{
+  (void)counter;
+  (void)value;
+}
+
+void stats_print(void)
+{
+}
+
+void stats_send_binary(void)
+{
+}
+
+void stats_clear(void)
+{
+}
+
+void stream_start(unsigned int period_ms)
+{
+  (void)period_ms;
+}
+
+int storage_save(void)
+{
+  return 0;
+}
+
+int storage_load(void)
+{
+  return -1;
+}
+
+void storage_autostart_set(unsigned char autostart)
+{
+  (void)autostart;
+}
+
+void command_mode_set(COMMAND_MODE mode)
+{
+  (void)mode;
+}
+
+/* Every instruction goes through here, to be timed per line. */
+unsigned int opcode_execute(unsigned char *insn)
+{
+  unsigned char *script;
+  unsigned int offset, delay;
+  int line_no;
+  sim_line_t *line;
+
+  delay = opcode_execute_shell(insn);
+
+  script = script_image();
+  if (insn < script || insn >= script + SCRIPT_SIZE) {
+    return delay; /* Not from the script buffer. */
+  }
+
+  line_no = 0;
+  for (offset = 0; script + offset < insn; offset += opcode_length(&script[offset])) {
+    line_no++;
+  }
+
+  line = &sim_lines[line_no];
+  if (line->executions == 0) {
+    line->first = sim_now;
+  }
+  line->executions++;
+  line->last = sim_now;
+  line->sleep += delay;
+
+  return delay;
+}
+
+static int sim_load(char *filename)
+{
+  FILE *fh;
+  char text[256];
+  unsigned char insn[OPCODE_INSN_MAX];
+  int len;
+
+  fh = fopen(filename, "r");
+  if (fh == NULL) {
+    perror(filename);
+    return -1;
+  }
+
+  script_clear();
+  while (fgets(text, sizeof(text), fh) != NULL) {
+    len = strlen(text);
+    while (len > 0 && (text[len - 1] == '\n' || text[len - 1] == '\r' || text[len - 1] == ' ')) {
+      len--;
+    }
+    text[len] = '\0';
+
+    /* Checked first, opcode_lookup() takes the length as a signed char. */
+    if (len > 127) {
+      fprintf(stderr, "%s:%d: line too long\n", filename, sim_line_count + 1);
+      fclose(fh);
+      return -1;
+    }
+
+    insn[0] = OPCODE_NONE;
+    if (len > 0 && opcode_lookup(text, len, insn) == OPCODE_EVAL_ERROR) {
+      fprintf(stderr, "%s:%d: syntax error: %s\n", filename, sim_line_count + 1, text);
+      fclose(fh);
+      return -1;
+    }
+    if (sim_line_count >= SCRIPT_LINES ||
+      script_program(sim_line_count, insn) != 0) {
+      fprintf(stderr, "%s:%d: does not fit in the script buffer\n", filename, sim_line_count + 1);
+      fclose(fh);
+      return -1;
+    }
+    sim_line_count++;
+  }
+
+  fclose(fh);
+  return 0;
+}
+
+static void sim_run(unsigned long duration)
+{
+  unsigned long deadline;
+  unsigned long stalls;
+  unsigned char pending;
+
+  script_run();
+
+  stalls = 0;
+  while (sim_now < duration) {
+    pending = script_execute(&deadline);
+
+    if (sim_fading() && (pending == 0 || (long)(sim_fade_next - deadline) < 0)) {
+      deadline = sim_fade_next;
+      pending = 1;
+    }
+    if (pending == 0) {
+      break; /* All scripts have stopped. */
+    }
+
+    if ((long)(deadline - sim_now) > 0) {
+      sim_record(); /* Every slot due at this time has run. */
+      sim_now = deadline;
+      stalls = 0;
+    } else if (++stalls > SIM_STALL_MAX) {
+      fprintf(stderr, "script does not sleep, stopped at %lu us\n", sim_now);
+      break;
+    }
+    if (sim_now > duration) {
+      sim_now = duration;
+    }
+
+    sim_fade_steps();
+  }
+
+  sim_record();
+}
+
+static void sim_report(void)
+{
+  int i;
+  unsigned char *script;
+  unsigned int offset;
+
+  printf("line  executions     first ms      last ms     sleep ms  command\n");
+  script = script_image();
+  offset = 0;
+  for (i = 0; i < sim_line_count; i++) {
+    printf("%4d  %10lu %12.3f %12.3f %12lu  ", i, sim_lines[i].executions,
+      sim_lines[i].first / 1000.0, sim_lines[i].last / 1000.0, sim_lines[i].sleep);
+    if (offset < script_image_length()) {
+      opcode_print(&script[offset]);
+      offset += opcode_length(&script[offset]);
+    }
+    printf("\n");
+  }
+
+  printf("\nsimulated: %.3f ms\nled changes: %lu", sim_now / 1000.0, sim_changes);
+  script_timing_print();
+  printf("\n");
+}
+
+static void usage(char *prog)
+{
+  printf("Usage: %s [-t ms] [-v file.vcd] [-c file.csv] <script file>\n", prog);
+  printf("  -t  Simulated time, default 60000 ms\n");
+  printf("  -v  Write LED levels as a VCD timeline\n");
+  printf("  -c  Write LED levels as CSV: time in us, red, green, blue\n");
+}
+
+int main(int argc, char *argv[])
+{
+  int c;
+  unsigned long duration;
+  char *vcd_file, *csv_file;
+
+  duration = 60000;
+  vcd_file = NULL;
+  csv_file = NULL;
+
+  while ((c = getopt(argc, argv, "ht:v:c:")) != -1) {
+    switch (c) {
+    case 'h':
+      usage(argv[0]);
+      return EXIT_SUCCESS;
+
+    case 't':
+      duration = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'v':
+      vcd_file = optarg;
+      break;
+
+    case 'c':
+      csv_file = optarg;
+      break;
+
+    case '?':
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (optind >= argc) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (vcd_file != NULL) {
+    sim_vcd = fopen(vcd_file, "w");
+    if (sim_vcd == NULL) {
+      perror(vcd_file);
+      return EXIT_FAILURE;
+    }
+    sim_vcd_header();
+  }
+  if (csv_file != NULL) {
+    sim_csv = fopen(csv_file, "w");
+    if (sim_csv == NULL) {
+      perror(csv_file);
+      return EXIT_FAILURE;
+    }
+    fprintf(sim_csv, "time_us,red,green,blue\n");
+  }
+
+  if (sim_load(argv[optind]) != 0) {
+    return EXIT_FAILURE;
+  }
+
+  sim_run(duration * 1000);
+  sim_report();
+
+  if (sim_vcd != NULL) {
+    if (sim_now != sim_vcd_time) {
+      fprintf(sim_vcd, "#%lu\n", sim_now);
+    }
+    fclose(sim_vcd);
+  }
+  if (sim_csv != NULL) {
+    fclose(sim_csv);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,107 @@
+#include "stats.h"
+#include "timer.h"
+#include "uart.h"
+
+static volatile unsigned long stats_counters[STATS_MAX];
+static unsigned long stats_start = 0; /* Time of last clear. */
+
+static const char *stats_names[STATS_MAX] = {
+  "isr rx",
+  "isr tx",
+  "isr timer",
+  "isr error",
+  "rx bytes",
+  "rx dropped",
+  "tx wait (" TIMER_TICK_UNIT ")",
+  "late max (" TIMER_TICK_UNIT ")",
+  "loops",
+};
+
+/* Counters are updated from interrupt handlers, which do not nest on the
+ * same counter, so only the main loop has to mask interrupts to read. */
+
+void stats_count(STATS counter)
+{
+  stats_counters[counter]++;
+}
+
+void stats_add(STATS counter, unsigned long value)
+{
+  stats_counters[counter] += value;
+}
+
+void stats_max(STATS counter, unsigned long value)
+{
+  if (value > stats_counters[counter]) {
+    stats_counters[counter] = value;
+  }
+}
+
+void stats_clear(void)
+{
+  int i;
+
+  asm("di"); /* Disable interrupts */
+  for (i = 0; i < STATS_MAX; i++) {
+    stats_counters[i] = 0;
+  }
+  asm("ei"); /* Enable interrupts */
+
+  stats_start = timer_now();
+}
+
+static unsigned long stats_snapshot(unsigned long *values)
+{
+  int i;
+
+  asm("di"); /* Disable interrupts */
+  for (i = 0; i < STATS_MAX; i++) {
+    values[i] = stats_counters[i];
+  }
+  asm("ei"); /* Enable interrupts */
+
+  return (timer_now() - stats_start) / TIMER_TICKS_PER_MS;
+}
+
+void stats_print(void)
+{
+  int i;
+  unsigned long values[STATS_MAX];
+  unsigned long elapsed;
+
+  elapsed = stats_snapshot(values);
+
+  for (i = 0; i < STATS_MAX; i++) {
+    uart0_send("\r\n");
+    uart0_send((char *)stats_names[i]);
+    uart0_send(": ");
+    uart0_send_decimal(values[i]);
+  }
+
+  uart0_send("\r\nloops/s: ");
+  if (elapsed > 0) {
+    uart0_send_decimal(((values[STATS_LOOPS] / elapsed) * 1000) +
+      (((values[STATS_LOOPS] % elapsed) * 1000) / elapsed));
+  } else {
+    uart0_send("0");
+  }
+}
+
+void stats_send_binary(void)
+{
+  int i, j;
+  unsigned long values[STATS_MAX + 1];
+  char frame[2 + (STATS_MAX + 1) * 4];
+
+  values[STATS_MAX] = stats_snapshot(values);
+
+  frame[0] = 'S';
+  frame[1] = sizeof(frame) - 2;
+  for (i = 0; i <= STATS_MAX; i++) {
+    for (j = 0; j < 4; j++) {
+      frame[2 + (i * 4) + j] = values[i] >> (j * 8);
+    }
+  }
+
+  uart0_write(frame, sizeof(frame));
+}
@@ -0,0 +1,29 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+/* Performance counters, in the order sent by the binary form of "stats":
+ * 'S', the length of the rest in bytes, then each value as 4 bytes
+ * little-endian, followed by the milliseconds since the counters were
+ * cleared. The values may hold ACK and NAK bytes, so in machine mode a
+ * reply starting with 'S' is skipped by its length to find its status. */
+typedef enum {
+  STATS_ISR_RX     = 0, /* Interrupt handler entries. */
+  STATS_ISR_TX     = 1,
+  STATS_ISR_TIMER  = 2,
+  STATS_ISR_ERROR  = 3,
+  STATS_RX_BYTES   = 4,
+  STATS_RX_DROPPED = 5, /* Receive buffer full. */
+  STATS_TX_WAIT    = 6, /* Timer ticks spent waiting in uart0_send(). */
+  STATS_LATE_MAX   = 7, /* Timer ticks a script deadline was missed by. */
+  STATS_LOOPS      = 8, /* Main loop iterations. */
+  STATS_MAX        = 9,
+} STATS;
+
+void stats_count(STATS counter);
+void stats_add(STATS counter, unsigned long value);
+void stats_max(STATS counter, unsigned long value);
+void stats_clear(void);
+void stats_print(void);
+void stats_send_binary(void);
+
+#endif /* _STATS_H */
@@ -0,0 +1,249 @@
+#include <stddef.h>
+#include "storage.h"
+#include "script.h"
+
+#define STORAGE_FLAG_AUTOSTART 0x01
+
+static unsigned char storage_flags = 0;
+
+#ifdef STORAGE_PFDL
+
+#include <pfdl.h>
+
+/* The 8 KiB data flash is used as a log of saved script images, written
+ * front to back and wrapping around, so that every block is erased equally
+ * often. A record never straddles two blocks. The header is written after
+ * the image, and the valid record with the highest sequence number wins. */
+#define STORAGE_BLOCKS 8
+#define STORAGE_BLOCK_SIZE 1024
+
+#define STORAGE_MAGIC 0x4b /* 'K' */
+
+#define STORAGE_CHUNK 16 /* Bytes read at a time when checking records. */
+
+typedef struct {
+  unsigned char magic;
+  unsigned char flags;
+  unsigned int seq;
+  unsigned int length;
+  unsigned int checksum;
+} storage_header_t;
+
+static pfdl_descriptor_t storage_descriptor = {
+  32, /* CPU clock in MHz. */
+  0,  /* Full-speed mode. */
+};
+
+/* Result of storage_scan(). */
+static unsigned char storage_found;
+static unsigned int storage_newest; /* Offset of newest valid record. */
+static storage_header_t storage_newest_header;
+static unsigned int storage_next; /* Offset for the next record. */
+
+static pfdl_status_t storage_request(pfdl_flash_command_t command, unsigned int index,
+  unsigned char *data, unsigned int count)
+{
+  pfdl_request_t request;
+  pfdl_status_t status;
+
+  request.index_u16 = index;
+  request.data_pu08 = data;
+  request.bytecount_u16 = count;
+  request.command_enu = command;
+
+  /* Erase, write and checks run in the background, just wait for them. */
+  status = PFDL_Execute(&request);
+  while (status == PFDL_BUSY) {
+    status = PFDL_Handler();
+  }
+
+  return status;
+}
+
+static unsigned int storage_checksum(storage_header_t *header)
+{
+  return header->flags + (header->seq & 0xff) + (header->seq >> 8) +
+    (header->length & 0xff) + (header->length >> 8);
+}
+
+static int storage_record_check(unsigned int offset, storage_header_t *header)
+{
+  unsigned char chunk[STORAGE_CHUNK];
+  unsigned int i, j, n, checksum;
+
+  checksum = storage_checksum(header);
+  for (i = 0; i < header->length; i += n) {
+    n = header->length - i;
+    if (n > STORAGE_CHUNK) {
+      n = STORAGE_CHUNK;
+    }
+    if (storage_request(PFDL_CMD_READ_BYTES, offset + sizeof(storage_header_t) + i,
+      chunk, n) != PFDL_OK) {
+      return -1;
+    }
+    for (j = 0; j < n; j++) {
+      checksum += chunk[j];
+    }
+  }
+
+  return (checksum == header->checksum) ? 0 : -1;
+}
+
+static void storage_scan(void)
+{
+  unsigned int block, offset, end;
+  storage_header_t header;
+
+  storage_found = 0;
+  storage_next = 0;
+
+  for (block = 0; block < STORAGE_BLOCKS; block++) {
+    offset = block * STORAGE_BLOCK_SIZE;
+    end = offset + STORAGE_BLOCK_SIZE;
+    while (offset + sizeof(header) <= end) {
+      if (storage_request(PFDL_CMD_READ_BYTES, offset, (unsigned char *)&header,
+        sizeof(header)) != PFDL_OK) {
+        break;
+      }
+      if (header.magic != STORAGE_MAGIC || header.length > SCRIPT_SIZE ||
+        offset + sizeof(header) + header.length > end) {
+        break; /* Erased, or nothing sensible after this point. */
+      }
+
+      if (storage_record_check(offset, &header) == 0 &&
+        (storage_found == 0 || (int)(header.seq - storage_newest_header.seq) > 0)) {
+        storage_found = 1;
+        storage_newest = offset;
+        storage_newest_header = header;
+        storage_next = offset + sizeof(header) + header.length;
+      }
+
+      offset += sizeof(header) + header.length;
+    }
+  }
+}
+
+static int storage_write(storage_header_t *header, unsigned char *image)
+{
+  unsigned int size, block;
+
+  size = sizeof(storage_header_t) + header->length;
+
+  /* A block is erased before its first record is written. Move on to the
+   * next block if the record does not fit in the current one, or if that
+   * has been left dirty by an interrupted save. */
+  block = storage_next / STORAGE_BLOCK_SIZE;
+  if (storage_next % STORAGE_BLOCK_SIZE != 0 &&
+    (storage_next + size > (block + 1) * STORAGE_BLOCK_SIZE ||
+    storage_request(PFDL_CMD_BLANKCHECK_BYTES, storage_next, NULL, size) != PFDL_OK)) {
+    block++;
+    storage_next = block * STORAGE_BLOCK_SIZE;
+  }
+  if (storage_next % STORAGE_BLOCK_SIZE == 0) {
+    block %= STORAGE_BLOCKS;
+    if (storage_request(PFDL_CMD_ERASE_BLOCK, block, NULL, 0) != PFDL_OK) {
+      return -1;
+    }
+    storage_next = block * STORAGE_BLOCK_SIZE;
+  }
+
+  if (header->length > 0) {
+    if (storage_request(PFDL_CMD_WRITE_BYTES, storage_next + sizeof(storage_header_t),
+      image, header->length) != PFDL_OK) {
+      return -1;
+    }
+  }
+  if (storage_request(PFDL_CMD_WRITE_BYTES, storage_next, (unsigned char *)header,
+    sizeof(storage_header_t)) != PFDL_OK) {
+    return -1;
+  }
+  if (storage_request(PFDL_CMD_IVERIFY_BYTES, storage_next, NULL, size) != PFDL_OK) {
+    return -1;
+  }
+
+  return 0;
+}
+
+int storage_save(void)
+{
+  int result;
+  unsigned int i;
+  unsigned char *image;
+  storage_header_t header;
+
+  if (PFDL_Open(&storage_descriptor) != PFDL_OK) {
+    return -1;
+  }
+
+  storage_scan();
+
+  image = script_image();
+  header.magic = STORAGE_MAGIC;
+  header.flags = storage_flags;
+  header.seq = storage_found ? storage_newest_header.seq + 1 : 0;
+  header.length = script_image_length();
+  header.checksum = storage_checksum(&header);
+  for (i = 0; i < header.length; i++) {
+    header.checksum += image[i];
+  }
+
+  result = storage_write(&header, image);
+
+  PFDL_Close();
+  return result;
+}
+
+int storage_load(void)
+{
+  int result;
+
+  if (PFDL_Open(&storage_descriptor) != PFDL_OK) {
+    return -1;
+  }
+
+  storage_scan();
+
+  result = -1;
+  if (storage_found) {
+    if (storage_request(PFDL_CMD_READ_BYTES, storage_newest + sizeof(storage_header_t),
+      script_image(), storage_newest_header.length) == PFDL_OK) {
+      script_image_loaded(storage_newest_header.length);
+      storage_flags = storage_newest_header.flags;
+      result = 0;
+    } else {
+      script_clear();
+    }
+  }
+
+  PFDL_Close();
+  return result;
+}
+
+#else /* STORAGE_PFDL */
+
+/* Built without the data flash library, scripts only live until reset. */
+int storage_save(void)
+{
+  return STORAGE_UNSUPPORTED;
+}
+
+int storage_load(void)
+{
+  return STORAGE_UNSUPPORTED;
+}
+
+#endif /* STORAGE_PFDL */
+
+void storage_autostart_set(unsigned char autostart)
+{
+  if (autostart) {
+    storage_flags |= STORAGE_FLAG_AUTOSTART;
+  } else {
+    storage_flags &= ~STORAGE_FLAG_AUTOSTART;
+  }
+}
+
+unsigned char storage_autostart(void)
+{
+  return (storage_flags & STORAGE_FLAG_AUTOSTART) ? 1 : 0;
+}
@@ -0,0 +1,11 @@
+#ifndef _STORAGE_H
+#define _STORAGE_H
+
+#define STORAGE_UNSUPPORTED -2 /* Built without STORAGE=pfdl. */
+
+int storage_save(void);
+int storage_load(void);
+void storage_autostart_set(unsigned char autostart);
+unsigned char storage_autostart(void);
+
+#endif /* _STORAGE_H */
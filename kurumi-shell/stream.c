@@ -0,0 +1,132 @@
+#include "stream.h"
+#include "led.h"
+#include "timer.h"
+#include "uart.h"
+
+/* Frames are received into the back buffer and applied from the front
+ * buffer on the next tick, so LED updates happen at a steady rate no
+ * matter how the bytes were spread over the link. */
+static unsigned char stream_frames[2][STREAM_FRAME_SIZE];
+static unsigned char stream_back = 0; /* Buffer being received into. */
+static unsigned char stream_ready = 0; /* Front buffer is waiting for a tick. */
+static unsigned char stream_index = 0; /* Next byte in the back buffer. */
+static unsigned char stream_seq = 0; /* Expected sequence number. */
+
+static unsigned char stream_running = 0;
+static unsigned char stream_started = 0; /* First frame has been received. */
+static unsigned long stream_period = 0; /* In timer ticks. */
+static unsigned long stream_deadline = 0;
+
+static unsigned long stream_applied = 0;
+static unsigned long stream_underruns = 0; /* Ticks without a new frame. */
+static unsigned long stream_overruns = 0; /* Frames replaced before a tick. */
+static unsigned long stream_lost = 0; /* Gaps in the sequence numbers. */
+static unsigned long stream_sync_errors = 0; /* Bytes skipped for sync. */
+
+void stream_start(unsigned int period_ms)
+{
+  if (period_ms == 0) {
+    period_ms = 1;
+  }
+
+  stream_back = 0;
+  stream_ready = 0;
+  stream_index = 0;
+  stream_started = 0;
+  stream_period = (unsigned long)period_ms * TIMER_TICKS_PER_MS;
+
+  stream_applied = 0;
+  stream_underruns = 0;
+  stream_overruns = 0;
+  stream_lost = 0;
+  stream_sync_errors = 0;
+
+  stream_running = 1;
+}
+
+unsigned char stream_active(void)
+{
+  return stream_running;
+}
+
+unsigned char stream_input(unsigned char c)
+{
+  unsigned char *frame;
+
+  frame = stream_frames[stream_back];
+
+  if (stream_index == 0) {
+    if (c == STREAM_ESCAPE) {
+      stream_running = 0;
+      return 1;
+    }
+    if (c != STREAM_SYNC) {
+      stream_sync_errors++;
+      return 0;
+    }
+  }
+
+  frame[stream_index] = c;
+  stream_index++;
+  if (stream_index < STREAM_FRAME_SIZE) {
+    return 0;
+  }
+  stream_index = 0;
+
+  if (stream_started == 0) {
+    stream_started = 1;
+    stream_seq = frame[1];
+    stream_deadline = timer_now(); /* Apply the first frame right away. */
+  }
+  stream_lost += (unsigned char)(frame[1] - stream_seq);
+  stream_seq = frame[1] + 1;
+
+  if (stream_ready) {
+    stream_overruns++;
+  }
+  stream_back ^= 1;
+  stream_ready = 1;
+
+  return 0;
+}
+
+unsigned char stream_execute(unsigned long *deadline)
+{
+  unsigned char *frame;
+
+  if (stream_running == 0 || stream_started == 0) {
+    return 0;
+  }
+
+  if ((long)(timer_now() - stream_deadline) >= 0) {
+    stream_deadline += stream_period;
+
+    if (stream_ready) {
+      frame = stream_frames[stream_back ^ 1];
+      led_level(LED_RED, frame[2]);
+      led_level(LED_GREEN, frame[3]);
+      led_level(LED_BLUE, frame[4]);
+      stream_ready = 0;
+      stream_applied++;
+    } else {
+      stream_underruns++;
+    }
+  }
+
+  *deadline = stream_deadline;
+  return 1;
+}
+
+void stream_report(void)
+{
+  uart0_send("\r\nframes: ");
+  uart0_send_decimal(stream_applied);
+  uart0_send("\r\nunderruns: ");
+  uart0_send_decimal(stream_underruns);
+  uart0_send("\r\noverruns: ");
+  uart0_send_decimal(stream_overruns);
+  uart0_send("\r\nlost: ");
+  uart0_send_decimal(stream_lost);
+  uart0_send("\r\nsync errors: ");
+  uart0_send_decimal(stream_sync_errors);
+}
@@ -0,0 +1,17 @@
+#ifndef _STREAM_H
+#define _STREAM_H
+
+/* Frames sent by the host while streaming: sync byte, sequence number and
+ * red, green and blue levels. An escape byte in place of a sync byte ends
+ * the stream. */
+#define STREAM_SYNC   0xa5
+#define STREAM_ESCAPE 0x1b
+#define STREAM_FRAME_SIZE 5
+
+void stream_start(unsigned int period_ms);
+unsigned char stream_active(void);
+unsigned char stream_input(unsigned char c);
+unsigned char stream_execute(unsigned long *deadline);
+void stream_report(void);
+
+#endif /* _STREAM_H */
@@ -1,14 +1,135 @@
 #include <iodefine.h>
 #include <iodefine_ext.h>
 #include "timer.h"
+#include "event.h"
+#include "stats.h"
 
-static volatile unsigned char timer_left = 0;
+#ifdef TIMER_TAU
+
+/* TAU0 channel 0 counts down from 0xffff at 1 MHz as the low part of the
+ * microsecond counter, channel 1 is started as a one-shot alarm once the
+ * deadline is less than a full count away. No other interrupts are taken,
+ * so the CPU only wakes up every 65ms and at the deadline itself. */
+
+static volatile unsigned int timer_overflows = 0;
+static volatile unsigned long timer_deadline = 0;
+static volatile unsigned char timer_armed = 0;
+
+static void timer_alarm_start(void)
+{
+  unsigned long remaining;
+
+  remaining = timer_deadline - timer_now();
+  if ((long)remaining <= 0) {
+    timer_armed = 0;
+    event_post(EVENT_TIMER);
+  } else if (remaining <= 0xffff) {
+    TT0.tt0 = 0x0002; /* Stop channel 1... */
+    TDR01.tdr01 = remaining - 1; /* ...and restart as a one-shot alarm. */
+    TS0.ts0 = 0x0002;
+  } else {
+    TT0.tt0 = 0x0002; /* Out of range, an earlier alarm must not fire. */
+    TMIF01 = 0;
+  }
+}
+
+__attribute__((interrupt))
+void tm00_handler(void)
+{
+  stats_count(STATS_ISR_TIMER);
+
+  timer_overflows++;
+
+  if (timer_armed) {
+    timer_alarm_start(); /* Possibly in range now. */
+  }
+}
+
+__attribute__((interrupt))
+void tm01_handler(void)
+{
+  stats_count(STATS_ISR_TIMER);
+
+  TT0.tt0 = 0x0002; /* Stop channel 1, the alarm has expired. */
+  timer_armed = 0;
+  event_post(EVENT_TIMER);
+}
+
+void timer_setup(void)
+{
+  TAU0EN = 1; /* Supply input clock to timer array unit 0. */
+  TPS0.tps0 = 0x0005; /* Set CK00 to 1 MHz (32 MHz / 2^5). */
+
+  TT0.tt0 = 0x0003; /* Stop operation of channels 0 and 1. */
+
+  TMMK00 = 1; /* Disable INTTM00 interrupt... */
+  TMIF00 = 0; /* ...and clear the interrupt request flag. */
+  TMMK01 = 1; /* Disable INTTM01 interrupt... */
+  TMIF01 = 0; /* ...and clear the interrupt request flag. */
+
+  TMPR100 = 0; /* INTTM00 interrupt priority level... */
+  TMPR000 = 0; /* ...select level 0 (highest). */
+  TMPR101 = 0; /* INTTM01 interrupt priority level... */
+  TMPR001 = 0; /* ...select level 0 (highest). */
+
+  TMR00.tmr00 = 0x0000; /* CK00, software trigger, interval timer mode. */
+  TDR00.tdr00 = 0xffff; /* Reload every 65536 counts. */
+  TMR01.tmr01 = 0x0000; /* CK00, software trigger, interval timer mode. */
+
+  TMMK00 = 0; /* Enable timer interrupts. */
+  TMMK01 = 0;
+
+  TS0.ts0 = 0x0001; /* Start channel 0. */
+}
+
+unsigned long timer_now(void)
+{
+  unsigned int overflows, count, pending;
+
+  /* Not read atomically, so repeat if the interrupt changed it. */
+  do {
+    overflows = timer_overflows;
+    count = TCR00.tcr00;
+    pending = TMIF00;
+  } while (overflows != timer_overflows);
+
+  /* Reloaded after the read of the overflow count, but the interrupt
+   * has not been serviced yet. */
+  if (pending && count > 0x8000) {
+    overflows++;
+  }
+
+  return ((unsigned long)overflows << 16) + (0xffff - count);
+}
+
+void timer_alarm(unsigned long deadline)
+{
+  asm("di"); /* Disable interrupts */
+  timer_deadline = deadline;
+  timer_armed = 1;
+  timer_alarm_start();
+  asm("ei"); /* Enable interrupts */
+}
+
+#else /* Interval timer. */
+
+/* The interval timer counter cannot be read, so it keeps ticking every 1ms
+ * to count milliseconds, but the main loop is only woken up at the deadline. */
+
+static volatile unsigned long timer_ticks = 0; /* Milliseconds since start. */
+static volatile unsigned long timer_deadline = 0;
+static volatile unsigned char timer_armed = 0;
 
 __attribute__((interrupt))
 void it_handler(void)
 {
-  if (timer_left > 0) {
-    timer_left--;
+  stats_count(STATS_ISR_TIMER);
+
+  timer_ticks++;
+
+  if (timer_armed && (long)(timer_ticks - timer_deadline) >= 0) {
+    timer_armed = 0;
+    event_post(EVENT_TIMER);
   }
 }
 
@@ -23,18 +144,34 @@ void timer_setup(void)
   ITPR0 = 0; /* ...select level 0 (highest). */
 
   OSMC.osmc = 0x10; /* Use low-speed on-chip oscillator. */
-  ITMC.itmc = 0x8096; /* Start and trigger every ~10ms (150 / 15000Hz). */
+  ITMC.itmc = 0x800e; /* Start and trigger every 1ms (15 / 15000Hz). */
 
   ITMK  = 0; /* Enable timer interrupt. */
 }
 
-unsigned char timer_read(void)
+unsigned long timer_now(void)
 {
-  return timer_left;
+  unsigned long now;
+
+  /* Not read atomically, so repeat if the interrupt changed it. */
+  do {
+    now = timer_ticks;
+  } while (now != timer_ticks);
+
+  return now;
 }
 
-void timer_set(unsigned char countdown)
+void timer_alarm(unsigned long deadline)
 {
-  timer_left = countdown;
+  asm("di"); /* Disable interrupts */
+  if ((long)(timer_ticks - deadline) >= 0) {
+    timer_armed = 0;
+    event_post(EVENT_TIMER);
+  } else {
+    timer_deadline = deadline;
+    timer_armed = 1;
+  }
+  asm("ei"); /* Enable interrupts */
 }
 
+#endif /* TIMER_TAU */
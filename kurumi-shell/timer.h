@@ -1,8 +1,16 @@
 #ifndef _TIMER_H
 #define _TIMER_H
 
+#ifdef TIMER_TAU
+#define TIMER_TICKS_PER_MS 1000 /* Microseconds from TAU0. */
+#define TIMER_TICK_UNIT    "us"
+#else
+#define TIMER_TICKS_PER_MS 1    /* Milliseconds from the interval timer. */
+#define TIMER_TICK_UNIT    "ms"
+#endif
+
 void timer_setup(void);
-unsigned char timer_read(void);
-void timer_set(unsigned char countdown);
+unsigned long timer_now(void);
+void timer_alarm(unsigned long deadline);
 
 #endif /* _TIMER_H */
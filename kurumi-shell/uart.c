@@ -1,31 +1,58 @@
 #include <iodefine.h>
 #include <iodefine_ext.h>
 #include "uart.h"
+#include "event.h"
+#include "timer.h"
+#include "stats.h"
+
+#define UART0_RECV_SIZE 32 /* Must be a power of two. */
+
+/* Written by the interrupt handler at the head, read by the main loop at the
+ * tail, so no masking is needed as long as each side only moves its own. */
+static volatile char uart0_recv_buffer[UART0_RECV_SIZE];
+static volatile unsigned char uart0_recv_head = 0;
+static volatile unsigned char uart0_recv_tail = 0;
 
-static volatile char uart0_recv_byte = '\0';
 static volatile char *uart0_send_byte;
-static volatile char uart0_send_done = 0;
+static volatile unsigned int uart0_send_count;
 
 __attribute__((interrupt))
 void sr0_handler(void)
 {
-  uart0_recv_byte = SDR01.sdr01;
+  char c;
+
+  stats_count(STATS_ISR_RX);
+
+  c = SDR01.sdr01;
+  if (((uart0_recv_head + 1) & (UART0_RECV_SIZE - 1)) != uart0_recv_tail) {
+    uart0_recv_buffer[uart0_recv_head] = c;
+    uart0_recv_head = (uart0_recv_head + 1) & (UART0_RECV_SIZE - 1);
+    stats_count(STATS_RX_BYTES);
+  } else {
+    stats_count(STATS_RX_DROPPED);
+  }
+  event_post(EVENT_RX);
 }
 
 __attribute__((interrupt))
 void st0_handler(void)
 {
-  if (*uart0_send_byte != '\0') {
+  stats_count(STATS_ISR_TX);
+
+  if (uart0_send_count > 0) {
     SDR00.sdr00 = *uart0_send_byte;
     uart0_send_byte++;
+    uart0_send_count--;
   } else {
-    uart0_send_done = 1;
+    event_post(EVENT_TX);
   }
 }
 
 __attribute__((interrupt))
 void tm01h_handler(void) /* INTSRE0 is shared with INTTM01H. */
 {
+  stats_count(STATS_ISR_ERROR);
+
   SIR01.sir01 = SSR01.ssr01 & 0x7; /* Clear error flags. */
 }
 
@@ -94,43 +121,61 @@ void uart0_start(void)
   SS0.BIT.bit1 = 1;
 }
 
-void uart0_send(char *s)
+void uart0_write(char *data, unsigned int len)
 {
-  if (*s == '\0')
+  unsigned long start;
+
+  if (len == 0)
     return;
-  uart0_send_byte = s;
-  uart0_send_done = 0;
+  uart0_send_byte = data;
+  uart0_send_count = len;
+
+  start = timer_now();
 
   /* Send first byte, let interrupt handle the rest... */
   STMK0 = 1; /* Mask transmission interrupt. */
   SDR00.sdr00 = *uart0_send_byte;
   uart0_send_byte++;
+  uart0_send_count--;
   STMK0 = 0; /* Cancel transmission interrupt mask. */
 
-  while (uart0_send_done == 0) {
-    asm("nop");
-  }
+  event_wait(EVENT_BIT(EVENT_TX));
+
+  stats_add(STATS_TX_WAIT, timer_now() - start);
 }
 
-char uart0_recv(void)
+void uart0_send(char *s)
 {
-  char c;
+  unsigned int len;
 
-  /* Enable reception interrupt. */
-  SRMK0  = 0;
-  SREMK0 = 0;
+  for (len = 0; s[len] != '\0'; len++)
+    ;
+  uart0_write(s, len);
+}
 
-  if (uart0_recv_byte != '\0') {
-    c = uart0_recv_byte;
-    uart0_recv_byte = '\0';
-  } else {
-    c = '\0';
-  }
+void uart0_send_decimal(unsigned long value)
+{
+  char digits[11];
+  int i;
 
-  /* Disable reception interrupt. */
-  SRMK0  = 1;
-  SREMK0 = 1;
+  i = sizeof(digits) - 1;
+  digits[i] = '\0';
+  do {
+    digits[--i] = (value % 10) + 0x30;
+    value /= 10;
+  } while (value > 0);
 
-  return c;
+  uart0_send(&digits[i]);
 }
 
+unsigned char uart0_recv(char *c)
+{
+  if (uart0_recv_tail == uart0_recv_head) {
+    return 0;
+  }
+
+  *c = uart0_recv_buffer[uart0_recv_tail];
+  uart0_recv_tail = (uart0_recv_tail + 1) & (UART0_RECV_SIZE - 1);
+
+  return 1;
+}
@@ -4,6 +4,8 @@
 void uart0_setup(void);
 void uart0_start(void);
 void uart0_send(char *s);
-char uart0_recv(void);
+void uart0_write(char *data, unsigned int len);
+void uart0_send_decimal(unsigned long value);
+unsigned char uart0_recv(char *c);
 
 #endif /* _UART_H */
@@ -0,0 +1,714 @@
+#define _GNU_SOURCE /* For posix_openpt() and friends. */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "rl78.h"
+
+/* Flash session benchmark. The writer library programs a simulated
+ * bootloader through a pseudo terminal, and a link model between them
+ * keeps its own clock: every byte takes its time on the wire, each way
+ * adds half the USB round trip, the adapter holds received bytes back
+ * until a packet is full or its latency timer runs out, and bits may be
+ * flipped. Flash times are those of the model, the host is taken to
+ * answer at once, so runs are quick and repeatable. */
+
+
+
+#define BENCH_FLASH_SIZE (256 * RL78_BLOCK_SIZE) /* R5F100GJ, as on the GR-KURUMI. */
+#define BENCH_QUEUE_SIZE 4096 /* Bytes on their way to the host. */
+#define BENCH_HANG_MS 1000 /* Host waiting for an answer that will not come. */
+#define BENCH_SIZES_MAX 16
+
+#define LINK_BITS_PER_BYTE 11 /* Start bit, 8 data bits and 2 stop bits. */
+#define LINK_USB_PACKET 62 /* Payload of an FT232R bulk in packet. */
+
+/* Rough flash timings of the bootloader, in seconds. */
+#define BOOT_BLANK_CHECK_TIME 0.0003 /* Per block. */
+#define BOOT_ERASE_TIME       0.0055 /* Per block. */
+#define BOOT_WRITE_TIME       0.0025 /* Per 256 byte data frame. */
+#define BOOT_VERIFY_TIME      0.0002 /* Per 256 byte data frame. */
+#define BOOT_CHECKSUM_TIME    0.0001 /* Per block. */
+
+typedef enum {
+  BENCH_MODE_PROGRAM   = 0, /* Onto an erased chip. */
+  BENCH_MODE_REPROGRAM = 1, /* Onto the same image, so every block is erased first. */
+  BENCH_MODE_VERIFY    = 2,
+  BENCH_MODE_CHECKSUM  = 3,
+  BENCH_MODE_MAX       = 4,
+} BENCH_MODE;
+
+static const char *bench_mode_names[BENCH_MODE_MAX] = {
+  "program",
+  "reprogram",
+  "verify",
+  "checksum",
+};
+
+typedef struct {
+  double byte_time; /* Seconds per byte on the wire. */
+  double round_trip; /* USB round trip, half of it each way. */
+  double latency_timer; /* 0 if bytes are passed on at once. */
+  double bit_error_rate;
+} link_t;
+
+typedef struct {
+  double time; /* When the host gets it, below 0 while in the open packet. */
+  unsigned char byte;
+} link_byte_t;
+
+static link_t link_model = { LINK_BITS_PER_BYTE / 115200.0, 0.001, 0.016, 0.0 };
+static double link_host_clock; /* When the host was last given bytes. */
+static double link_out_free; /* When the wire to the bootloader is free. */
+static double link_in_free; /* When the wire from the bootloader is free. */
+static link_byte_t link_queue[BENCH_QUEUE_SIZE];
+static int link_head, link_tail;
+static int link_packet_first, link_packet_count;
+static double link_packet_start;
+static unsigned long link_bit_errors;
+
+static unsigned char boot_flash[BENCH_FLASH_SIZE];
+static unsigned char boot_frame[300];
+static int boot_frame_len;
+static unsigned char boot_command; /* Taking data frames, 0 for none. */
+static unsigned long boot_start;
+static unsigned long boot_address;
+static unsigned long boot_end;
+
+
+
+static unsigned char link_corrupt(unsigned char byte)
+{
+  int bit;
+
+  if (link_model.bit_error_rate <= 0.0) {
+    return byte;
+  }
+
+  for (bit = 0; bit < 8; bit++) {
+    if (drand48() < link_model.bit_error_rate) {
+      byte ^= (1 << bit);
+      link_bit_errors++;
+    }
+  }
+
+  return byte;
+}
+
+
+
+static void link_reset(void)
+{
+  link_host_clock = 0.0;
+  link_out_free = 0.0;
+  link_in_free = 0.0;
+  link_head = link_tail = 0;
+  link_packet_count = 0;
+  boot_frame_len = 0;
+  boot_command = 0;
+}
+
+
+
+static void link_packet_close(double time)
+{
+  int i;
+
+  for (i = link_packet_first; i < link_tail; i++) {
+    link_queue[i].time = time + (link_model.round_trip / 2);
+  }
+  link_packet_count = 0;
+}
+
+
+
+/* A byte from the bootloader, sent once the wire is free after ready. */
+static void link_to_host(unsigned char byte, double ready)
+{
+  double arrival;
+
+  if (link_tail == BENCH_QUEUE_SIZE) {
+    return; /* Cannot happen with a host that reads its answers. */
+  }
+
+  arrival = ((link_in_free > ready) ? link_in_free : ready) + link_model.byte_time;
+  link_in_free = arrival;
+
+  if (link_model.latency_timer > 0.0 && link_packet_count > 0 &&
+      arrival >= link_packet_start + link_model.latency_timer) {
+    link_packet_close(link_packet_start + link_model.latency_timer);
+  }
+  if (link_packet_count == 0) {
+    link_packet_first = link_tail;
+    link_packet_start = arrival;
+  }
+
+  link_queue[link_tail].byte = link_corrupt(byte);
+  link_queue[link_tail].time = -1.0;
+  link_tail++;
+  link_packet_count++;
+
+  if (link_model.latency_timer <= 0.0 || link_packet_count == LINK_USB_PACKET) {
+    link_packet_close(arrival);
+  }
+}
+
+
+
+static void boot_send(unsigned char *data, int data_len, double ready)
+{
+  int i;
+
+  link_to_host(0x02, ready); /* Status or Data Frame Header */
+  link_to_host(data_len & 0xff, ready);
+  for (i = 0; i < data_len; i++) {
+    link_to_host(data[i], ready);
+  }
+  link_to_host(rl78_checksum(data, data_len & 0xff), ready);
+  link_to_host(0x03, ready); /* Footer */
+}
+
+
+
+static void boot_status(unsigned char status, double ready)
+{
+  boot_send(&status, 1, ready);
+}
+
+
+
+static void boot_signature(double ready)
+{
+  unsigned char data[22] = {
+    0x10, 0x00, 0x06, /* Device code */
+    'R', '5', 'F', '1', '0', '0', 'G', 'J', ' ', ' ',
+    (BENCH_FLASH_SIZE - 1) & 0xff, ((BENCH_FLASH_SIZE - 1) >> 8) & 0xff,
+    ((BENCH_FLASH_SIZE - 1) >> 16) & 0xff, /* Code flash end */
+    0xff, 0x17, 0x0f, /* Data flash end */
+    0x03, 0x01, 0x00, /* Firmware version */
+  };
+
+  boot_status(RL78_STATUS_NORMAL_ACK, ready);
+  boot_send(data, sizeof(data), ready);
+}
+
+
+
+static int boot_blank(unsigned long start, unsigned long end)
+{
+  unsigned long i;
+
+  for (i = start; i <= end; i++) {
+    if (boot_flash[i] != 0xff) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+
+
+static void boot_command_frame(unsigned char *frame, double ready)
+{
+  unsigned long start, end, i;
+  unsigned int sum;
+  unsigned char answer[3];
+  int blocks;
+
+  start = end = 0;
+  if (frame[1] >= 4) {
+    start = frame[3] + (frame[4] * 0x100UL) + (frame[5] * 0x10000UL);
+    end = start + RL78_BLOCK_SIZE - 1;
+  }
+  if (frame[1] >= 7) {
+    end = frame[6] + (frame[7] * 0x100UL) + (frame[8] * 0x10000UL);
+  }
+  if (start > end || end >= BENCH_FLASH_SIZE) {
+    boot_status(RL78_STATUS_PARAMETER_ERROR, ready);
+    return;
+  }
+  blocks = (end - start + 1) / RL78_BLOCK_SIZE;
+
+  switch (frame[2]) {
+  case RL78_COMMAND_RESET:
+    boot_status(RL78_STATUS_NORMAL_ACK, ready);
+    break;
+
+  case RL78_COMMAND_BAUD_RATE_SET:
+    answer[0] = RL78_STATUS_NORMAL_ACK;
+    answer[1] = 32; /* MHz */
+    answer[2] = 0; /* Full-speed mode */
+    boot_send(answer, 3, ready);
+    break;
+
+  case RL78_COMMAND_SILICON_SIGNATURE:
+    boot_signature(ready);
+    break;
+
+  case RL78_COMMAND_BLOCK_BLANK_CHECK:
+    boot_status(boot_blank(start, end) ? RL78_STATUS_NORMAL_ACK : RL78_STATUS_IVERIFY_BLANK_ERROR,
+      ready + (blocks * BOOT_BLANK_CHECK_TIME));
+    break;
+
+  case RL78_COMMAND_BLOCK_ERASE:
+    memset(&boot_flash[start], 0xff, RL78_BLOCK_SIZE);
+    boot_status(RL78_STATUS_NORMAL_ACK, ready + BOOT_ERASE_TIME);
+    break;
+
+  case RL78_COMMAND_PROGRAMMING:
+  case RL78_COMMAND_VERIFY:
+    boot_command = frame[2];
+    boot_start = start;
+    boot_address = start;
+    boot_end = end;
+    boot_status(RL78_STATUS_NORMAL_ACK, ready);
+    break;
+
+  case RL78_COMMAND_CHECKSUM:
+    sum = 0;
+    for (i = start; i <= end; i++) {
+      sum -= boot_flash[i];
+    }
+    boot_status(RL78_STATUS_NORMAL_ACK, ready + (blocks * BOOT_CHECKSUM_TIME));
+    answer[0] = sum & 0xff;
+    answer[1] = (sum >> 8) & 0xff;
+    boot_send(answer, 2, ready + (blocks * BOOT_CHECKSUM_TIME));
+    break;
+
+  default:
+    boot_status(RL78_STATUS_COMMAND_NUMBER_ERROR, ready);
+    break;
+  }
+}
+
+
+
+static void boot_data_frame(unsigned char *frame, int frame_len, double ready)
+{
+  int len;
+  unsigned char answer[2];
+
+  len = frame_len - 4;
+  if (boot_command == 0 || boot_address + len - 1 > boot_end) {
+    boot_status(RL78_STATUS_PARAMETER_ERROR, ready);
+    return;
+  }
+
+  answer[0] = RL78_STATUS_NORMAL_ACK;
+  answer[1] = RL78_STATUS_NORMAL_ACK;
+  if (boot_command == RL78_COMMAND_PROGRAMMING) {
+    memcpy(&boot_flash[boot_address], &frame[2], len);
+    ready += BOOT_WRITE_TIME;
+  } else {
+    if (memcmp(&boot_flash[boot_address], &frame[2], len) != 0) {
+      answer[1] = RL78_STATUS_VERIFY_ERROR;
+    }
+    ready += BOOT_VERIFY_TIME;
+  }
+  boot_send(answer, 2, ready);
+
+  boot_address += len;
+  if (frame[frame_len - 1] == 0x03) {
+    /* Programming ends with the internal verify of the whole range. */
+    if (boot_command == RL78_COMMAND_PROGRAMMING) {
+      boot_status(RL78_STATUS_NORMAL_ACK, ready + (((boot_end - boot_start + 1) / 256) * BOOT_VERIFY_TIME));
+    }
+    boot_command = 0;
+  }
+}
+
+
+
+/* A byte from the host, which wrote it as soon as it had its last answer. */
+static void boot_recv(unsigned char byte)
+{
+  double arrival;
+  int len;
+
+  arrival = link_host_clock + (link_model.round_trip / 2);
+  if (link_out_free > arrival) {
+    arrival = link_out_free;
+  }
+  arrival += link_model.byte_time;
+  link_out_free = arrival;
+
+  byte = link_corrupt(byte);
+  if (boot_frame_len == 0 && byte != 0x01 && byte != 0x02) {
+    return; /* Such as the byte selecting two-wire mode. */
+  }
+  if (boot_frame_len == sizeof(boot_frame)) {
+    boot_frame_len = 0;
+    return;
+  }
+  boot_frame[boot_frame_len++] = byte;
+
+  if (boot_frame_len < 2) {
+    return;
+  }
+  len = boot_frame[1] ? boot_frame[1] : 0x100;
+  if (boot_frame_len < len + 4) {
+    return;
+  }
+
+  boot_frame_len = 0;
+  if (rl78_checksum(&boot_frame[2], boot_frame[1]) != boot_frame[len + 2]) {
+    boot_status(RL78_STATUS_CHECKSUM_ERROR, arrival);
+  } else if (boot_frame[0] == 0x01) {
+    boot_command_frame(boot_frame, arrival);
+  } else {
+    boot_data_frame(boot_frame, len + 4, arrival);
+  }
+}
+
+
+
+/* Hands the host everything that arrives at the same time. */
+static void link_deliver(int master_fd)
+{
+  unsigned char data[BENCH_QUEUE_SIZE];
+  int len;
+  double time;
+
+  if (link_queue[link_head].time < 0.0) {
+    link_packet_close(link_packet_start + link_model.latency_timer);
+  }
+
+  time = link_queue[link_head].time;
+  len = 0;
+  while (link_head < link_tail && link_queue[link_head].time == time) {
+    data[len++] = link_queue[link_head++].byte;
+  }
+  if (link_head == link_tail) {
+    link_head = link_tail = 0;
+  }
+
+  if (write(master_fd, data, len) != len) {
+    perror("write");
+  }
+  link_host_clock = time;
+}
+
+
+
+/* The writer side, as kurumi does it. Any error goes into the pipe. */
+static void bench_host(char *tty_device, int mode, unsigned char *image, int image_len, int error_fd)
+{
+  rl78_t *rl78;
+  rl78_mode_t baud;
+  rl78_signature_t signature;
+  int blocks, checksum_local, checksum_remote;
+  const char *error;
+
+  blocks = (image_len + RL78_BLOCK_SIZE - 1) / RL78_BLOCK_SIZE;
+  checksum_local = -1;
+
+  rl78 = rl78_new();
+  if (rl78 == NULL) {
+    _exit(EXIT_FAILURE);
+  }
+  if (programmer_init(rl78, tty_device) != 0) {
+    goto failure;
+  }
+
+  if (command_baud_rate_set(rl78, &baud) != 0 ||
+      command_reset(rl78) != 0 ||
+      command_silicon_signature(rl78, &signature) != 0) {
+    goto failure;
+  }
+
+  if (mode != BENCH_MODE_CHECKSUM) {
+    checksum_local = rl78_write(rl78, 0, image, image_len, mode == BENCH_MODE_VERIFY);
+    if (checksum_local == -1) {
+      goto failure;
+    }
+  }
+
+  checksum_remote = command_checksum(rl78, 0, blocks);
+  if (checksum_remote == -1) {
+    goto failure;
+  }
+  if (checksum_local != -1 && checksum_local != checksum_remote) {
+    error = "Checksum mismatch";
+    if (write(error_fd, error, strlen(error)) < 0) {
+      perror("write");
+    }
+    _exit(EXIT_FAILURE);
+  }
+
+  programmer_shutdown(rl78);
+  rl78_free(rl78);
+  _exit(EXIT_SUCCESS);
+
+failure:
+  error = rl78_error(rl78);
+  if (write(error_fd, error, strlen(error)) < 0) {
+    perror("write");
+  }
+  _exit(EXIT_FAILURE);
+}
+
+
+
+static double bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+
+
+/* One flash session, returns the modelled time or -1 if it failed. */
+static double bench_session(int master_fd, char *tty_device, int mode,
+  unsigned char *image, int image_len, char *error, int error_size)
+{
+  int error_pipe[2], status, result, len, i;
+  pid_t pid;
+  struct pollfd fds[2];
+  unsigned char data[512];
+
+  if (pipe(error_pipe) == -1) {
+    perror("pipe");
+    exit(EXIT_FAILURE);
+  }
+
+  fflush(stdout);
+  pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    close(error_pipe[0]);
+    bench_host(tty_device, mode, image, image_len, error_pipe[1]);
+  }
+  close(error_pipe[1]);
+
+  link_reset();
+  error[0] = '\0';
+  len = 0;
+  fds[0].fd = master_fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = error_pipe[0];
+  fds[1].events = POLLIN;
+
+  while (1) {
+    /* Whatever the host has written goes first, then the next answer. */
+    result = poll(fds, 2, (link_head < link_tail) ? 0 : BENCH_HANG_MS);
+    if (result == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll");
+      exit(EXIT_FAILURE);
+    }
+
+    if (fds[0].revents & POLLIN) {
+      result = read(master_fd, data, sizeof(data));
+      for (i = 0; i < result; i++) {
+        boot_recv(data[i]);
+      }
+      continue;
+    }
+
+    if (fds[1].revents & (POLLIN | POLLHUP)) {
+      result = read(error_pipe[0], error + len, error_size - len - 1);
+      if (result > 0) {
+        len += result;
+        error[len] = '\0';
+        continue;
+      }
+      break; /* The host is done. */
+    }
+
+    if (link_head < link_tail) {
+      link_deliver(master_fd);
+    } else {
+      snprintf(error, error_size, "No answer after %d ms", BENCH_HANG_MS);
+      kill(pid, SIGKILL);
+      break;
+    }
+  }
+
+  close(error_pipe[0]);
+  waitpid(pid, &status, 0);
+  tcflush(master_fd, TCIOFLUSH);
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+    return -1.0;
+  }
+  return link_host_clock;
+}
+
+
+
+static void display_help(char *progname)
+{
+  fprintf(stderr, "Usage: %s <options>\n", progname);
+  fprintf(stderr, "Options:\n"
+     "  -h          Display this help and exit.\n"
+     "  -v          Print why failed sessions failed.\n"
+     "  -b BAUD     Bit rate of the wire, 115200 by default.\n"
+     "  -l USEC     USB round trip, 1000 by default.\n"
+     "  -u MSEC     Latency timer of the adapter, 16 by default, 0 for none.\n"
+     "  -e RATE     Bit error rate, such as 1e-6, none by default.\n"
+     "  -s KIB,...  Image sizes, 1,4,16,64 by default.\n"
+     "  -r COUNT    Sessions for each size and mode.\n"
+     "\n");
+}
+
+
+
+int main(int argc, char *argv[])
+{
+  int c, i, mode, size, repeat, sizes_count, ok;
+  int master_fd, slave_fd;
+  double time, total, wall;
+  char *tty_device, *size_list, *token;
+  char error[256];
+  struct termios tio;
+  int sizes[BENCH_SIZES_MAX];
+  static unsigned char image[BENCH_FLASH_SIZE];
+
+  int print_errors = 0;
+  int repeats = 1;
+  long baud = 115200;
+
+  size_list = "1,4,16,64";
+
+  while ((c = getopt(argc, argv, "hvb:l:u:e:s:r:")) != -1) {
+    switch (c) {
+    case 'h':
+      display_help(argv[0]);
+      return EXIT_SUCCESS;
+
+    case 'v':
+      print_errors = 1;
+      break;
+
+    case 'b':
+      baud = atol(optarg);
+      break;
+
+    case 'l':
+      link_model.round_trip = atof(optarg) / 1e6;
+      break;
+
+    case 'u':
+      link_model.latency_timer = atof(optarg) / 1e3;
+      break;
+
+    case 'e':
+      link_model.bit_error_rate = atof(optarg);
+      break;
+
+    case 's':
+      size_list = optarg;
+      break;
+
+    case 'r':
+      repeats = atoi(optarg);
+      break;
+
+    case '?':
+    default:
+      display_help(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (baud <= 0 || repeats <= 0) {
+    display_help(argv[0]);
+    return EXIT_FAILURE;
+  }
+  link_model.byte_time = (double)LINK_BITS_PER_BYTE / baud;
+
+  sizes_count = 0;
+  size_list = strdup(size_list);
+  for (token = strtok(size_list, ","); token != NULL; token = strtok(NULL, ",")) {
+    size = atoi(token) * 1024;
+    if (size <= 0 || size > BENCH_FLASH_SIZE || sizes_count == BENCH_SIZES_MAX) {
+      fprintf(stderr, "Bad image size: %s KiB\n", token);
+      return EXIT_FAILURE;
+    }
+    sizes[sizes_count++] = size;
+  }
+  free(size_list);
+
+  /* The bootloader end of a pseudo terminal, the writer opens the other. */
+  master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master_fd == -1 || grantpt(master_fd) == -1 || unlockpt(master_fd) == -1) {
+    perror("posix_openpt");
+    return EXIT_FAILURE;
+  }
+  tty_device = ptsname(master_fd);
+
+  /* Kept open, so the pseudo terminal stays up between sessions. */
+  slave_fd = open(tty_device, O_RDWR | O_NOCTTY);
+  if (slave_fd == -1 || tcgetattr(slave_fd, &tio) == -1) {
+    perror(tty_device);
+    return EXIT_FAILURE;
+  }
+  cfmakeraw(&tio);
+  tcsetattr(slave_fd, TCSANOW, &tio);
+
+  srand48(1);
+  for (i = 0; i < BENCH_FLASH_SIZE; i++) {
+    image[i] = lrand48() & 0xff;
+  }
+
+  printf("link: %ld baud, %.0f us round trip, %.0f ms latency timer, bit error rate %g\n",
+    baud, link_model.round_trip * 1e6, link_model.latency_timer * 1e3, link_model.bit_error_rate);
+  printf("%-10s %8s %10s %9s %10s %7s\n", "mode", "size", "time (ms)", "KiB/s", "wall (ms)", "ok");
+
+  for (i = 0; i < sizes_count; i++) {
+    for (mode = 0; mode < BENCH_MODE_MAX; mode++) {
+      ok = 0;
+      total = 0.0;
+      wall = bench_now();
+      for (repeat = 0; repeat < repeats; repeat++) {
+        /* Every mode but the first finds the image in place. */
+        memset(boot_flash, 0xff, sizeof(boot_flash));
+        if (mode != BENCH_MODE_PROGRAM) {
+          memcpy(boot_flash, image, sizes[i]);
+        }
+        time = bench_session(master_fd, tty_device, mode, image, sizes[i], error, sizeof(error));
+        if (time < 0.0) {
+          if (print_errors) {
+            fprintf(stderr, "%s %d KiB: %s\n", bench_mode_names[mode], sizes[i] / 1024, error);
+          }
+          continue;
+        }
+        ok++;
+        total += time;
+      }
+      wall = (bench_now() - wall) / repeats;
+
+      if (ok > 0) {
+        printf("%-10s %5d KiB %10.1f %9.2f %10.1f %3d/%-3d\n", bench_mode_names[mode], sizes[i] / 1024,
+          total * 1e3 / ok, (sizes[i] / 1024.0) / (total / ok), wall * 1e3, ok, repeats);
+      } else {
+        printf("%-10s %5d KiB %10s %9s %10.1f %3d/%-3d\n", bench_mode_names[mode], sizes[i] / 1024,
+          "-", "-", wall * 1e3, ok, repeats);
+      }
+    }
+  }
+
+  if (link_bit_errors > 0) {
+    printf("bits flipped: %lu\n", link_bit_errors);
+  }
+
+  close(slave_fd);
+  close(master_fd);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "rl78.h"
+
+/* Prints a traffic capture of kurumi -c as commands and statuses. */
+
+
+
+static unsigned long frame_address(unsigned char *data)
+{
+  return data[0] + (data[1] * 0x100UL) + (data[2] * 0x10000UL);
+}
+
+
+
+static void print_bytes(unsigned char *data, int data_len, int print_data)
+{
+  int i;
+
+  if (!print_data && data_len > 8) {
+    printf(" (%d bytes)", data_len);
+    return;
+  }
+
+  for (i = 0; i < data_len; i++) {
+    printf(" %02x", data[i]);
+  }
+}
+
+
+
+static void print_statuses(unsigned char *data, int data_len)
+{
+  int i;
+
+  for (i = 0; i < data_len; i++) {
+    printf("%s%s (0x%02x)", i ? ", " : " ", rl78_status_text(data[i]), data[i]);
+  }
+}
+
+
+
+static void display_help(char *progname)
+{
+  fprintf(stderr, "Usage: %s <options> FILE\n", progname);
+  fprintf(stderr, "FILE can be - for the standard input.\n");
+  fprintf(stderr, "Options:\n"
+     "  -h          Display this help and exit.\n"
+     "  -x          Print the bytes of data frames too.\n"
+     "\n");
+}
+
+
+
+int main(int argc, char *argv[])
+{
+  int c, result, len, records, data_frames;
+  unsigned char *data;
+  unsigned long long first, previous;
+  FILE *fh;
+  rl78_record_t record;
+
+  int print_data = 0;
+  int command = -1; /* Last command sent. */
+  int answers = 0; /* Frames received since. */
+
+  while ((c = getopt(argc, argv, "hx")) != -1) {
+    switch (c) {
+    case 'h':
+      display_help(argv[0]);
+      return EXIT_SUCCESS;
+
+    case 'x':
+      print_data = 1;
+      break;
+
+    case '?':
+    default:
+      display_help(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (optind != argc - 1) {
+    display_help(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (strcmp(argv[optind], "-") == 0) {
+    fh = stdin;
+  } else {
+    fh = fopen(argv[optind], "rb");
+    if (fh == NULL) {
+      fprintf(stderr, "fopen(%s) failed: %s\n", argv[optind], strerror(errno));
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (rl78_capture_header(fh) != 0) {
+    fprintf(stderr, "%s: not a capture file\n", argv[optind]);
+    fclose(fh);
+    return EXIT_FAILURE;
+  }
+
+  first = previous = 0;
+  records = 0;
+  data_frames = 0;
+  while ((result = rl78_capture_read(fh, &record)) == 1) {
+    if (records++ == 0) {
+      first = previous = record.time;
+    }
+    printf("%11.6f %+9.3f ms %s", (record.time - first) / 1e9, (record.time - previous) / 1e6,
+      record.direction == RL78_CAPTURE_SENT ? ">>>" : "<<<");
+    previous = record.time;
+
+    if (record.frame_len < 5) {
+      printf(" Short frame");
+      print_bytes(record.frame, record.frame_len, 1);
+      printf("\n");
+      continue;
+    }
+
+    data = &record.frame[2];
+    len = record.frame[1] ? record.frame[1] : 0x100;
+    if (len != record.frame_len - 4) {
+      printf(" Bad length %d of %d bytes\n", len, record.frame_len);
+      continue;
+    }
+
+    if (record.direction == RL78_CAPTURE_SENT && record.frame[0] == 0x01) {
+      command = data[0];
+      answers = 0;
+      data_frames = 0;
+      printf(" %s (0x%02x)", rl78_command_text(command), command);
+      if (len >= 7) {
+        printf(" 0x%06lx-0x%06lx", frame_address(&data[1]), frame_address(&data[4]));
+        print_bytes(&data[7], len - 7, 1);
+      } else if (len >= 4) {
+        printf(" 0x%06lx", frame_address(&data[1]));
+      } else {
+        print_bytes(&data[1], len - 1, 1);
+      }
+
+    } else if (record.direction == RL78_CAPTURE_SENT) {
+      data_frames++;
+      answers = 0;
+      printf(" Data #%d", data_frames);
+      print_bytes(data, len, print_data);
+      printf(record.frame[record.frame_len - 1] == 0x03 ? ", last" : ", more to come");
+
+    } else if (answers++ == 1 && (command == RL78_COMMAND_SILICON_SIGNATURE ||
+               command == RL78_COMMAND_CHECKSUM)) {
+      /* The data frame after the status. */
+      if (command == RL78_COMMAND_CHECKSUM && len == 2) {
+        printf(" Checksum 0x%04x", data[0] + (data[1] * 0x100));
+      } else if (command == RL78_COMMAND_SILICON_SIGNATURE && len == 22) {
+        printf(" Device 0x%02x 0x%02x 0x%02x %.10s, code flash end 0x%06lx, data flash end 0x%06lx,"
+          " firmware %d.%d%d", data[0], data[1], data[2], &data[3], frame_address(&data[13]),
+          frame_address(&data[16]), data[19], data[20], data[21]);
+      } else {
+        printf(" Data");
+        print_bytes(data, len, print_data);
+      }
+
+    } else if (command == RL78_COMMAND_BAUD_RATE_SET && len == 3) {
+      print_statuses(data, 1);
+      printf(", %d MHz, %s", data[1], data[2] ? "wide-voltage" : "full-speed");
+
+    } else {
+      print_statuses(data, len);
+    }
+
+    if (rl78_checksum(data, record.frame[1]) != record.frame[record.frame_len - 2]) {
+      printf(" [checksum incorrect]");
+    }
+    printf("\n");
+  }
+
+  fclose(fh);
+  if (result == -1) {
+    fprintf(stderr, "%s: cut short\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,334 @@
+#define _GNU_SOURCE /* For posix_openpt() and friends. */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+#include "rl78.h"
+
+/* Plays the board of a traffic capture from kurumi -c. Every frame the
+ * writer sends is matched against the next one sent in the capture, and
+ * the frames the board answered with follow after the same delays, or
+ * scaled ones, counted from the end of the writer's frame. */
+
+
+
+#define REPLAY_IDLE_MS 2000 /* Writer gone quiet before the capture ended. */
+
+
+
+typedef struct {
+  unsigned char frame[RL78_FRAME_MAX];
+  int frame_len;
+} replay_frame_t;
+
+static rl78_record_t *replay_records = NULL;
+static int replay_record_count = 0;
+static double replay_scale = 1.0;
+static pid_t replay_pid = 0; /* Of the writer, if we started it. */
+static int replay_status = 0;
+static int replay_exited = 0;
+
+
+
+static int replay_load(char *filename)
+{
+  FILE *fh;
+  int result, size;
+
+  fh = fopen(filename, "rb");
+  if (fh == NULL) {
+    fprintf(stderr, "fopen(%s) failed: %s\n", filename, strerror(errno));
+    return -1;
+  }
+
+  if (rl78_capture_header(fh) != 0) {
+    fprintf(stderr, "%s: not a capture file\n", filename);
+    fclose(fh);
+    return -1;
+  }
+
+  size = 0;
+  while (1) {
+    if (replay_record_count == size) {
+      size = size ? size * 2 : 256;
+      replay_records = realloc(replay_records, size * sizeof(rl78_record_t));
+      if (replay_records == NULL) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    result = rl78_capture_read(fh, &replay_records[replay_record_count]);
+    if (result != 1) {
+      break;
+    }
+    replay_record_count++;
+  }
+  fclose(fh);
+
+  if (result == -1 && replay_record_count == 0) {
+    fprintf(stderr, "%s: no complete frame\n", filename);
+    return -1;
+  } else if (result == -1) {
+    fprintf(stderr, "%s: cut short, replaying the first %d frames\n", filename, replay_record_count);
+  }
+
+  return 0;
+}
+
+
+
+static unsigned long long replay_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+
+
+static void replay_sleep_until(unsigned long long time)
+{
+  struct timespec ts;
+
+  ts.tv_sec = time / 1000000000ULL;
+  ts.tv_nsec = time % 1000000000ULL;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+}
+
+
+
+/* Collects the next frame from the writer, skipping anything before a
+ * header, such as the byte that selects two-wire mode. Returns 0 if the
+ * writer has exited or gone quiet. */
+static int replay_recv(int master_fd, int first, replay_frame_t *frame)
+{
+  struct pollfd fds;
+  unsigned char byte;
+  int result, len;
+
+  fds.fd = master_fd;
+  fds.events = POLLIN;
+  frame->frame_len = 0;
+
+  while (1) {
+    if (replay_pid > 0) {
+      result = poll(&fds, 1, 10);
+    } else {
+      result = poll(&fds, 1, first ? -1 : REPLAY_IDLE_MS);
+    }
+    if (result == -1 && errno != EINTR) {
+      perror("poll");
+      exit(EXIT_FAILURE);
+    }
+    if (result <= 0) {
+      if (replay_pid > 0 && !replay_exited) {
+        replay_exited = (waitpid(replay_pid, &replay_status, WNOHANG) == replay_pid);
+        continue;
+      }
+      if (replay_pid == 0 && result < 0) {
+        continue;
+      }
+      return 0;
+    }
+
+    if (read(master_fd, &byte, 1) != 1) {
+      continue;
+    }
+    if (frame->frame_len == 0 && byte != 0x01 && byte != 0x02) {
+      continue;
+    }
+    frame->frame[frame->frame_len++] = byte;
+
+    if (frame->frame_len >= 2) {
+      len = frame->frame[1] ? frame->frame[1] : 0x100;
+      if (frame->frame_len == len + 4) {
+        return 1;
+      }
+    }
+  }
+}
+
+
+
+static void display_help(char *progname)
+{
+  fprintf(stderr, "Usage: %s <options> FILE [COMMAND...]\n", progname);
+  fprintf(stderr, "Options:\n"
+     "  -h          Display this help and exit.\n"
+     "  -x SCALE    Multiply the delays of the board by SCALE, 0 answers at once.\n"
+     "\n"
+     "The capture FILE is answered on a pseudo terminal. With a COMMAND, such as\n"
+     "\"kurumi -q -f kurumi.bin -d\", it is run with the terminal added to the end\n"
+     "and timed, otherwise the terminal is printed.\n");
+}
+
+
+
+int main(int argc, char *argv[])
+{
+  int c, i, n, master_fd, slave_fd, differing, replayed;
+  char *tty_device;
+  char **command;
+  struct termios tio;
+  replay_frame_t frame;
+  rl78_record_t *record;
+  unsigned long long start, received, delay;
+
+  /* "+" stops at the file, so the options of the command are left alone. */
+  while ((c = getopt(argc, argv, "+hx:")) != -1) {
+    switch (c) {
+    case 'h':
+      display_help(argv[0]);
+      return EXIT_SUCCESS;
+
+    case 'x':
+      replay_scale = atof(optarg);
+      break;
+
+    case '?':
+    default:
+      display_help(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (optind >= argc || replay_scale < 0.0) {
+    display_help(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (replay_load(argv[optind]) != 0) {
+    return EXIT_FAILURE;
+  }
+
+  master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master_fd == -1 || grantpt(master_fd) == -1 || unlockpt(master_fd) == -1) {
+    perror("posix_openpt");
+    return EXIT_FAILURE;
+  }
+  tty_device = ptsname(master_fd);
+
+  /* Kept open, so the pseudo terminal stays up while the writer opens it. */
+  slave_fd = open(tty_device, O_RDWR | O_NOCTTY);
+  if (slave_fd == -1 || tcgetattr(slave_fd, &tio) == -1) {
+    perror(tty_device);
+    return EXIT_FAILURE;
+  }
+  cfmakeraw(&tio);
+  tcsetattr(slave_fd, TCSANOW, &tio);
+
+  start = replay_now();
+  if (optind + 1 < argc) {
+    n = argc - optind - 1;
+    command = calloc(n + 2, sizeof(char *));
+    if (command == NULL) {
+      perror("calloc");
+      return EXIT_FAILURE;
+    }
+    for (i = 0; i < n; i++) {
+      command[i] = argv[optind + 1 + i];
+    }
+    command[n] = tty_device;
+
+    fflush(stdout);
+    replay_pid = fork();
+    if (replay_pid == -1) {
+      perror("fork");
+      return EXIT_FAILURE;
+    }
+    if (replay_pid == 0) {
+      close(master_fd);
+      close(slave_fd);
+      execvp(command[0], command);
+      perror(command[0]);
+      _exit(EXIT_FAILURE);
+    }
+  } else {
+    fprintf(stderr, "replay: %s\n", tty_device);
+  }
+
+  differing = 0;
+  replayed = 0;
+  i = 0;
+  while (i < replay_record_count) {
+    /* The board may have spoken first, which is only replayed as is. */
+    if (replay_records[i].direction == RL78_CAPTURE_RECEIVED) {
+      if (write(master_fd, replay_records[i].frame, replay_records[i].frame_len) < 0) {
+        perror("write");
+      }
+      i++;
+      continue;
+    }
+
+    if (replay_recv(master_fd, replayed == 0, &frame) == 0) {
+      break;
+    }
+    received = replay_now();
+
+    record = &replay_records[i++];
+    replayed++;
+    if (frame.frame_len != record->frame_len ||
+        memcmp(frame.frame, record->frame, frame.frame_len) != 0) {
+      if (differing++ == 0) {
+        fprintf(stderr, "frame %d differs from the capture\n", replayed);
+      }
+    }
+
+    /* Each answer after its delay from the frame before it. */
+    for (; i < replay_record_count && replay_records[i].direction == RL78_CAPTURE_RECEIVED; i++) {
+      delay = (replay_records[i].time - replay_records[i - 1].time) * replay_scale;
+      received += delay;
+      replay_sleep_until(received);
+      if (write(master_fd, replay_records[i].frame, replay_records[i].frame_len) < 0) {
+        perror("write");
+      }
+    }
+  }
+
+  if (i < replay_record_count) {
+    fprintf(stderr, "writer stopped after %d of the captured frames\n", replayed);
+  }
+
+  /* A writer still waiting at the end of the capture never gets its answer. */
+  for (n = 0; replay_pid > 0 && !replay_exited; n++) {
+    replay_exited = (waitpid(replay_pid, &replay_status, WNOHANG) == replay_pid);
+    if (!replay_exited && n == REPLAY_IDLE_MS) {
+      fprintf(stderr, "writer still running at the end of the capture\n");
+      kill(replay_pid, SIGTERM);
+      waitpid(replay_pid, &replay_status, 0);
+      break;
+    }
+    usleep(1000);
+  }
+
+  /* Closing the terminal throws away what the writer has not read yet. */
+  for (n = 0; n < REPLAY_IDLE_MS; n++) {
+    if (ioctl(slave_fd, FIONREAD, &c) == -1 || c == 0) {
+      break;
+    }
+    usleep(1000);
+  }
+  printf("%d frames replayed, %d differing, %.3f s\n", replayed, differing,
+    (replay_now() - start) / 1e9);
+
+  close(slave_fd);
+  close(master_fd);
+
+  if (replay_pid > 0 && (!WIFEXITED(replay_status) || WEXITSTATUS(replay_status) != EXIT_SUCCESS)) {
+    return EXIT_FAILURE;
+  }
+  /* Answers to other frames than captured mean little. */
+  return (i < replay_record_count || differing > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,1018 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+
+#include "rl78.h"
+
+
+
+#define RL78_CAPTURE_BUFFER 65536 /* Written out only when full. */
+#define RL78_CAPTURE_HEADER 11 /* Time, direction and length. */
+
+
+
+struct rl78_context {
+  int tty_fd;
+  int print_traffic;
+  rl78_progress_t progress;
+  void *progress_data;
+  FILE *capture;
+  volatile sig_atomic_t interrupted;
+  char error[256]; /* Reason for the last failure. */
+};
+
+
+
+rl78_t *rl78_new(void)
+{
+  rl78_t *rl78;
+
+  rl78 = calloc(1, sizeof(rl78_t));
+  if (rl78 == NULL) {
+    return NULL;
+  }
+
+  rl78->tty_fd = -1;
+  return rl78;
+}
+
+
+
+void rl78_free(rl78_t *rl78)
+{
+  if (rl78->tty_fd != -1) {
+    close(rl78->tty_fd);
+  }
+  if (rl78->capture != NULL) {
+    fclose(rl78->capture);
+  }
+  free(rl78);
+}
+
+
+
+void rl78_traffic_set(rl78_t *rl78, int enable)
+{
+  rl78->print_traffic = enable;
+}
+
+
+
+void rl78_progress_set(rl78_t *rl78, rl78_progress_t progress, void *data)
+{
+  rl78->progress = progress;
+  rl78->progress_data = data;
+}
+
+
+
+/* Only sets a flag, so it can be called from a signal handler. */
+void rl78_interrupt(rl78_t *rl78)
+{
+  rl78->interrupted = 1;
+}
+
+
+
+const char *rl78_error(rl78_t *rl78)
+{
+  return rl78->error;
+}
+
+
+
+static void rl78_error_set(rl78_t *rl78, const char *format, ...)
+{
+  va_list args;
+
+  va_start(args, format);
+  vsnprintf(rl78->error, sizeof(rl78->error), format, args);
+  va_end(args);
+}
+
+
+
+int rl78_capture_open(rl78_t *rl78, const char *filename)
+{
+  if (rl78->capture != NULL) {
+    fclose(rl78->capture);
+  }
+
+  rl78->capture = fopen(filename, "wb");
+  if (rl78->capture == NULL) {
+    rl78_error_set(rl78, "fopen(%s) failed: %s", filename, strerror(errno));
+    return -1;
+  }
+  setvbuf(rl78->capture, NULL, _IOFBF, RL78_CAPTURE_BUFFER);
+
+  if (fwrite(RL78_CAPTURE_MAGIC, 1, strlen(RL78_CAPTURE_MAGIC), rl78->capture) !=
+      strlen(RL78_CAPTURE_MAGIC)) {
+    rl78_error_set(rl78, "fwrite() failed: %s", strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+
+
+int rl78_capture_close(rl78_t *rl78)
+{
+  int result;
+
+  if (rl78->capture == NULL) {
+    return 0;
+  }
+
+  result = ferror(rl78->capture);
+  result |= fclose(rl78->capture);
+  rl78->capture = NULL;
+  if (result != 0) {
+    rl78_error_set(rl78, "fclose() failed: %s", strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+
+
+/* Buffered until full, or until the capture is closed or the handle freed,
+ * where write errors show up at rl78_capture_close(). */
+static void capture_record(rl78_t *rl78, int direction, unsigned char *frame, int frame_len)
+{
+  struct timespec ts;
+  unsigned long long time;
+  unsigned char header[RL78_CAPTURE_HEADER];
+  int i;
+
+  if (rl78->capture == NULL) {
+    return;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  time = (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+  for (i = 0; i < 8; i++) {
+    header[i] = (time >> (i * 8)) & 0xff;
+  }
+  header[8] = direction;
+  header[9] = frame_len & 0xff;
+  header[10] = (frame_len >> 8) & 0xff;
+
+  fwrite(header, 1, sizeof(header), rl78->capture);
+  fwrite(frame, 1, frame_len, rl78->capture);
+}
+
+
+
+/* Reads the magic at the start of a capture, -1 if it is not one. */
+int rl78_capture_header(FILE *fh)
+{
+  char magic[sizeof(RL78_CAPTURE_MAGIC) - 1];
+
+  if (fread(magic, 1, sizeof(magic), fh) != sizeof(magic) ||
+      memcmp(magic, RL78_CAPTURE_MAGIC, sizeof(magic)) != 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+
+
+/* Returns 1 for a record, 0 at the end of the file and -1 if it is cut
+ * short. Reads on from rl78_capture_header(), so the file can be a pipe. */
+int rl78_capture_read(FILE *fh, rl78_record_t *record)
+{
+  unsigned char header[RL78_CAPTURE_HEADER];
+  int i;
+
+  i = fread(header, 1, sizeof(header), fh);
+  if (i == 0) {
+    return 0;
+  } else if (i != sizeof(header)) {
+    return -1;
+  }
+
+  record->time = 0;
+  for (i = 0; i < 8; i++) {
+    record->time |= (unsigned long long)header[i] << (i * 8);
+  }
+  record->direction = header[8];
+  record->frame_len = header[9] + (header[10] * 0x100);
+  if (record->frame_len > RL78_FRAME_MAX) {
+    return -1;
+  }
+
+  if (fread(record->frame, 1, record->frame_len, fh) != (size_t)record->frame_len) {
+    return -1;
+  }
+
+  return 1;
+}
+
+
+
+static void programmer_close(rl78_t *rl78)
+{
+  close(rl78->tty_fd);
+  rl78->tty_fd = -1;
+}
+
+
+
+const char *rl78_status_text(int status)
+{
+  switch (status) {
+  case RL78_STATUS_COMMAND_NUMBER_ERROR:
+    return "Command number error";
+  case RL78_STATUS_PARAMETER_ERROR:
+    return "Parameter error";
+  case RL78_STATUS_NORMAL_ACK:
+    return "Normal acknowledgement";
+  case RL78_STATUS_CHECKSUM_ERROR:
+    return "Checksum error";
+  case RL78_STATUS_VERIFY_ERROR:
+    return "Verify error";
+  case RL78_STATUS_PROTECT_ERROR:
+    return "Protect error";
+  case RL78_STATUS_NEGATIVE_ACK:
+    return "Negative acknowledgement";
+  case RL78_STATUS_ERASE_ERROR:
+    return "Erase error";
+  case RL78_STATUS_IVERIFY_BLANK_ERROR:
+    return "Internal verify error or blank check error";
+  case RL78_STATUS_WRITE_ERROR:
+    return "Write error";
+  default:
+    return "Unknown error";
+  }
+}
+
+
+
+const char *rl78_command_text(int command)
+{
+  switch (command) {
+  case RL78_COMMAND_RESET:
+    return "Reset";
+  case RL78_COMMAND_VERIFY:
+    return "Verify";
+  case RL78_COMMAND_BLOCK_ERASE:
+    return "Block erase";
+  case RL78_COMMAND_BLOCK_BLANK_CHECK:
+    return "Block blank check";
+  case RL78_COMMAND_PROGRAMMING:
+    return "Programming";
+  case RL78_COMMAND_BAUD_RATE_SET:
+    return "Baud rate set";
+  case RL78_COMMAND_SECURITY_SET:
+    return "Security set";
+  case RL78_COMMAND_SECURITY_GET:
+    return "Security get";
+  case RL78_COMMAND_SECURITY_RELEASE:
+    return "Security release";
+  case RL78_COMMAND_CHECKSUM:
+    return "Checksum";
+  case RL78_COMMAND_SILICON_SIGNATURE:
+    return "Silicon signature";
+  default:
+    return "Unknown command";
+  }
+}
+
+
+
+/* Of a frame, over the length byte and data_len bytes of data, 0 for 256. */
+int rl78_checksum(unsigned char *data, int data_len)
+{
+  int i, checksum;
+
+  if (data_len == 0) {
+    data_len = 0x100;
+  }
+
+  checksum = (0 - data_len);
+  for (i = 0; i < data_len; i++) {
+    checksum -= data[i];
+  }
+
+  return checksum & 0xff;
+}
+
+
+
+static int frame_is_complete(unsigned char *frame, int frame_len)
+{
+  int internal_frame_len;
+
+  if (frame_len < 5) {
+    return 0;
+  }
+
+  if (frame[1] == 0) {
+    internal_frame_len = 0x100;
+  } else {
+    internal_frame_len = frame[1];
+  }
+
+  if (internal_frame_len == (frame_len - 4)) {
+    return 1;
+  } else {
+    return 0;
+  }
+}
+
+
+
+/* One line per frame, formatted after the frame has been sent or received. */
+static void frame_print(rl78_t *rl78, const char *prefix, unsigned char *frame, int frame_len)
+{
+  char line[4 + (RL78_FRAME_MAX * 3) + 1];
+  int i, len;
+
+  if (rl78->print_traffic == 0) {
+    return;
+  }
+
+  len = sprintf(line, "%s", prefix);
+  for (i = 0; i < frame_len && i < RL78_FRAME_MAX; i++) {
+    len += sprintf(&line[len], "%02x ", frame[i]);
+  }
+  puts(line);
+}
+
+
+
+static int frame_send(rl78_t *rl78, unsigned char *frame, int frame_len)
+{
+  int result;
+
+  capture_record(rl78, RL78_CAPTURE_SENT, frame, frame_len);
+
+  result = write(rl78->tty_fd, frame, frame_len);
+  if (result == -1) {
+    rl78_error_set(rl78, "write() failed: %s", strerror(errno));
+    return -1;
+  }
+
+  frame_print(rl78, ">>> ", frame, frame_len);
+
+  return frame_len;
+}
+
+
+
+static int frame_recv(rl78_t *rl78, unsigned char *frame, int frame_len_max)
+{
+  int result, frame_len, checksum;
+  unsigned char byte;
+
+  frame_len = 0;
+  while (1) {
+    /* Fails the command, so the caller shuts down and the capture is
+     * written out instead of being lost with the process. */
+    if (rl78->interrupted) {
+      rl78_error_set(rl78, "frame_recv() failed: Interrupted");
+      return -1;
+    }
+
+    result = read(rl78->tty_fd, &byte, 1);
+    if (result == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        rl78_error_set(rl78, "read() failed: %s", strerror(errno));
+        return -1;
+      }
+
+    } else if (result > 0) {
+      if (frame_len == frame_len_max) {
+        rl78_error_set(rl78, "frame_recv() failed: Overflow");
+        return -1;
+      }
+
+      frame[frame_len++] = byte;
+
+      if (frame_is_complete(frame, frame_len)) {
+        break;
+      }
+    }
+
+    usleep(10);
+  }
+
+  capture_record(rl78, RL78_CAPTURE_RECEIVED, frame, frame_len);
+  frame_print(rl78, "<<< ", frame, frame_len);
+
+  checksum = rl78_checksum(&frame[2], frame[1]);
+  if (checksum != frame[frame_len - 2]) {
+    rl78_error_set(rl78, "frame_recv() failed: Checksum incorrect");
+    return -1;
+  }
+
+  return frame_len;
+}
+
+
+
+int command_baud_rate_set(rl78_t *rl78, rl78_mode_t *mode)
+{
+  int cmd_frame_len;
+  unsigned char cmd_frame[8];
+  unsigned char status_frame[8];
+
+  cmd_frame_len = 0;
+  cmd_frame[cmd_frame_len++] = 0x01; /* Command Frame Header */
+  cmd_frame[cmd_frame_len++] = 0x03; /* Command Information Length */
+  cmd_frame[cmd_frame_len++] = RL78_COMMAND_BAUD_RATE_SET;
+  cmd_frame[cmd_frame_len++] = 0x00; /* Baud rate setting = 115200 */
+  cmd_frame[cmd_frame_len++] = 0x21; /* Voltage setting = 3.3V */
+  cmd_frame[cmd_frame_len++] = rl78_checksum(&cmd_frame[2], cmd_frame[1]);
+  cmd_frame[cmd_frame_len++] = 0x03; /* Command Frame Footer */
+
+  if (frame_send(rl78, cmd_frame, cmd_frame_len) < 0) {
+    return -1;
+  }
+
+  if (frame_recv(rl78, status_frame, sizeof(status_frame)) < 0) {
+    return -1;
+  }
+
+  if (status_frame[2] != RL78_STATUS_NORMAL_ACK) {
+    rl78_error_set(rl78, "command_baud_rate_set() failed: %s (0x%02x)",
+      rl78_status_text(status_frame[2]), status_frame[2]);
+    return -1;
+  }
+
+  mode->frequency = status_frame[3];
+  mode->wide_voltage = status_frame[4];
+
+  return 0;
+}
+
+
+
+int command_reset(rl78_t *rl78)
+{
+  int cmd_frame_len;
+  unsigned char cmd_frame[8];
+  unsigned char status_frame[8];
+
+  cmd_frame_len = 0;
+  cmd_frame[cmd_frame_len++] = 0x01; /* Command Frame Header */
+  cmd_frame[cmd_frame_len++] = 0x01; /* Command Information Length */
+  cmd_frame[cmd_frame_len++] = RL78_COMMAND_RESET;
+  cmd_frame[cmd_frame_len++] = rl78_checksum(&cmd_frame[2], cmd_frame[1]);
+  cmd_frame[cmd_frame_len++] = 0x03; /* Command Frame Footer */
+
+  if (frame_send(rl78, cmd_frame, cmd_frame_len) < 0) {
+    return -1;
+  }
+
+  if (frame_recv(rl78, status_frame, sizeof(status_frame)) < 0) {
+    return -1;
+  }
+
+  if (status_frame[2] != RL78_STATUS_NORMAL_ACK) {
+    rl78_error_set(rl78, "command_reset() failed: %s (0x%02x)",
+      rl78_status_text(status_frame[2]), status_frame[2]);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+
+int command_silicon_signature(rl78_t *rl78, rl78_signature_t *signature)
+{
+  int cmd_frame_len, status_frame_len, data_frame_len;
+  unsigned char cmd_frame[8];
+  unsigned char status_frame[8];
+  unsigned char data_frame[32];
+
+  cmd_frame_len = 0;
+  cmd_frame[cmd_frame_len++] = 0x01; /* Command Frame Header */
+  cmd_frame[cmd_frame_len++] = 0x01; /* Command Information Length */
+  cmd_frame[cmd_frame_len++] = RL78_COMMAND_SILICON_SIGNATURE;
+  cmd_frame[cmd_frame_len++] = rl78_checksum(&cmd_frame[2], cmd_frame[1]);
+  cmd_frame[cmd_frame_len++] = 0x03; /* Command Frame Footer */
+
+  if (frame_send(rl78, cmd_frame, cmd_frame_len) < 0) {
+    return -1;
+  }
+
+  if ((status_frame_len = frame_recv(rl78, status_frame, sizeof(status_frame))) < 0) {
+    return -1;
+  }
+
+  if (status_frame[2] != RL78_STATUS_NORMAL_ACK) {
+    rl78_error_set(rl78, "command_silicon_signature() failed: %s (0x%02x)",
+      rl78_status_text(status_frame[2]), status_frame[2]);
+    return -1;
+  }
+
+  if ((data_frame_len = frame_recv(rl78, data_frame, sizeof(data_frame))) < 0) {
+    return -1;
+  }
+
+  memcpy(signature->device_code, &data_frame[2], 3);
+  memcpy(signature->device_name, &data_frame[5], 10);
+  signature->device_name[10] = '\0';
+  signature->code_flash_end = data_frame[15] + (data_frame[16] * 0x100UL) + (data_frame[17] * 0x10000UL);
+  signature->data_flash_end = data_frame[18] + (data_frame[19] * 0x100UL) + (data_frame[20] * 0x10000UL);
+  memcpy(signature->firmware_version, &data_frame[21], 3);
+
+  return 0;
+}
+
+
+
+int command_block_erase(rl78_t *rl78, int block_no)
+{
+  int cmd_frame_len, status_frame_len, start_address;
+  unsigned char cmd_frame[16];
+  unsigned char status_frame[8];
+
+  start_address = block_no * RL78_BLOCK_SIZE;
+
+  cmd_frame_len = 0;
+  cmd_frame[cmd_frame_len++] = 0x01; /* Command Frame Header */
+  cmd_frame[cmd_frame_len++] = 0x04; /* Command Information Length */
+  cmd_frame[cmd_frame_len++] = RL78_COMMAND_BLOCK_ERASE;
+  cmd_frame[cmd_frame_len++] = (start_address & 0xff);         /* Start Address, Low */
+  cmd_frame[cmd_frame_len++] = ((start_address >> 8) & 0xff);  /* Start Address, Middle */
+  cmd_frame[cmd_frame_len++] = ((start_address >> 16) & 0xff); /* Start Address, High */
+  cmd_frame[cmd_frame_len++] = rl78_checksum(&cmd_frame[2], cmd_frame[1]);
+  cmd_frame[cmd_frame_len++] = 0x03; /* Command Frame Footer */
+
+  if (frame_send(rl78, cmd_frame, cmd_frame_len) < 0) {
+    return -1;
+  }
+
+  if ((status_frame_len = frame_recv(rl78, status_frame, sizeof(status_frame))) < 0) {
+    return -1;
+  }
+
+  if (status_frame[2] != RL78_STATUS_NORMAL_ACK) {
+    rl78_error_set(rl78, "command_block_erase() failed: %s (0x%02x)",
+      rl78_status_text(status_frame[2]), status_frame[2]);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+
+int command_programming(rl78_t *rl78, int first_block_no, unsigned char *block_data, int no_of_blocks)
+{
+  int cmd_frame_len, status_frame_len, data_frame_len, start_address, end_address, offset;
+  unsigned char cmd_frame[16];
+  unsigned char status_frame[8];
+  unsigned char data_frame[264];
+
+  start_address = first_block_no * RL78_BLOCK_SIZE;
+  end_address = ((first_block_no + no_of_blocks) * RL78_BLOCK_SIZE) - 1;
+
+  cmd_frame_len = 0;
+  cmd_frame[cmd_frame_len++] = 0x01; /* Command Frame Header */
+  cmd_frame[cmd_frame_len++] = 0x07; /* Command Information Length */
+  cmd_frame[cmd_frame_len++] = RL78_COMMAND_PROGRAMMING;
+  cmd_frame[cmd_frame_len++] = (start_address & 0xff);         /* Start Address, Low */
+  cmd_frame[cmd_frame_len++] = ((start_address >> 8) & 0xff);  /* Start Address, Middle */
+  cmd_frame[cmd_frame_len++] = ((start_address >> 16) & 0xff); /* Start Address, High */
+  cmd_frame[cmd_frame_len++] = (end_address & 0xff);         /* End Address, Low */
+  cmd_frame[cmd_frame_len++] = ((end_address >> 8) & 0xff);  /* End Address, Middle */
+  cmd_frame[cmd_frame_len++] = ((end_address >> 16) & 0xff); /* End Address, High */
+  cmd_frame[cmd_frame_len++] = rl78_checksum(&cmd_frame[2], cmd_frame[1]);
+  cmd_frame[cmd_frame_len++] = 0x03; /* Command Frame Footer */
+
+  if (frame_send(rl78, cmd_frame, cmd_frame_len) < 0) {
+    return -1;
+  }
+
+  if (frame_recv(rl78, status_frame, sizeof(status_frame)) < 0) {
+    return -1;
+  }
+
+  if (status_frame[2] != RL78_STATUS_NORMAL_ACK) {
+    rl78_error_set(rl78, "command_programming() failed: %s (0x%02x)",
+      rl78_status_text(status_frame[2]), status_frame[2]);
+    return -1;
+  }
+
+  for (offset = 0; offset < (no_of_blocks * RL78_BLOCK_SIZE); offset += 256) {
+
+    data_frame_len = 0;
+    data_frame[data_frame_len++] = 0x02; /* Data Frame Header */
+    data_frame[data_frame_len++] = 0x00; /* Data Length, Always 0x00 = 256 Bytes */
+    memcpy(&data_frame[2], &block_data[offset], 256);
+    data_frame_len += 256;
+    data_frame[data_frame_len++] = rl78_checksum(&data_frame[2], data_frame[1]);
+
+    if ((offset + 256) >= (no_of_blocks * RL78_BLOCK_SIZE)) {
+      data_frame[data_frame_len++] = 0x03; /* Data Frame Footer, End of Data */
+    } else {
+      data_frame[data_frame_len++] = 0x17; /* Data Frame Footer, More To Be Sent */
+    }
+
+    if (frame_send(rl78, data_frame, data_frame_len) < 0) {
+      return -1;
+    }
+
+    if ((status_frame_len = frame_recv(rl78, status_frame, sizeof(status_frame))) < 0) {
+      return -1;
+    }
+
+    if (status_frame[2] != RL78_STATUS_NORMAL_ACK) {
+      rl78_error_set(rl78, "command_programming() failed: %s (0x%02x)",
+        rl78_status_text(status_frame[2]), status_frame[2]);
+      return -1;
+    }
+  }
+
+  if ((status_frame_len = frame_recv(rl78, status_frame, sizeof(status_frame))) < 0) {
+    return -1;
+  }
+
+  if (status_frame[2] != RL78_STATUS_NORMAL_ACK) {
+    rl78_error_set(rl78, "command_programming() failed: %s (0x%02x)",
+      rl78_status_text(status_frame[2]), status_frame[2]);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+
+int command_checksum(rl78_t *rl78, int first_block_no, int no_of_blocks)
+{
+  int cmd_frame_len, status_frame_len, data_frame_len, start_address, end_address;
+  unsigned char cmd_frame[16];
+  unsigned char status_frame[8];
+  unsigned char data_frame[8];
+
+  start_address = first_block_no * RL78_BLOCK_SIZE;
+  end_address = ((first_block_no + no_of_blocks) * RL78_BLOCK_SIZE) - 1;
+
+  cmd_frame_len = 0;
+  cmd_frame[cmd_frame_len++] = 0x01; /* Command Frame Header */
+  cmd_frame[cmd_frame_len++] = 0x07; /* Command Information Length */
+  cmd_frame[cmd_frame_len++] = RL78_COMMAND_CHECKSUM;
+  cmd_frame[cmd_frame_len++] = (start_address & 0xff);         /* Start Address, Low */
+  cmd_frame[cmd_frame_len++] = ((start_address >> 8) & 0xff);  /* Start Address, Middle */
+  cmd_frame[cmd_frame_len++] = ((start_address >> 16) & 0xff); /* Start Address, High */
+  cmd_frame[cmd_frame_len++] = (end_address & 0xff);         /* End Address, Low */
+  cmd_frame[cmd_frame_len++] = ((end_address >> 8) & 0xff);  /* End Address, Middle */
+  cmd_frame[cmd_frame_len++] = ((end_address >> 16) & 0xff); /* End Address, High */
+  cmd_frame[cmd_frame_len++] = rl78_checksum(&cmd_frame[2], cmd_frame[1]);
+  cmd_frame[cmd_frame_len++] = 0x03; /* Command Frame Footer */
+
+  if (frame_send(rl78, cmd_frame, cmd_frame_len) < 0) {
+    return -1;
+  }
+
+  if ((status_frame_len = frame_recv(rl78, status_frame, sizeof(status_frame))) < 0) {
+    return -1;
+  }
+
+  if (status_frame[2] != RL78_STATUS_NORMAL_ACK) {
+    rl78_error_set(rl78, "command_checksum() failed: %s (0x%02x)",
+      rl78_status_text(status_frame[2]), status_frame[2]);
+    return -1;
+  }
+
+  if ((data_frame_len = frame_recv(rl78, data_frame, sizeof(data_frame))) < 0) {
+    return -1;
+  }
+
+  return data_frame[2] + (data_frame[3] * 0x100);
+}
+
+
+
+int command_verify(rl78_t *rl78, int first_block_no, unsigned char *block_data, int no_of_blocks)
+{
+  int cmd_frame_len, status_frame_len, data_frame_len, start_address, end_address, offset;
+  unsigned char cmd_frame[16];
+  unsigned char status_frame[8];
+  unsigned char data_frame[264];
+
+  start_address = first_block_no * RL78_BLOCK_SIZE;
+  end_address = ((first_block_no + no_of_blocks) * RL78_BLOCK_SIZE) - 1;
+
+  cmd_frame_len = 0;
+  cmd_frame[cmd_frame_len++] = 0x01; /* Command Frame Header */
+  cmd_frame[cmd_frame_len++] = 0x07; /* Command Information Length */
+  cmd_frame[cmd_frame_len++] = RL78_COMMAND_VERIFY;
+  cmd_frame[cmd_frame_len++] = (start_address & 0xff);         /* Start Address, Low */
+  cmd_frame[cmd_frame_len++] = ((start_address >> 8) & 0xff);  /* Start Address, Middle */
+  cmd_frame[cmd_frame_len++] = ((start_address >> 16) & 0xff); /* Start Address, High */
+  cmd_frame[cmd_frame_len++] = (end_address & 0xff);         /* End Address, Low */
+  cmd_frame[cmd_frame_len++] = ((end_address >> 8) & 0xff);  /* End Address, Middle */
+  cmd_frame[cmd_frame_len++] = ((end_address >> 16) & 0xff); /* End Address, High */
+  cmd_frame[cmd_frame_len++] = rl78_checksum(&cmd_frame[2], cmd_frame[1]);
+  cmd_frame[cmd_frame_len++] = 0x03; /* Command Frame Footer */
+
+  if (frame_send(rl78, cmd_frame, cmd_frame_len) < 0) {
+    return -1;
+  }
+
+  if (frame_recv(rl78, status_frame, sizeof(status_frame)) < 0) {
+    return -1;
+  }
+
+  if (status_frame[2] != RL78_STATUS_NORMAL_ACK) {
+    rl78_error_set(rl78, "command_verify() failed: %s (0x%02x)",
+      rl78_status_text(status_frame[2]), status_frame[2]);
+    return -1;
+  }
+
+  for (offset = 0; offset < (no_of_blocks * RL78_BLOCK_SIZE); offset += 256) {
+
+    data_frame_len = 0;
+    data_frame[data_frame_len++] = 0x02; /* Data Frame Header */
+    data_frame[data_frame_len++] = 0x00; /* Data Length, Always 0x00 = 256 Bytes */
+    memcpy(&data_frame[2], &block_data[offset], 256);
+    data_frame_len += 256;
+    data_frame[data_frame_len++] = rl78_checksum(&data_frame[2], data_frame[1]);
+
+    if ((offset + 256) >= (no_of_blocks * RL78_BLOCK_SIZE)) {
+      data_frame[data_frame_len++] = 0x03; /* Data Frame Footer, End of Data */
+    } else {
+      data_frame[data_frame_len++] = 0x17; /* Data Frame Footer, More To Be Sent */
+    }
+
+    if (frame_send(rl78, data_frame, data_frame_len) < 0) {
+      return -1;
+    }
+
+    if ((status_frame_len = frame_recv(rl78, status_frame, sizeof(status_frame))) < 0) {
+      return -1;
+    }
+
+    if (status_frame[2] != RL78_STATUS_NORMAL_ACK) {
+      rl78_error_set(rl78, "command_verify() failed: %s (0x%02x)",
+        rl78_status_text(status_frame[2]), status_frame[2]);
+      return -1;
+    }
+    if (status_frame[3] != RL78_STATUS_NORMAL_ACK) {
+      rl78_error_set(rl78, "command_verify() failed: %s (0x%02x)",
+        rl78_status_text(status_frame[3]), status_frame[3]);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+
+
+int command_block_blank_check(rl78_t *rl78, int first_block_no, int no_of_blocks)
+{
+  int cmd_frame_len, start_address, end_address;
+  unsigned char cmd_frame[16];
+  unsigned char status_frame[8];
+
+  start_address = first_block_no * RL78_BLOCK_SIZE;
+  end_address = ((first_block_no + no_of_blocks) * RL78_BLOCK_SIZE) - 1;
+
+  cmd_frame_len = 0;
+  cmd_frame[cmd_frame_len++] = 0x01; /* Command Frame Header */
+  cmd_frame[cmd_frame_len++] = 0x08; /* Command Information Length */
+  cmd_frame[cmd_frame_len++] = RL78_COMMAND_BLOCK_BLANK_CHECK;
+  cmd_frame[cmd_frame_len++] = (start_address & 0xff);         /* Start Address, Low */
+  cmd_frame[cmd_frame_len++] = ((start_address >> 8) & 0xff);  /* Start Address, Middle */
+  cmd_frame[cmd_frame_len++] = ((start_address >> 16) & 0xff); /* Start Address, High */
+  cmd_frame[cmd_frame_len++] = (end_address & 0xff);         /* End Address, Low */
+  cmd_frame[cmd_frame_len++] = ((end_address >> 8) & 0xff);  /* End Address, Middle */
+  cmd_frame[cmd_frame_len++] = ((end_address >> 16) & 0xff); /* End Address, High */
+  cmd_frame[cmd_frame_len++] = 0x00; /* Specified Block */
+  cmd_frame[cmd_frame_len++] = rl78_checksum(&cmd_frame[2], cmd_frame[1]);
+  cmd_frame[cmd_frame_len++] = 0x03; /* Command Frame Footer */
+
+  if (frame_send(rl78, cmd_frame, cmd_frame_len) < 0) {
+    return -1;
+  }
+
+  if (frame_recv(rl78, status_frame, sizeof(status_frame)) < 0) {
+    return -1;
+  }
+
+  switch (status_frame[2]) {
+  case RL78_STATUS_NORMAL_ACK:
+    return 0; /* Blocks are free. */
+  case RL78_STATUS_IVERIFY_BLANK_ERROR:
+    return 1; /* Blocks are occupied. */
+  default:
+    rl78_error_set(rl78, "command_block_blank_check() failed: %s (0x%02x)",
+      rl78_status_text(status_frame[2]), status_frame[2]);
+    return -1;
+  }
+}
+
+
+
+int programmer_init(rl78_t *rl78, char *tty_device)
+{
+  int result, modem;
+  struct termios tio;
+  unsigned int bits;
+
+  rl78->tty_fd = open(tty_device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (rl78->tty_fd == -1) {
+    rl78_error_set(rl78, "open(%s) failed: %s", tty_device, strerror(errno));
+    return -1;
+  }
+ 
+  memset(&tio, '\0', sizeof(tio));
+  tio.c_cflag = CS8 | CSTOPB | CREAD;
+  tio.c_iflag = IGNPAR;
+  tio.c_oflag = 0;
+  tio.c_lflag = 0;
+  cfsetispeed(&tio, B115200);
+  cfsetospeed(&tio, B115200);
+  result = tcsetattr(rl78->tty_fd, TCSANOW, &tio);
+  if (result == -1) {
+    rl78_error_set(rl78, "tcsetattr() failed: %s", strerror(errno));
+    programmer_close(rl78);
+    return -1;
+  }
+
+  /* Pseudo terminals, such as the one of kurumi-bench, have no modem
+   * lines, so there is no reset to pulse. */
+  modem = 1;
+  result = ioctl(rl78->tty_fd, TIOCMGET, &bits);
+  if (result == -1) {
+    if (errno != ENOTTY && errno != EINVAL) {
+      rl78_error_set(rl78, "ioctl() failed: %s", strerror(errno));
+      programmer_close(rl78);
+      return -1;
+    }
+    modem = 0;
+  }
+
+  /* Set DTR (Reset Signal). */
+  bits |= TIOCM_DTR;
+  result = modem ? ioctl(rl78->tty_fd, TIOCMSET, &bits) : 0;
+  if (result == -1) {
+    rl78_error_set(rl78, "ioctl() failed: %s", strerror(errno));
+    programmer_close(rl78);
+    return -1;
+  }
+
+  /* Turn on break. */
+  result = ioctl(rl78->tty_fd, TIOCSBRK, NULL);
+  if (result == -1) {
+    rl78_error_set(rl78, "ioctl() failed: %s", strerror(errno));
+    programmer_close(rl78);
+    return -1;
+  }
+
+  tcflush(rl78->tty_fd, TCIOFLUSH);
+
+  /* Clear DTR (Reset Signal). */
+  bits &= (~TIOCM_DTR);
+  result = modem ? ioctl(rl78->tty_fd, TIOCMSET, &bits) : 0;
+  if (result == -1) {
+    rl78_error_set(rl78, "ioctl() failed: %s", strerror(errno));
+    programmer_close(rl78);
+    return -1;
+  }
+
+  usleep(1000);
+
+  /* Turn off break. */
+  result = ioctl(rl78->tty_fd, TIOCCBRK, NULL);
+  if (result == -1) {
+    rl78_error_set(rl78, "ioctl() failed: %s", strerror(errno));
+    programmer_close(rl78);
+    return -1;
+  }
+
+  tcflush(rl78->tty_fd, TCIOFLUSH);
+
+  usleep(1000);
+
+  /* Setup Two-wire UART mode. */
+  result = write(rl78->tty_fd, "\x00", 1);
+  if (result == -1) {
+    rl78_error_set(rl78, "write() failed: %s", strerror(errno));
+    programmer_close(rl78);
+    return -1;
+  } else if (result == 0) {
+    rl78_error_set(rl78, "write() failed: Nothing written");
+    programmer_close(rl78);
+    return -1;
+  }
+
+  usleep(1000);
+
+  tcflush(rl78->tty_fd, TCIOFLUSH);
+
+  return 0;
+}
+
+
+
+void programmer_shutdown(rl78_t *rl78)
+{
+  int result;
+  unsigned int bits = 0;
+
+  result = ioctl(rl78->tty_fd, TIOCMGET, &bits);
+  if (result == -1) {
+    if (errno != ENOTTY && errno != EINVAL) { /* Otherwise no modem lines. */
+      rl78_error_set(rl78, "ioctl() failed: %s", strerror(errno));
+    }
+    programmer_close(rl78);
+    return;
+  }
+
+  /* Set DTR (Reset Signal). */
+  bits |= TIOCM_DTR;
+  result = ioctl(rl78->tty_fd, TIOCMSET, &bits);
+  if (result == -1) {
+    rl78_error_set(rl78, "ioctl() failed: %s", strerror(errno));
+  }
+
+  usleep(1000);
+
+  /* Clear DTR (Reset Signal). */
+  bits &= (~TIOCM_DTR);
+  result = ioctl(rl78->tty_fd, TIOCMSET, &bits);
+  if (result == -1) {
+    rl78_error_set(rl78, "ioctl() failed: %s", strerror(errno));
+  }
+
+  programmer_close(rl78);
+}
+
+
+
+int rl78_write(rl78_t *rl78, int first_block_no, unsigned char *data, int data_len, int verify_only)
+{
+  int i, offset, block_len, block_no, result, checksum;
+  int total;
+  unsigned char block_data[RL78_BLOCK_SIZE];
+
+  total = (data_len + RL78_BLOCK_SIZE - 1) / RL78_BLOCK_SIZE;
+
+  checksum = 0;
+  block_no = first_block_no;
+  for (offset = 0; offset < data_len; offset += RL78_BLOCK_SIZE) {
+    block_len = data_len - offset;
+    if (block_len > RL78_BLOCK_SIZE) {
+      block_len = RL78_BLOCK_SIZE;
+    }
+    memcpy(block_data, &data[offset], block_len);
+
+    /* Pad remaining data with 0xff */
+    while (block_len < RL78_BLOCK_SIZE) {
+      block_data[block_len++] = 0xff;
+    }
+
+    for (i = 0; i < RL78_BLOCK_SIZE; i++) {
+      checksum -= block_data[i];
+    }
+
+    if (verify_only == 0) {
+      result = command_block_blank_check(rl78, block_no, 1);
+      if (result == -1) {
+        return -1;
+
+      } else if (result == 1) {
+        if (command_block_erase(rl78, block_no) != 0) {
+          return -1;
+        }
+      }
+
+      if (command_programming(rl78, block_no, block_data, 1) != 0) {
+        return -1;
+      }
+    }
+
+    if (command_verify(rl78, block_no, block_data, 1) != 0) {
+      return -1;
+    }
+
+    block_no += 1;
+
+    if (rl78->progress != NULL) {
+      rl78->progress(rl78->progress_data, block_no - 1, block_no - first_block_no, total);
+    }
+  }
+
+  return checksum & 0xffff;
+}
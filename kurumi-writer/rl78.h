@@ -0,0 +1,109 @@
+#ifndef _RL78_H
+#define _RL78_H
+
+/* RL78 Protocol A, see Renesas application note R01AN0815EJ0100. All
+ * state is kept in a context handle, so several programmers can be used
+ * from the same process. Functions returning int give -1 on failure, with
+ * the reason available from rl78_error(). */
+
+#include <stdio.h>
+
+#define RL78_BLOCK_SIZE 1024 /* In bytes. */
+#define RL78_FRAME_MAX 260 /* Data frame of 256 bytes. */
+
+typedef enum {
+  RL78_COMMAND_RESET             = 0x00,
+  RL78_COMMAND_VERIFY            = 0x13,
+  RL78_COMMAND_BLOCK_ERASE       = 0x22,
+  RL78_COMMAND_BLOCK_BLANK_CHECK = 0x32,
+  RL78_COMMAND_PROGRAMMING       = 0x40,
+  RL78_COMMAND_BAUD_RATE_SET     = 0x9a,
+  RL78_COMMAND_SECURITY_SET      = 0xa0,
+  RL78_COMMAND_SECURITY_GET      = 0xa1,
+  RL78_COMMAND_SECURITY_RELEASE  = 0xa2,
+  RL78_COMMAND_CHECKSUM          = 0xb0,
+  RL78_COMMAND_SILICON_SIGNATURE = 0xc0,
+} RL78_COMMAND;
+
+typedef enum {
+  RL78_STATUS_COMMAND_NUMBER_ERROR = 0x04,
+  RL78_STATUS_PARAMETER_ERROR      = 0x05,
+  RL78_STATUS_NORMAL_ACK           = 0x06,
+  RL78_STATUS_CHECKSUM_ERROR       = 0x07,
+  RL78_STATUS_VERIFY_ERROR         = 0x0f,
+  RL78_STATUS_PROTECT_ERROR        = 0x10,
+  RL78_STATUS_NEGATIVE_ACK         = 0x15,
+  RL78_STATUS_ERASE_ERROR          = 0x1a,
+  RL78_STATUS_IVERIFY_BLANK_ERROR  = 0x1b,
+  RL78_STATUS_WRITE_ERROR          = 0x1c,
+} RL78_STATUS;
+
+/* Traffic capture, written by rl78_capture_open(): the magic below, then
+ * a record per frame sent or received. Each record has the time as 8
+ * bytes of CLOCK_MONOTONIC nanoseconds, a direction byte and the frame
+ * length as 2 bytes, all little-endian, followed by the raw frame. */
+#define RL78_CAPTURE_MAGIC "RL78CAP1"
+
+typedef enum {
+  RL78_CAPTURE_SENT     = 0,
+  RL78_CAPTURE_RECEIVED = 1,
+} RL78_CAPTURE;
+
+typedef struct {
+  unsigned long long time; /* In nanoseconds. */
+  int direction;
+  int frame_len;
+  unsigned char frame[RL78_FRAME_MAX];
+} rl78_record_t;
+
+typedef struct rl78_context rl78_t;
+
+/* Answer to the baud rate set command. */
+typedef struct {
+  int frequency; /* In MHz. */
+  int wide_voltage; /* Full-speed mode if 0. */
+} rl78_mode_t;
+
+/* Answer to the silicon signature command. */
+typedef struct {
+  unsigned char device_code[3];
+  char device_name[11]; /* Nul terminated. */
+  unsigned long code_flash_end;
+  unsigned long data_flash_end;
+  unsigned char firmware_version[3];
+} rl78_signature_t;
+
+/* Called by rl78_write() after each block, with the number of blocks
+ * done out of the total. */
+typedef void (*rl78_progress_t)(void *data, int block_no, int done, int total);
+
+rl78_t *rl78_new(void);
+void rl78_free(rl78_t *rl78);
+void rl78_traffic_set(rl78_t *rl78, int enable);
+void rl78_progress_set(rl78_t *rl78, rl78_progress_t progress, void *data);
+void rl78_interrupt(rl78_t *rl78);
+const char *rl78_error(rl78_t *rl78);
+const char *rl78_status_text(int status);
+const char *rl78_command_text(int command);
+int rl78_checksum(unsigned char *data, int data_len);
+
+int rl78_capture_open(rl78_t *rl78, const char *filename);
+int rl78_capture_close(rl78_t *rl78);
+int rl78_capture_header(FILE *fh);
+int rl78_capture_read(FILE *fh, rl78_record_t *record);
+
+int programmer_init(rl78_t *rl78, char *tty_device);
+void programmer_shutdown(rl78_t *rl78);
+
+int command_baud_rate_set(rl78_t *rl78, rl78_mode_t *mode);
+int command_reset(rl78_t *rl78);
+int command_silicon_signature(rl78_t *rl78, rl78_signature_t *signature);
+int command_block_erase(rl78_t *rl78, int block_no);
+int command_programming(rl78_t *rl78, int first_block_no, unsigned char *block_data, int no_of_blocks);
+int command_checksum(rl78_t *rl78, int first_block_no, int no_of_blocks);
+int command_verify(rl78_t *rl78, int first_block_no, unsigned char *block_data, int no_of_blocks);
+int command_block_blank_check(rl78_t *rl78, int first_block_no, int no_of_blocks);
+
+int rl78_write(rl78_t *rl78, int first_block_no, unsigned char *data, int data_len, int verify_only);
+
+#endif /* _RL78_H */
@@ -0,0 +1,134 @@
+# Python binding for librl78.so, the RL78 Protocol A programmer library of
+# Kurumi Writer. Build it with "make" first.
+#
+#	import rl78
+#	with rl78.RL78("/dev/ttyUSB0") as chip:
+#		print(chip.signature()["name"])
+#		checksum = chip.write(open("kurumi.bin", "rb").read(),
+#			progress=lambda block, done, total: print(done, total))
+
+import ctypes
+import os
+
+BLOCK_SIZE = 1024
+
+class RL78Error(Exception):
+	pass
+
+class _Mode(ctypes.Structure):
+	_fields_ = [
+		("frequency", ctypes.c_int),
+		("wide_voltage", ctypes.c_int),
+	]
+
+class _Signature(ctypes.Structure):
+	_fields_ = [
+		("device_code", ctypes.c_ubyte * 3),
+		("device_name", ctypes.c_char * 11),
+		("code_flash_end", ctypes.c_ulong),
+		("data_flash_end", ctypes.c_ulong),
+		("firmware_version", ctypes.c_ubyte * 3),
+	]
+
+_PROGRESS = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.c_int, ctypes.c_int, ctypes.c_int)
+
+_lib = ctypes.CDLL(os.path.join(os.path.dirname(os.path.abspath(__file__)), "librl78.so"))
+_lib.rl78_new.restype = ctypes.c_void_p
+_lib.rl78_new.argtypes = []
+_lib.rl78_free.argtypes = [ctypes.c_void_p]
+_lib.rl78_traffic_set.argtypes = [ctypes.c_void_p, ctypes.c_int]
+_lib.rl78_progress_set.argtypes = [ctypes.c_void_p, _PROGRESS, ctypes.c_void_p]
+_lib.rl78_error.restype = ctypes.c_char_p
+_lib.rl78_error.argtypes = [ctypes.c_void_p]
+_lib.rl78_capture_open.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+_lib.rl78_capture_close.argtypes = [ctypes.c_void_p]
+_lib.programmer_init.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+_lib.programmer_shutdown.argtypes = [ctypes.c_void_p]
+_lib.command_baud_rate_set.argtypes = [ctypes.c_void_p, ctypes.POINTER(_Mode)]
+_lib.command_reset.argtypes = [ctypes.c_void_p]
+_lib.command_silicon_signature.argtypes = [ctypes.c_void_p, ctypes.POINTER(_Signature)]
+_lib.command_checksum.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int]
+_lib.command_block_blank_check.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int]
+_lib.command_block_erase.argtypes = [ctypes.c_void_p, ctypes.c_int]
+_lib.rl78_write.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_char_p, ctypes.c_int, ctypes.c_int]
+
+class RL78:
+	"""A chip in its bootloader, entered through DTR and break on open."""
+
+	def __init__(self, port, traffic=False, capture=None):
+		"""capture is a file to record the traffic in, see kurumi-decode."""
+		self._progress = None
+		self._handle = _lib.rl78_new()
+		if not self._handle:
+			raise MemoryError()
+		_lib.rl78_traffic_set(self._handle, traffic)
+		if (capture and _lib.rl78_capture_open(self._handle, capture.encode()) != 0) or \
+		   _lib.programmer_init(self._handle, port.encode()) != 0:
+			error = _lib.rl78_error(self._handle).decode()
+			_lib.rl78_free(self._handle)
+			self._handle = None
+			raise RL78Error(error)
+		try:
+			mode = _Mode()
+			self._check(_lib.command_baud_rate_set(self._handle, ctypes.byref(mode)))
+			self.frequency = mode.frequency
+			self.wide_voltage = bool(mode.wide_voltage)
+			self._check(_lib.command_reset(self._handle))
+		except RL78Error:
+			self.close()
+			raise
+
+	def __enter__(self):
+		return self
+
+	def __exit__(self, *args):
+		self.close()
+
+	def _check(self, result):
+		if result == -1:
+			raise RL78Error(_lib.rl78_error(self._handle).decode())
+		return result
+
+	def close(self):
+		"""Reset the chip out of its bootloader and free the handle."""
+		if self._handle:
+			_lib.programmer_shutdown(self._handle)
+			_lib.rl78_free(self._handle)
+			self._handle = None
+
+	def signature(self):
+		signature = _Signature()
+		self._check(_lib.command_silicon_signature(self._handle, ctypes.byref(signature)))
+		return {
+			"code": bytes(signature.device_code),
+			"name": signature.device_name.decode("latin-1").strip(),
+			"code_flash_end": signature.code_flash_end,
+			"data_flash_end": signature.data_flash_end,
+			"version": "%d.%d%d" % tuple(signature.firmware_version),
+		}
+
+	def write(self, data, block=0, verify_only=False, progress=None):
+		"""Program and verify data from the given block on, or only verify
+		it. progress(block_no, done, total) is called after each block.
+		Returns the checksum of the padded data, as command_checksum()."""
+		def callback(user, block_no, done, total):
+			progress(block_no, done, total)
+		self._progress = _PROGRESS(callback) if progress else _PROGRESS()
+		try:
+			_lib.rl78_progress_set(self._handle, self._progress, None)
+			return self._check(_lib.rl78_write(self._handle, block, bytes(data), len(data), verify_only))
+		finally:
+			_lib.rl78_progress_set(self._handle, _PROGRESS(), None)
+			self._progress = None
+
+	def verify(self, data, block=0, progress=None):
+		return self.write(data, block, True, progress)
+
+	def checksum(self, block, blocks):
+		return self._check(_lib.command_checksum(self._handle, block, blocks))
+
+	def blank(self, block, blocks=1):
+		return self._check(_lib.command_block_blank_check(self._handle, block, blocks)) == 0
+
+	def erase(self, block):
+		self._check(_lib.command_block_erase(self._handle, block))